@@ -0,0 +1,1869 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "asm_backend.hpp"
+#include "bytecode.hpp"
+#include "string_table.hpp"
+#include "symbol_table.hpp"
+
+// Appended to every program. It preserves rbx and r12-r15 as System V
+// requires, and makes no calls that need the stack aligned.
+static const char runtime[] = R"(
+# Runtime: buffered standard input and output over raw system calls
+rt_getc:
+        movq    rt_in_pos(%rip), %rax
+        cmpq    rt_in_len(%rip), %rax
+        jb      1f
+        xorl    %edi, %edi
+        leaq    rt_in(%rip), %rsi
+        movl    $65536, %edx
+        xorl    %eax, %eax
+        syscall
+        testq   %rax, %rax
+        jle     2f
+        movq    %rax, rt_in_len(%rip)
+        xorl    %eax, %eax
+1:      leaq    rt_in(%rip), %rdx
+        movzbl  (%rdx,%rax), %edx
+        incq    %rax
+        movq    %rax, rt_in_pos(%rip)
+        movl    %edx, %eax
+        ret
+2:      movq    $0, rt_in_len(%rip)
+        movq    $0, rt_in_pos(%rip)
+        movl    $-1, %eax
+        ret
+
+# Push back the character rt_getc returned in eax
+rt_ungetc:
+        cmpl    $-1, %eax
+        je      1f
+        decq    rt_in_pos(%rip)
+1:      ret
+
+# Skip white space; the first other character is left in eax
+rt_skip:
+        call    rt_getc
+        cmpl    $32, %eax
+        je      rt_skip
+        leal    -9(%rax), %edx
+        cmpl    $4, %edx
+        jbe     rt_skip
+        ret
+
+# rax = next integer; rdi, rsi = error message for bad input
+rt_scan_int:
+        pushq   %rbx
+        pushq   %r12
+        pushq   %r13
+        pushq   %r14
+        movq    %rdi, %r13
+        movq    %rsi, %r14
+        xorl    %ebx, %ebx
+        xorl    %r12d, %r12d
+        call    rt_skip
+        cmpl    $45, %eax
+        jne     1f
+        movl    $1, %r12d
+        call    rt_getc
+        jmp     2f
+1:      cmpl    $43, %eax
+        jne     2f
+        call    rt_getc
+2:      leal    -48(%rax), %edx
+        cmpl    $9, %edx
+        ja      5f
+        # Accumulate the negated value so INT64_MIN fits
+3:      imulq   $10, %rbx
+        jo      5f
+        movslq  %edx, %rdx
+        subq    %rdx, %rbx
+        jo      5f
+        call    rt_getc
+        leal    -48(%rax), %edx
+        cmpl    $9, %edx
+        jbe     3b
+        call    rt_ungetc
+        testl   %r12d, %r12d
+        jnz     4f
+        negq    %rbx
+        jo      5f
+4:      movq    %rbx, %rax
+        popq    %r14
+        popq    %r13
+        popq    %r12
+        popq    %rbx
+        ret
+5:      movq    %r13, %rdi
+        movq    %r14, %rsi
+        jmp     rt_error
+
+# rax = next boolean word: true, false, 1 or 0
+rt_scan_bool:
+        pushq   %rbx
+        pushq   %r12
+        pushq   %r13
+        pushq   %r14
+        movq    %rdi, %r13
+        movq    %rsi, %r14
+        xorl    %ebx, %ebx
+        xorl    %r12d, %r12d
+        call    rt_skip
+        cmpl    $-1, %eax
+        je      5f
+        # Pack up to eight characters of the word into rbx
+1:      cmpl    $8, %r12d
+        jae     2f
+        movl    %r12d, %ecx
+        shll    $3, %ecx
+        movzbl  %al, %eax
+        shlq    %cl, %rax
+        orq     %rax, %rbx
+2:      incl    %r12d
+        call    rt_getc
+        cmpl    $-1, %eax
+        je      3f
+        cmpl    $32, %eax
+        je      3f
+        leal    -9(%rax), %edx
+        cmpl    $4, %edx
+        ja      1b
+3:      cmpl    $8, %r12d
+        ja      5f
+        movl    $1, %eax
+        movl    $0x65757274, %edx
+        cmpq    %rdx, %rbx
+        je      4f
+        cmpq    $0x31, %rbx
+        je      4f
+        xorl    %eax, %eax
+        movabsq $0x65736c6166, %rdx
+        cmpq    %rdx, %rbx
+        je      4f
+        cmpq    $0x30, %rbx
+        jne     5f
+4:      popq    %r14
+        popq    %r13
+        popq    %r12
+        popq    %rbx
+        ret
+5:      movq    %r13, %rdi
+        movq    %r14, %rsi
+        jmp     rt_error
+
+# Append rdx bytes at rsi to the output buffer
+rt_write:
+        movq    rt_out_len(%rip), %rax
+        leaq    (%rax,%rdx), %rcx
+        cmpq    $65536, %rcx
+        jbe     1f
+        pushq   %rsi
+        pushq   %rdx
+        call    rt_flush
+        popq    %rdx
+        popq    %rsi
+        xorl    %eax, %eax
+1:      leaq    rt_out(%rip), %rdi
+        addq    %rax, %rdi
+        movq    %rdx, %rcx
+        rep movsb
+        addq    %rdx, rt_out_len(%rip)
+        ret
+
+rt_flush:
+        movq    rt_out_len(%rip), %rdx
+        leaq    rt_out(%rip), %rsi
+1:      testq   %rdx, %rdx
+        jle     2f
+        movl    $1, %edi
+        movl    $1, %eax
+        syscall
+        testq   %rax, %rax
+        jle     2f
+        addq    %rax, %rsi
+        subq    %rax, %rdx
+        jmp     1b
+2:      movq    $0, rt_out_len(%rip)
+        ret
+
+# Print rdi as a decimal line
+rt_print_int:
+        subq    $40, %rsp
+        leaq    32(%rsp), %r8
+        decq    %r8
+        movb    $10, (%r8)
+        movq    %rdi, %rax
+        testq   %rax, %rax
+        jns     1f
+        negq    %rax
+1:      movl    $10, %ecx
+2:      xorl    %edx, %edx
+        divq    %rcx
+        addb    $48, %dl
+        decq    %r8
+        movb    %dl, (%r8)
+        testq   %rax, %rax
+        jnz     2b
+        testq   %rdi, %rdi
+        jns     3f
+        decq    %r8
+        movb    $45, (%r8)
+3:      movq    %r8, %rsi
+        leaq    32(%rsp), %rdx
+        subq    %r8, %rdx
+        call    rt_write
+        addq    $40, %rsp
+        ret
+
+# Print rdi as true or false
+rt_print_bool:
+        leaq    rt_true(%rip), %rsi
+        movl    $5, %edx
+        testq   %rdi, %rdi
+        jnz     rt_write
+        leaq    rt_false(%rip), %rsi
+        movl    $6, %edx
+        jmp     rt_write
+
+# Flush and exit with status edi
+rt_exit:
+        pushq   %rdi
+        call    rt_flush
+        popq    %rdi
+        movl    $231, %eax
+        syscall
+
+# Report the rsi-byte message at rdi on standard error and exit with 1
+rt_error:
+        pushq   %rdi
+        pushq   %rsi
+        call    rt_flush
+        movl    $2, %edi
+        leaq    rt_prefix(%rip), %rsi
+        movl    $15, %edx
+        movl    $1, %eax
+        syscall
+        popq    %rdx
+        popq    %rsi
+        movl    $2, %edi
+        movl    $1, %eax
+        syscall
+        movl    $1, %edi
+        movl    $231, %eax
+        syscall
+
+        .section .rodata
+rt_true:
+        .ascii  "true\n"
+rt_false:
+        .ascii  "false\n"
+rt_prefix:
+        .ascii  "Runtime error: "
+
+        .lcomm  rt_in, 65536
+        .lcomm  rt_out, 65536
+        .lcomm  rt_in_pos, 8
+        .lcomm  rt_in_len, 8
+        .lcomm  rt_out_len, 8
+        .lcomm  rt_depth, 8
+)";
+
+// Appended, with the table of powers of ten after it, when a program
+// prints or scans a real. Both read and write exactly what the VM's
+// to_chars() and from_chars() do.
+static const char realRuntime[] = R"(
+        .text
+# Print the real whose bits are in rdi: the fewest digits that read back
+# as the same value (Schubfach), fixed or scientific, whichever is shorter
+rt_print_real:
+        pushq   %rbx
+        pushq   %r12
+        pushq   %r13
+        pushq   %r14
+        pushq   %r15
+        subq    $80, %rsp
+        movq    %rsp, %r8
+        testq   %rdi, %rdi
+        jns     1f
+        movb    $45, (%r8)
+        incq    %r8
+1:      movq    %rdi, %rax
+        shrq    $52, %rax
+        andl    $0x7ff, %eax
+        movabsq $0xfffffffffffff, %rbx
+        andq    %rdi, %rbx
+        cmpl    $0x7ff, %eax
+        jne     3f
+        movl    $0x666e69, %ecx
+        testq   %rbx, %rbx
+        jz      2f
+        movl    $0x6e616e, %ecx
+2:      movl    %ecx, (%r8)
+        addq    $3, %r8
+        jmp     29f
+3:      xorl    %r13d, %r13d
+        testq   %rax, %rax
+        jnz     4f
+        testq   %rbx, %rbx
+        jnz     6f
+        movb    $48, (%r8)
+        incq    %r8
+        jmp     29f
+        # The value is rbx * 2^r12; r13 = 1 when the next value down is
+        # nearer than the next one up
+4:      testq   %rbx, %rbx
+        jnz     5f
+        cmpl    $1, %eax
+        seta    %r13b
+5:      btsq    $52, %rbx
+        leaq    -1075(%rax), %r12
+        jmp     7f
+6:      movq    $-1074, %r12
+        # r14 = k = floor(log10(2^q)), or of 3/4 2^q when r13 is set;
+        # rcx = q + floor(log2(10^-k)) + 1
+7:      imulq   $1262611, %r12, %r14
+        testl   %r13d, %r13d
+        jz      8f
+        subq    $524031, %r14
+8:      sarq    $22, %r14
+        imulq   $-1741647, %r14, %rax
+        sarq    $19, %rax
+        leaq    1(%r12,%rax), %rcx
+        # r11:r10 = 10^-k, rounded up to 128 bits
+        movq    %r14, %rdx
+        negq    %rdx
+        shlq    $4, %rdx
+        leaq    rt_pow10(%rip), %rax
+        movq    (%rax,%rdx), %r10
+        movq    8(%rax,%rdx), %r11
+        addq    $1, %r10
+        adcq    $0, %r11
+        # The bounds of the values that round to this one, and the value,
+        # scaled by 4 * 10^-k; an odd value excludes its bounds
+        movq    %rbx, %r9
+        andl    $1, %r9d
+        leaq    -2(%r13,%rbx,4), %rax
+        shlq    %cl, %rax
+        call    rt_round_odd
+        leaq    (%rax,%r9), %r13
+        leaq    2(,%rbx,4), %rax
+        shlq    %cl, %rax
+        call    rt_round_odd
+        movq    %rax, %r15
+        subq    %r9, %r15
+        leaq    (,%rbx,4), %rax
+        shlq    %cl, %rax
+        call    rt_round_odd
+        movq    %rax, %r9
+        # One digit fewer if a number of them is within the bounds
+        movq    %r9, %rsi
+        shrq    $2, %rsi
+        cmpq    $10, %rsi
+        jb      9f
+        movq    %rsi, %rax
+        xorl    %edx, %edx
+        movl    $10, %ecx
+        divq    %rcx
+        imulq   $40, %rax, %rdx
+        cmpq    %rdx, %r13
+        setbe   %cl
+        addq    $40, %rdx
+        cmpq    %r15, %rdx
+        setbe   %dl
+        cmpb    %cl, %dl
+        je      9f
+        movzbl  %dl, %edx
+        addq    %rdx, %rax
+        incq    %r14
+        jmp     12f
+9:      leaq    (,%rsi,4), %rdx
+        cmpq    %rdx, %r13
+        setbe   %cl
+        addq    $4, %rdx
+        cmpq    %r15, %rdx
+        setbe   %dl
+        movq    %rsi, %rax
+        cmpb    %cl, %dl
+        je      10f
+        movzbl  %dl, %edx
+        addq    %rdx, %rax
+        jmp     12f
+        # Both neighbours or neither: the nearer, ties to even
+10:     leaq    2(,%rsi,4), %rdx
+        cmpq    %rdx, %r9
+        ja      11f
+        jne     12f
+        testb   $1, %al
+        jz      12f
+11:     incq    %rax
+        # rax = the digits, r14 = the power of ten of the last one
+12:     movl    $10, %ecx
+13:     movq    %rax, %rsi
+        xorl    %edx, %edx
+        divq    %rcx
+        testq   %rdx, %rdx
+        jnz     14f
+        incq    %r14
+        jmp     13b
+14:     leaq    80(%rsp), %rdi
+        movq    %rsi, %rax
+15:     xorl    %edx, %edx
+        divq    %rcx
+        addb    $48, %dl
+        decq    %rdi
+        movb    %dl, (%rdi)
+        testq   %rax, %rax
+        jnz     15b
+        # The digits are at rdi, r10 of them; r9 = the power of ten of
+        # the first. r11 = the length in scientific notation, rax fixed.
+        leaq    80(%rsp), %r10
+        subq    %rdi, %r10
+        leaq    -1(%r10,%r14), %r9
+        leaq    4(%r10), %r11
+        cmpq    $1, %r10
+        seta    %al
+        movzbl  %al, %eax
+        addq    %rax, %r11
+        movq    %r9, %rax
+        negq    %rax
+        cmovsq  %r9, %rax
+        cmpq    $100, %rax
+        setae   %al
+        movzbl  %al, %eax
+        addq    %rax, %r11
+        leaq    (%r10,%r14), %rax
+        testq   %r14, %r14
+        jns     16f
+        leaq    1(%r10), %rax
+        testq   %r9, %r9
+        jns     16f
+        subq    %r9, %rax
+16:     cmpq    %r11, %rax
+        ja      25f
+        testq   %r14, %r14
+        js      22f
+        # A whole number: all of its digits, not only the shortest
+        movq    %rbx, %rax
+        xorl    %edx, %edx
+        movq    %r12, %rcx
+        testq   %rcx, %rcx
+        js      17f
+        shldq   %cl, %rax, %rdx
+        shlq    %cl, %rax
+        jmp     18f
+17:     negq    %rcx
+        shrq    %cl, %rax
+18:     leaq    80(%rsp), %rdi
+        movl    $10, %ecx
+        testq   %rdx, %rdx
+        jz      20f
+        movabsq $10000000000000000000, %rsi
+        divq    %rsi
+        movq    %rax, %rsi
+        movq    %rdx, %rax
+        movl    $19, %r9d
+19:     xorl    %edx, %edx
+        divq    %rcx
+        addb    $48, %dl
+        decq    %rdi
+        movb    %dl, (%rdi)
+        decl    %r9d
+        jnz     19b
+        movq    %rsi, %rax
+20:     xorl    %edx, %edx
+        divq    %rcx
+        addb    $48, %dl
+        decq    %rdi
+        movb    %dl, (%rdi)
+        testq   %rax, %rax
+        jnz     20b
+        movq    %rdi, %rsi
+        leaq    80(%rsp), %rcx
+        subq    %rsi, %rcx
+        movq    %r8, %rdi
+        rep movsb
+        movq    %rdi, %r8
+        jmp     29f
+        # The point among the digits, or 0. and zeros before them
+22:     movq    %rdi, %rsi
+        testq   %r9, %r9
+        js      23f
+        leaq    1(%r9), %rcx
+        movq    %r8, %rdi
+        rep movsb
+        movb    $46, (%rdi)
+        incq    %rdi
+        jmp     24f
+23:     movw    $0x2e30, (%r8)
+        leaq    2(%r8), %rdi
+        movq    %r9, %rcx
+        notq    %rcx
+        movb    $48, %al
+        rep stosb
+24:     leaq    80(%rsp), %rcx
+        subq    %rsi, %rcx
+        rep movsb
+        movq    %rdi, %r8
+        jmp     29f
+        # d.ddde+XX
+25:     movb    (%rdi), %al
+        movb    %al, (%r8)
+        incq    %r8
+        cmpq    $1, %r10
+        je      26f
+        movb    $46, (%r8)
+        leaq    1(%rdi), %rsi
+        leaq    -1(%r10), %rcx
+        leaq    1(%r8), %rdi
+        rep movsb
+        movq    %rdi, %r8
+26:     movw    $0x2b65, (%r8)
+        movq    %r9, %rax
+        testq   %rax, %rax
+        jns     27f
+        movb    $45, 1(%r8)
+        negq    %rax
+27:     addq    $2, %r8
+        cmpq    $100, %rax
+        jb      28f
+        movl    $100, %ecx
+        xorl    %edx, %edx
+        divq    %rcx
+        addb    $48, %al
+        movb    %al, (%r8)
+        incq    %r8
+        movq    %rdx, %rax
+28:     movl    $10, %ecx
+        xorl    %edx, %edx
+        divq    %rcx
+        addb    $48, %al
+        addb    $48, %dl
+        movb    %al, (%r8)
+        movb    %dl, 1(%r8)
+        addq    $2, %r8
+29:     movb    $10, (%r8)
+        incq    %r8
+        movq    %rsp, %rsi
+        movq    %r8, %rdx
+        subq    %rsp, %rdx
+        call    rt_write
+        addq    $80, %rsp
+        popq    %r15
+        popq    %r14
+        popq    %r13
+        popq    %r12
+        popq    %rbx
+        ret
+
+# rax = the top 64 bits of r11:r10 times rax, rounded to odd
+rt_round_odd:
+        movq    %rax, %rsi
+        mulq    %r10
+        movq    %rdx, %rdi
+        movq    %rsi, %rax
+        mulq    %r11
+        addq    %rdi, %rax
+        adcq    $0, %rdx
+        cmpq    $1, %rax
+        seta    %al
+        movzbl  %al, %eax
+        orq     %rdx, %rax
+        ret
+
+# Make rcx bytes of input available from rt_in_pos on, moving what is left
+# to the front of the buffer, unless the input ends first
+rt_more:
+        movq    rt_in_len(%rip), %rdx
+        movq    rt_in_pos(%rip), %rsi
+        subq    %rsi, %rdx
+        cmpq    %rcx, %rdx
+        jae     3f
+        pushq   %rcx
+        leaq    rt_in(%rip), %rdi
+        addq    %rdi, %rsi
+        movq    %rdx, %rcx
+        rep movsb
+        movq    %rdx, rt_in_len(%rip)
+        movq    $0, rt_in_pos(%rip)
+1:      movq    rt_in_len(%rip), %rdx
+        cmpq    (%rsp), %rdx
+        jae     2f
+        xorl    %edi, %edi
+        leaq    rt_in(%rip), %rsi
+        addq    %rdx, %rsi
+        negq    %rdx
+        addq    $65536, %rdx
+        xorl    %eax, %eax
+        syscall
+        testq   %rax, %rax
+        jle     2f
+        addq    %rax, rt_in_len(%rip)
+        jmp     1b
+2:      popq    %rcx
+3:      ret
+
+# rax = the bits of the next real; rdi, rsi = error message for bad input.
+# Up to 19 significant digits decide by rt_decimal alone; with more, the
+# first 800 are compared with the halfway point between the two candidates.
+rt_scan_real:
+        pushq   %rbx
+        pushq   %rbp
+        pushq   %r12
+        pushq   %r13
+        pushq   %r14
+        pushq   %r15
+        pushq   %rdi
+        pushq   %rsi
+        xorl    %ebx, %ebx              # the first 19 significant digits
+        xorl    %r12d, %r12d            # significant digits
+        xorl    %r13d, %r13d            # digits after the point
+        xorl    %r14d, %r14d            # 1 minus, 2 point, 4 digits,
+                                        # 8 nonzero digit dropped, 16 e-
+        xorl    %r15d, %r15d            # digits kept in rt_digits
+        xorl    %ebp, %ebp              # exponent
+        call    rt_skip
+        cmpl    $43, %eax
+        jne     1f
+        call    rt_getc
+        cmpl    $45, %eax
+        je      40f
+        jmp     2f
+1:      cmpl    $45, %eax
+        jne     2f
+        orl     $1, %r14d
+        call    rt_getc
+2:      movl    %eax, %edx
+        orl     $32, %edx
+        cmpl    $105, %edx
+        je      30f
+        cmpl    $110, %edx
+        je      30f
+3:      cmpl    $46, %eax
+        jne     4f
+        btsl    $1, %r14d
+        jc      8f
+        call    rt_getc
+        jmp     3b
+4:      leal    -48(%rax), %edx
+        cmpl    $9, %edx
+        ja      8f
+        orl     $4, %r14d
+        btl     $1, %r14d
+        adcq    $0, %r13
+        testq   %r12, %r12
+        jnz     5f
+        testl   %edx, %edx
+        jz      7f
+5:      cmpq    $19, %r12
+        jae     6f
+        imulq   $10, %rbx
+        addq    %rdx, %rbx
+6:      incq    %r12
+        cmpq    $800, %r15
+        jae     9f
+        leaq    rt_digits(%rip), %rcx
+        movb    %dl, (%rcx,%r15)
+        incq    %r15
+7:      call    rt_getc
+        jmp     3b
+9:      testl   %edx, %edx
+        jz      7b
+        orl     $8, %r14d
+        jmp     7b
+8:      call    rt_ungetc
+        testl   $4, %r14d
+        jz      40f
+        # An exponent if e is followed by digits, with or without a sign
+        orl     $32, %eax
+        cmpl    $101, %eax
+        jne     13f
+        movl    $64, %ecx
+        call    rt_more
+        movq    rt_in_pos(%rip), %rax
+        movq    rt_in_len(%rip), %rcx
+        leaq    rt_in(%rip), %rsi
+        incq    %rax
+        cmpq    %rcx, %rax
+        jae     13f
+        movzbl  (%rsi,%rax), %edx
+        cmpl    $43, %edx
+        je      10f
+        cmpl    $45, %edx
+        jne     11f
+        orl     $16, %r14d
+10:     incq    %rax
+        cmpq    %rcx, %rax
+        jae     13f
+        movzbl  (%rsi,%rax), %edx
+11:     subl    $48, %edx
+        cmpl    $9, %edx
+        ja      13f
+        movq    %rax, rt_in_pos(%rip)
+12:     call    rt_getc
+        leal    -48(%rax), %edx
+        cmpl    $9, %edx
+        ja      14f
+        cmpq    $0x10000000, %rbp
+        jae     12b
+        imulq   $10, %rbp
+        addq    %rdx, %rbp
+        jmp     12b
+14:     call    rt_ungetc
+        testl   $16, %r14d
+        jz      13f
+        negq    %rbp
+        # rbp = q: the value is rbx * 10^q, and more digits if r12 > 19
+13:     testq   %r12, %r12
+        jz      20f
+        subq    %r13, %rbp
+        leaq    -19(%r12), %rax
+        testq   %rax, %rax
+        jle     15f
+        addq    %rax, %rbp
+15:     movq    %rbx, %rdi
+        movq    %rbp, %rsi
+        call    rt_decimal
+        movq    %rax, %rbx
+        cmpq    $19, %r12
+        jbe     19f
+        cmpq    $-342, %rbp
+        jl      19f
+        movabsq $0x7ff0000000000000, %rax
+        cmpq    %rax, %rbx
+        je      19f
+        # The value is rbx or the next one up. rt_big_a = the digits kept,
+        # N, with the value N * 10^rbp; rt_big_b = the halfway point
+        # 2m + 1 between the two, with the value rt_big_b * 2^r13.
+        addq    $19, %rbp
+        subq    %r15, %rbp
+        leaq    rt_big_a(%rip), %rdi
+        movq    $0, (%rdi)
+        xorl    %r12d, %r12d
+16:     leaq    rt_digits(%rip), %rax
+        movzbl  (%rax,%r12), %ecx
+        leaq    rt_big_a(%rip), %rdi
+        movl    $10, %esi
+        call    rt_big_mul
+        incq    %r12
+        cmpq    %r15, %r12
+        jb      16b
+        movq    %rbx, %rax
+        shrq    $52, %rax
+        movabsq $0xfffffffffffff, %rdx
+        andq    %rbx, %rdx
+        movq    $-1075, %r13
+        testq   %rax, %rax
+        jz      17f
+        btsq    $52, %rdx
+        leaq    -1076(%rax), %r13
+17:     leaq    1(%rdx,%rdx), %rdx
+        leaq    rt_big_b(%rip), %rdi
+        movq    $1, (%rdi)
+        movq    %rdx, 8(%rdi)
+        # Cancel the powers of ten, then the powers of two; r12 = the
+        # power of two on N's side
+        movq    %rbp, %r12
+        movq    %rbp, %rsi
+        leaq    rt_big_a(%rip), %rdi
+        testq   %rsi, %rsi
+        jns     18f
+        xorl    %r12d, %r12d
+        negq    %rsi
+        addq    %rsi, %r13
+        leaq    rt_big_b(%rip), %rdi
+18:     call    rt_big_pow5
+        movq    %r12, %rsi
+        leaq    rt_big_a(%rip), %rdi
+        subq    %r13, %rsi
+        jns     21f
+        negq    %rsi
+        leaq    rt_big_b(%rip), %rdi
+21:     call    rt_big_shl
+        leaq    rt_big_a(%rip), %rdi
+        leaq    rt_big_b(%rip), %rsi
+        call    rt_big_cmp
+        testl   %eax, %eax
+        jnz     22f
+        # Halfway: above it if a nonzero digit was dropped, else to even
+        testl   $8, %r14d
+        jnz     23f
+        testb   $1, %bl
+        jz      19f
+        jmp     23f
+22:     js      19f
+23:     incq    %rbx
+        # Out of range unless the digits were all zeros
+19:     testq   %rbx, %rbx
+        jz      40f
+        movabsq $0x7ff0000000000000, %rax
+        cmpq    %rax, %rbx
+        je      40f
+20:     movq    %rbx, %rax
+        testl   $1, %r14d
+        jz      24f
+        btsq    $63, %rax
+24:     addq    $16, %rsp
+        popq    %r15
+        popq    %r14
+        popq    %r13
+        popq    %r12
+        popq    %rbp
+        popq    %rbx
+        ret
+        # inf, infinity, nan or nan(letters, digits and _), in any case
+30:     call    rt_ungetc
+        movl    $64, %ecx
+        call    rt_more
+        movq    rt_in_pos(%rip), %rsi
+        movq    rt_in_len(%rip), %rdx
+        subq    %rsi, %rdx
+        leaq    rt_in(%rip), %rdi
+        addq    %rsi, %rdi
+        cmpq    $3, %rdx
+        jb      40f
+        movq    (%rdi), %rax
+        movabsq $0x2020202020202020, %rcx
+        orq     %rcx, %rax
+        movl    %eax, %ecx
+        andl    $0xffffff, %ecx
+        cmpl    $0x666e69, %ecx
+        jne     32f
+        movl    $3, %r8d
+        cmpq    $8, %rdx
+        jb      31f
+        movabsq $0x7974696e69666e69, %rcx
+        cmpq    %rcx, %rax
+        jne     31f
+        movl    $8, %r8d
+31:     movabsq $0x7ff0000000000000, %rbx
+        jmp     37f
+32:     cmpl    $0x6e616e, %ecx
+        jne     40f
+        movl    $3, %r8d
+        movl    $4, %r9d
+        cmpq    $4, %rdx
+        jb      36f
+        cmpb    $40, 3(%rdi)
+        jne     36f
+33:     cmpq    %rdx, %r9
+        jb      34f
+        leaq    1(%r9), %rcx
+        call    rt_more
+        movq    rt_in_pos(%rip), %rsi
+        movq    rt_in_len(%rip), %rdx
+        subq    %rsi, %rdx
+        leaq    rt_in(%rip), %rdi
+        addq    %rsi, %rdi
+        cmpq    %rdx, %r9
+        jae     36f
+34:     movzbl  (%rdi,%r9), %eax
+        cmpl    $41, %eax
+        je      35f
+        incq    %r9
+        cmpl    $95, %eax
+        je      33b
+        leal    -48(%rax), %ecx
+        cmpl    $9, %ecx
+        jbe     33b
+        orl     $32, %eax
+        subl    $97, %eax
+        cmpl    $25, %eax
+        jbe     33b
+        jmp     36f
+35:     leaq    1(%r9), %r8
+36:     movabsq $0x7ff8000000000000, %rbx
+37:     addq    %r8, rt_in_pos(%rip)
+        jmp     20b
+40:     popq    %rsi
+        popq    %rdi
+        jmp     rt_error
+
+# rax = the bits of the double nearest rdi * 10^rsi, rdi not zero
+# (Eisel and Lemire; for 19 digits 128 bits of the power always decide)
+rt_decimal:
+        cmpq    $-342, %rsi
+        jl      5f
+        cmpq    $308, %rsi
+        jg      6f
+        bsrq    %rdi, %rcx
+        xorl    $63, %ecx
+        shlq    %cl, %rdi
+        movl    %ecx, %r11d
+        movq    %rsi, %rax
+        shlq    $4, %rax
+        leaq    rt_pow10(%rip), %rdx
+        movq    (%rdx,%rax), %r9
+        movq    8(%rdx,%rax), %r10
+        # 10^-27 to 10^-1 are rounded up
+        leaq    27(%rsi), %rax
+        cmpq    $26, %rax
+        ja      1f
+        addq    $1, %r9
+        adcq    $0, %r10
+1:      movq    %rdi, %rax
+        mulq    %r10
+        movq    %rdx, %r10
+        movq    %rax, %r8
+        movl    %r10d, %eax
+        andl    $0x1ff, %eax
+        cmpl    $0x1ff, %eax
+        jne     2f
+        movq    %rdi, %rax
+        mulq    %r9
+        addq    %rdx, %r8
+        adcq    $0, %r10
+2:      movq    %r10, %rax
+        shrq    $63, %rax
+        leal    9(%rax), %ecx
+        movq    %r10, %rdx
+        shrq    %cl, %rdx
+        # r9 = the biased binary exponent
+        imulq   $217706, %rsi, %r9
+        sarq    $16, %r9
+        addq    %rax, %r9
+        subq    %r11, %r9
+        addq    $1086, %r9
+        jg      3f
+        movl    $1, %ecx
+        subq    %r9, %rcx
+        cmpq    $64, %rcx
+        jae     5f
+        shrq    %cl, %rdx
+        movq    %rdx, %rax
+        andl    $1, %eax
+        addq    %rdx, %rax
+        shrq    $1, %rax
+        ret
+        # Exactly halfway rounds to even
+3:      cmpq    $1, %r8
+        ja      4f
+        leaq    4(%rsi), %rax
+        cmpq    $27, %rax
+        ja      4f
+        movl    %edx, %eax
+        andl    $3, %eax
+        cmpl    $1, %eax
+        jne     4f
+        movq    %rdx, %rax
+        shlq    %cl, %rax
+        cmpq    %r10, %rax
+        jne     4f
+        andq    $-2, %rdx
+4:      movq    %rdx, %rax
+        andl    $1, %eax
+        addq    %rdx, %rax
+        shrq    $1, %rax
+        btrq    $53, %rax
+        jnc     7f
+        incq    %r9
+7:      btrq    $52, %rax
+        cmpq    $0x7ff, %r9
+        jge     6f
+        shlq    $52, %r9
+        orq     %r9, %rax
+        ret
+5:      xorl    %eax, %eax
+        ret
+6:      movabsq $0x7ff0000000000000, %rax
+        ret
+
+# Numbers of up to 72 limbs: the count, then the limbs from the lowest.
+# rdi = rdi * rsi + rcx
+rt_big_mul:
+        movq    (%rdi), %r8
+        xorl    %r9d, %r9d
+1:      cmpq    %r8, %r9
+        jae     2f
+        movq    8(%rdi,%r9,8), %rax
+        mulq    %rsi
+        addq    %rcx, %rax
+        adcq    $0, %rdx
+        movq    %rax, 8(%rdi,%r9,8)
+        movq    %rdx, %rcx
+        incq    %r9
+        jmp     1b
+2:      testq   %rcx, %rcx
+        jz      3f
+        movq    %rcx, 8(%rdi,%r8,8)
+        incq    (%rdi)
+3:      ret
+
+# rdi = rdi * 5^rsi
+rt_big_pow5:
+        movq    %rsi, %r11
+1:      cmpq    $27, %r11
+        jb      2f
+        movabsq $7450580596923828125, %rsi
+        xorl    %ecx, %ecx
+        call    rt_big_mul
+        subq    $27, %r11
+        jmp     1b
+2:      testq   %r11, %r11
+        jz      3f
+        movl    $5, %esi
+        xorl    %ecx, %ecx
+        call    rt_big_mul
+        decq    %r11
+        jmp     2b
+3:      ret
+
+# rdi = rdi * 2^rsi
+rt_big_shl:
+        movl    %esi, %ecx
+        andl    $63, %ecx
+        jz      3f
+        movq    (%rdi), %r8
+        xorl    %r9d, %r9d
+        xorl    %r10d, %r10d
+1:      cmpq    %r8, %r9
+        jae     2f
+        movq    8(%rdi,%r9,8), %rax
+        movq    %rax, %rdx
+        shlq    %cl, %rax
+        orq     %r10, %rax
+        movq    %rax, 8(%rdi,%r9,8)
+        xorl    %r10d, %r10d
+        shldq   %cl, %rdx, %r10
+        incq    %r9
+        jmp     1b
+2:      testq   %r10, %r10
+        jz      3f
+        movq    %r10, 8(%rdi,%r8,8)
+        incq    (%rdi)
+3:      shrq    $6, %rsi
+        jz      6f
+        movq    (%rdi), %r8
+4:      decq    %r8
+        js      5f
+        movq    8(%rdi,%r8,8), %rax
+        leaq    (%r8,%rsi), %rdx
+        movq    %rax, 8(%rdi,%rdx,8)
+        jmp     4b
+5:      movq    %rdi, %rdx
+        leaq    8(%rdi), %rdi
+        movq    %rsi, %rcx
+        xorl    %eax, %eax
+        rep stosq
+        movq    %rdx, %rdi
+        addq    %rsi, (%rdi)
+6:      ret
+
+# eax = -1, 0 or 1 as rdi is below, equal to or above rsi
+rt_big_cmp:
+        movq    (%rdi), %rcx
+        cmpq    (%rsi), %rcx
+        jne     2f
+1:      decq    %rcx
+        js      3f
+        movq    8(%rdi,%rcx,8), %rax
+        cmpq    8(%rsi,%rcx,8), %rax
+        je      1b
+2:      sbbl    %eax, %eax
+        orl     $1, %eax
+        ret
+3:      xorl    %eax, %eax
+        ret
+
+        .lcomm  rt_digits, 800
+        .lcomm  rt_big_a, 584
+        .lcomm  rt_big_b, 584
+        .section .rodata
+)";
+
+static const int lowestPower = -342, highestPower = 326;
+
+// The top 128 bits of 10^k for k from lowestPower to highestPower, low
+// quad first. Worked out once, exactly, on 32-bit limbs.
+static const std::vector<uint64_t> &powersOfTen() {
+  static std::vector<uint64_t> table;
+  if (!table.empty())
+    return table;
+  table.resize(2 * (highestPower - lowestPower + 1));
+  auto top = [](const std::vector<uint32_t> &n, uint64_t *entry) {
+    int bits = 32 * n.size() - __builtin_clz(n.back());
+    for (int i = 0; i < 128; i++) {
+      int bit = bits - 1 - i;
+      if (bit >= 0 && (n[bit / 32] >> bit % 32 & 1))
+        entry[1 - i / 64] |= uint64_t(1) << (63 - i % 64);
+    }
+  };
+
+  std::vector<uint32_t> n{1};
+  for (int k = 0; k <= highestPower; k++) {
+    top(n, &table[2 * (k - lowestPower)]);
+    uint64_t carry = 0;
+    for (uint32_t &limb : n) {
+      carry += uint64_t(limb) * 10;
+      limb = uint32_t(carry);
+      carry >>= 32;
+    }
+    if (carry)
+      n.push_back(carry);
+  }
+  // floor(2^1300 / 10^k) keeps well over 128 bits down to 10^-342
+  n.assign(41, 0);
+  n.back() = 1 << 20;
+  for (int k = -1; k >= lowestPower; k--) {
+    uint64_t rest = 0;
+    for (size_t i = n.size(); i-- > 0;) {
+      rest = rest << 32 | n[i];
+      n[i] = uint32_t(rest / 10);
+      rest %= 10;
+    }
+    if (n.back() == 0)
+      n.pop_back();
+    top(n, &table[2 * (k - lowestPower)]);
+  }
+  return table;
+}
+
+static const int maxCalls = 1 << 16; // same limit as the VM
+static const char *const argumentRegisters[] = {"%rdi", "%rsi", "%rdx",
+                                                "%rcx", "%r8",  "%r9"};
+static const char *const savedRegisters[] = {"%rbx", "%r12", "%r13", "%r14",
+                                             "%r15"};
+
+struct Variable {
+  bool global;
+  int index;
+  ValueType type;
+};
+
+// Parameters and locals of one function, including undeclared names
+struct FunctionInfo {
+  int symbol = -1;
+  uint32_t name = 0;
+  int parameters = 0;
+  std::vector<uint32_t> names;
+  std::vector<ValueType> types;
+  std::vector<uint64_t> uses; // weighted by loop depth
+  std::vector<std::string> homes;
+  std::unordered_map<uint32_t, int> implicit;
+  int saved = 0;  // callee-saved registers in use
+  int frame = 0;  // stack slots, including alignment padding
+};
+
+static std::ostream *out;
+static const std::function<Location(size_t)> *locator;
+static std::vector<FunctionInfo> functions;
+static FunctionInfo *current; // null for the main program
+static std::vector<int> slotOf;        // by symbol
+static std::vector<int> functionIndex; // by symbol
+static std::vector<uint32_t> globalNames;
+static std::vector<ValueType> globalTypes;
+static std::unordered_map<uint32_t, int> implicitGlobals;
+static std::vector<ValueType> returnTypes;
+static std::vector<std::string> messages;
+static std::vector<std::pair<int, int>> stubs; // label, message
+static int labels;
+static int pushed; // 8-byte temporaries on the stack
+static bool realText; // reals printed or scanned: append realRuntime
+static int returnLabel;
+
+static std::string quoted(uint32_t name) {
+  return "'" + std::string(identifiers.name(name)) + "'";
+}
+
+static void emit(const std::string &instruction) {
+  *out << "        " << instruction << '\n';
+}
+
+static std::string label(int n) { return ".L" + std::to_string(n); }
+
+static void place(int n) { *out << label(n) << ":\n"; }
+
+// A run-time error message quoting the location of offset
+static int message(const std::string &text, size_t offset) {
+  Location at = (*locator)(offset);
+  messages.push_back(text + " @ line " + std::to_string(at.line) +
+                     ", column " + std::to_string(at.column) + "\n");
+  return messages.size() - 1;
+}
+
+// A label that reports a run-time error at offset
+static int errorStub(const std::string &text, size_t offset) {
+  stubs.push_back({labels, message(text, offset)});
+  return labels++;
+}
+
+static void loadMessage(int index) {
+  emit("leaq    .Lmsg" + std::to_string(index) + "(%rip), %rdi");
+  emit("movq    $" + std::to_string(messages[index].size()) + ", %rsi");
+}
+
+static Variable variable(uint32_t name, size_t offset) {
+  int symbol = symbolTable.lookup(name, current ? current->symbol : -1);
+  if (symbol >= 0) {
+    const Symbol &s = symbolTable.symbols()[symbol];
+    if (s.kind == FUNCTION_SYMBOL)
+      throw CompileError("function " + quoted(name) + " used as a variable",
+                         offset);
+    return {s.kind == GLOBAL_SYMBOL, slotOf[symbol], valueType(s.type)};
+  }
+
+  // Undeclared: an integer in the innermost scope, as in the VM
+  if (current == nullptr) {
+    auto [it, added] = implicitGlobals.emplace(name, globalNames.size());
+    if (added) {
+      globalNames.push_back(name);
+      globalTypes.push_back(INT_VALUE);
+    }
+    return {true, it->second, INT_VALUE};
+  }
+  auto [it, added] = current->implicit.emplace(name, current->names.size());
+  if (added) {
+    current->names.push_back(name);
+    current->types.push_back(INT_VALUE);
+    current->uses.push_back(0);
+  }
+  return {false, it->second, INT_VALUE};
+}
+
+static std::string home(const Variable &v) {
+  if (v.global)
+    return "G_" + std::string(identifiers.name(globalNames[v.index])) +
+           "(%rip)";
+  return current->homes[v.index];
+}
+
+static int callee(uint32_t name, size_t offset, size_t arity) {
+  int symbol = symbolTable.lookup(name, current ? current->symbol : -1);
+  if (symbol < 0)
+    throw CompileError("undeclared function " + quoted(name), offset);
+  const Symbol &s = symbolTable.symbols()[symbol];
+  if (s.kind != FUNCTION_SYMBOL)
+    throw CompileError(quoted(name) + " is not a function", offset);
+  if ((int)arity != s.parameters)
+    throw CompileError(quoted(name) + " expects " +
+                           std::to_string(s.parameters) +
+                           " argument(s), got " + std::to_string(arity),
+                       offset);
+  return functionIndex[symbol];
+}
+
+// Count variable uses so the busiest get registers. Resolving them here
+// also creates the implicit ones before any code is written.
+static void countExpr(const Expr &e, uint64_t weight) {
+  switch (e.kind) {
+  case IDENTIFIER_EXPR: {
+    Variable v = variable(e.name, e.offset);
+    if (!v.global)
+      current->uses[v.index] += weight;
+    break;
+  }
+  case CALL_EXPR:
+    for (const ExprPtr &arg : e.args)
+      countExpr(*arg, weight);
+    break;
+  default:
+    if (e.left)
+      countExpr(*e.left, weight);
+    if (e.right)
+      countExpr(*e.right, weight);
+    break;
+  }
+}
+
+static void countStmt(const Stmt &s, uint64_t weight) {
+  switch (s.kind) {
+  case COMPOUND_STMT:
+    for (const StmtPtr &statement : s.body)
+      countStmt(*statement, weight);
+    break;
+  case ASSIGN_STMT: {
+    countExpr(*s.value, weight);
+    Variable v = variable(s.name, s.offset);
+    if (current && !v.global)
+      current->uses[v.index] += weight;
+    break;
+  }
+  case IF_STMT:
+  case WHILE_STMT: {
+    uint64_t inner = s.kind == WHILE_STMT ? weight * 8 : weight;
+    countExpr(*s.condition.left, inner);
+    countExpr(*s.condition.right, inner);
+    countStmt(*s.branch, inner);
+    if (s.elseBranch)
+      countStmt(*s.elseBranch, weight);
+    break;
+  }
+  case RETURN_STMT:
+  case PRINT_STMT:
+    if (s.value)
+      countExpr(*s.value, weight);
+    break;
+  case SCAN_STMT:
+    for (const ExprPtr &target : s.targets)
+      countExpr(*target, weight);
+    break;
+  }
+}
+
+static ValueType exprType(const Expr &e) {
+  switch (e.kind) {
+  case INTEGER_EXPR:
+    return INT_VALUE;
+  case BOOLEAN_EXPR:
+    return BOOL_VALUE;
+  case IDENTIFIER_EXPR:
+    return variable(e.name, e.offset).type;
+  case CALL_EXPR:
+    return returnTypes[callee(e.name, e.offset, e.args.size())];
+  case REAL_EXPR:
+  case TO_REAL_EXPR:
+    return REAL_VALUE;
+  default:
+    // An operation, whose operands checkTypes() gave its type
+    return exprType(*e.left);
+  }
+}
+
+static void collectReturns(const Stmt &s, std::vector<const Expr *> &found) {
+  if (s.kind == RETURN_STMT && s.value)
+    found.push_back(s.value.get());
+  for (const StmtPtr &statement : s.body)
+    collectReturns(*statement, found);
+  if (s.branch)
+    collectReturns(*s.branch, found);
+  if (s.elseBranch)
+    collectReturns(*s.elseBranch, found);
+}
+
+// A value that can be an instruction operand as it is
+static bool operand(const Expr &e, std::string &text, ValueType &type) {
+  if (e.kind == INTEGER_EXPR && e.integer == int32_t(e.integer)) {
+    text = "$" + std::to_string(e.integer);
+    type = INT_VALUE;
+  } else if (e.kind == BOOLEAN_EXPR) {
+    text = "$" + std::to_string(e.integer);
+    type = BOOL_VALUE;
+  } else if (e.kind == IDENTIFIER_EXPR) {
+    Variable v = variable(e.name, e.offset);
+    text = home(v);
+    type = v.type;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static ValueType expr(const Expr &e);
+
+// Evaluate the right operand into an operand string, left stays in rax
+static ValueType rightOperand(const Expr &e, std::string &text) {
+  ValueType type;
+  if (operand(e, text, type))
+    return type;
+  emit("pushq   %rax");
+  pushed++;
+  type = expr(e);
+  emit("movq    %rax, %rcx");
+  emit("popq    %rax");
+  pushed--;
+  text = "%rcx";
+  return type;
+}
+
+// An argument: a variable, or one checkTypes() promoted to real
+static const Expr &argumentName(const Expr &arg) {
+  return arg.kind == TO_REAL_EXPR ? *arg.left : arg;
+}
+
+// Put an argument in `to`, a register, or push it for "pushq"
+static void argument(const Expr &arg, const std::string &to) {
+  const Expr &name = argumentName(arg);
+  std::string from = home(variable(name.name, name.offset));
+  if (arg.kind != TO_REAL_EXPR) {
+    emit((to.empty() ? "pushq   " : "movq    ") + from +
+         (to.empty() ? "" : ", " + to));
+    return;
+  }
+  emit("cvtsi2sdq " + from + ", %xmm0");
+  emit("movq    %xmm0, " + (to.empty() ? "%rax" : to));
+  if (to.empty())
+    emit("pushq   %rax");
+}
+
+static void call(const Expr &e) {
+  int index = callee(e.name, e.offset, e.args.size());
+  const FunctionInfo &target = functions[index];
+  for (size_t i = 0; i < e.args.size(); i++) {
+    const Expr &name = argumentName(*e.args[i]);
+    ValueType type = e.args[i]->kind == TO_REAL_EXPR
+                         ? REAL_VALUE
+                         : variable(name.name, name.offset).type;
+    if (type != target.types[i])
+      throw CompileError("argument " + quoted(name.name) + " is " +
+                             typeName(type) + ", parameter " +
+                             quoted(target.names[i]) + " is " +
+                             typeName(target.types[i]),
+                         name.offset);
+  }
+
+  int overflow = errorStub("call stack overflow", e.offset);
+  emit("cmpq    $" + std::to_string(maxCalls) + ", rt_depth(%rip)");
+  emit("jae     " + label(overflow));
+
+  int stacked = std::max<int>(0, e.args.size() - 6);
+  int pad = (pushed + stacked) % 2;
+  if (pad)
+    emit("subq    $8, %rsp");
+  for (int i = e.args.size() - 1; i >= 6; i--)
+    argument(*e.args[i], "");
+  for (size_t i = 0; i < e.args.size() && i < 6; i++)
+    argument(*e.args[i], argumentRegisters[i]);
+  emit("call    F_" + std::string(identifiers.name(e.name)));
+  if (stacked + pad)
+    emit("addq    $" + std::to_string(8 * (stacked + pad)) + ", %rsp");
+}
+
+static void requireInteger(ValueType type, const char *verb, size_t offset) {
+  if (type == BOOL_VALUE)
+    throw CompileError(std::string("cannot ") + verb + " a boolean", offset);
+}
+
+// Reals travel in the integer registers as their bits; SSE2 does the
+// arithmetic. The left operand is in rax, the right in `text`.
+static void realOperation(const char *op, const std::string &text) {
+  emit("movq    %rax, %xmm0");
+  emit("movq    " + text + ", %xmm1");
+  emit(op + std::string("%xmm1, %xmm0"));
+  emit("movq    %xmm0, %rax");
+}
+
+// Evaluate into rax
+static ValueType expr(const Expr &e) {
+  std::string text;
+  ValueType type;
+  switch (e.kind) {
+  case INTEGER_EXPR:
+    if (e.integer == int32_t(e.integer)) {
+      emit("movq    $" + std::to_string(e.integer) + ", %rax");
+    } else {
+      emit("movabsq $" + std::to_string(e.integer) + ", %rax");
+    }
+    return INT_VALUE;
+  case REAL_EXPR: {
+    uint64_t bits;
+    std::memcpy(&bits, &e.real, sizeof bits);
+    emit("movabsq $" + std::to_string(bits) + ", %rax");
+    return REAL_VALUE;
+  }
+  case TO_REAL_EXPR:
+    expr(*e.left);
+    emit("cvtsi2sdq %rax, %xmm0");
+    emit("movq    %xmm0, %rax");
+    return REAL_VALUE;
+  case BOOLEAN_EXPR:
+  case IDENTIFIER_EXPR:
+    operand(e, text, type);
+    emit("movq    " + text + ", %rax");
+    return type;
+  case CALL_EXPR:
+    call(e);
+    return exprType(e);
+  case NEGATE_EXPR:
+    type = expr(*e.left);
+    requireInteger(type, "negate", e.offset);
+    if (type == REAL_VALUE) {
+      // Flip the sign bit, as -x does, NaN included
+      emit("btcq    $63, %rax");
+      return REAL_VALUE;
+    }
+    emit("negq    %rax");
+    return INT_VALUE;
+  case DIVIDE_EXPR: {
+    type = expr(*e.left);
+    requireInteger(type, "divide", e.offset);
+    requireInteger(rightOperand(*e.right, text), "divide", e.offset);
+    if (type == REAL_VALUE) {
+      // Division by zero gives an infinity or NaN, as in the VM
+      realOperation("divsd   ", text);
+      return REAL_VALUE;
+    }
+    if (e.right->kind == INTEGER_EXPR && e.right->integer != 0) {
+      // A constant divisor needs no checks
+      if (e.right->integer == -1) {
+        emit("negq    %rax");
+        return INT_VALUE;
+      }
+      if (text != "%rcx")
+        emit("movq    " + text + ", %rcx");
+      emit("cqto");
+      emit("idivq   %rcx");
+      return INT_VALUE;
+    }
+    int zero = errorStub("division by zero", e.offset);
+    int divide = labels++, done = labels++;
+    if (text != "%rcx")
+      emit("movq    " + text + ", %rcx");
+    emit("testq   %rcx, %rcx");
+    emit("jz      " + label(zero));
+    // INT64_MIN / -1 wraps like the VM instead of trapping
+    emit("cmpq    $-1, %rcx");
+    emit("jne     " + label(divide));
+    emit("negq    %rax");
+    emit("jmp     " + label(done));
+    place(divide);
+    emit("cqto");
+    emit("idivq   %rcx");
+    place(done);
+    return INT_VALUE;
+  }
+  default: {
+    static const char *const verbs[] = {"add", "subtract", "multiply"};
+    static const char *const ops[] = {"addq    ", "subq    ", "imulq   "};
+    static const char *const realOps[] = {"addsd   ", "subsd   ",
+                                          "mulsd   "};
+    const char *verb = verbs[e.kind - ADD_EXPR];
+    type = expr(*e.left);
+    requireInteger(type, verb, e.offset);
+    requireInteger(rightOperand(*e.right, text), verb, e.offset);
+    if (type == REAL_VALUE) {
+      realOperation(realOps[e.kind - ADD_EXPR], text);
+      return REAL_VALUE;
+    }
+    emit(ops[e.kind - ADD_EXPR] + text + ", %rax");
+    return INT_VALUE;
+  }
+  }
+}
+
+static void jump(const std::string &jump, int target) {
+  emit(jump + std::string(8 - jump.size(), ' ') + label(target));
+}
+
+// ucomisd leaves ZF, PF and CF all set for NaN, which makes every
+// comparison but != false. Greater and greater or equal use ja and jae,
+// the others swap the operands to do the same.
+static void realBranch(RelopKind op, bool when, int target) {
+  static const bool swapped[] = {false, false, false, true, true, false};
+  static const char *const jumps[] = {"", "", "ja", "ja", "jae", "jae"};
+  static const char *const inverse[] = {"", "", "jbe", "jbe", "jb", "jb"};
+  emit(swapped[op] ? "ucomisd %xmm0, %xmm1" : "ucomisd %xmm1, %xmm0");
+  if (op != EQUAL_RELOP && op != NOT_EQUAL_RELOP) {
+    jump(when ? jumps[op] : inverse[op], target);
+  } else if (when == (op == EQUAL_RELOP)) {
+    // Equal: ZF set and PF clear
+    int unordered = labels++;
+    jump("jp", unordered);
+    jump("je", target);
+    place(unordered);
+  } else {
+    jump("jp", target);
+    jump("jne", target);
+  }
+}
+
+// Compare and jump to `target` when the condition is `when`
+static void branch(const Comparison &c, bool when, int target) {
+  static const char *const jumps[] = {"je", "jne", "jg", "jl", "jle", "jge"};
+  static const char *const inverse[] = {"jne", "je", "jle", "jge", "jg", "jl"};
+  std::string text;
+  ValueType left = expr(*c.left);
+  ValueType right = rightOperand(*c.right, text);
+  if (left != right)
+    throw CompileError("cannot compare a boolean with a number",
+                       c.left->offset);
+  if (left == REAL_VALUE) {
+    emit("movq    %rax, %xmm0");
+    emit("movq    " + text + ", %xmm1");
+    realBranch(c.op, when, target);
+    return;
+  }
+  emit("cmpq    " + text + ", %rax");
+  jump(when ? jumps[c.op] : inverse[c.op], target);
+}
+
+static void store(uint32_t name, ValueType type, size_t offset) {
+  Variable v = variable(name, offset);
+  if (v.type != type)
+    throw CompileError(std::string("cannot assign ") + typeName(type) +
+                           " to " + typeName(v.type) + " " + quoted(name),
+                       offset);
+  emit("movq    %rax, " + home(v));
+}
+
+static void statement(const Stmt &s) {
+  switch (s.kind) {
+  case COMPOUND_STMT:
+    for (const StmtPtr &statement : s.body)
+      ::statement(*statement);
+    break;
+  case ASSIGN_STMT:
+    store(s.name, expr(*s.value), s.offset);
+    break;
+  case IF_STMT: {
+    int otherwise = labels++;
+    branch(s.condition, false, otherwise);
+    statement(*s.branch);
+    if (s.elseBranch) {
+      int done = labels++;
+      emit("jmp     " + label(done));
+      place(otherwise);
+      statement(*s.elseBranch);
+      place(done);
+    } else {
+      place(otherwise);
+    }
+    break;
+  }
+  case WHILE_STMT: {
+    // Test at the bottom so each iteration takes one branch
+    int body = labels++, test = labels++;
+    emit("jmp     " + label(test));
+    place(body);
+    statement(*s.branch);
+    place(test);
+    branch(s.condition, true, body);
+    break;
+  }
+  case RETURN_STMT:
+    if (current == nullptr) {
+      emit("jmp     " + label(returnLabel));
+      break;
+    }
+    if (s.value) {
+      ValueType type = expr(*s.value);
+      if (type != returnTypes[current - functions.data()])
+        throw CompileError("function " + quoted(current->name) +
+                               " returns both integer and boolean",
+                           s.offset);
+    } else {
+      emit("xorl    %eax, %eax");
+    }
+    emit("jmp     " + label(returnLabel));
+    break;
+  case PRINT_STMT: {
+    ValueType type = expr(*s.value);
+    emit("movq    %rax, %rdi");
+    emit(type == BOOL_VALUE   ? "call    rt_print_bool"
+         : type == REAL_VALUE ? "call    rt_print_real"
+                              : "call    rt_print_int");
+    realText = realText || type == REAL_VALUE;
+    break;
+  }
+  case SCAN_STMT:
+    for (const ExprPtr &target : s.targets) {
+      Variable v = variable(target->name, target->offset);
+      loadMessage(message(std::string("scan expected a value of type ") +
+                              typeName(v.type),
+                          target->offset));
+      emit(v.type == BOOL_VALUE   ? "call    rt_scan_bool"
+           : v.type == REAL_VALUE ? "call    rt_scan_real"
+                                  : "call    rt_scan_int");
+      emit("movq    %rax, " + home(v));
+      realText = realText || v.type == REAL_VALUE;
+    }
+    break;
+  }
+}
+
+// Give each parameter and local a home: the busiest get the callee-saved
+// registers, the rest stack slots below them
+static void allocate(FunctionInfo &f) {
+  std::vector<int> order(f.names.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(),
+                   [&](int a, int b) { return f.uses[a] > f.uses[b]; });
+
+  f.saved = std::min<int>(order.size(), 5);
+  int slots = order.size() - f.saved;
+  f.frame = slots + (f.saved + slots) % 2; // keep rsp 16-byte aligned
+  f.homes.assign(order.size(), "");
+  for (size_t i = 0; i < order.size(); i++) {
+    if ((int)i < f.saved) {
+      f.homes[order[i]] = savedRegisters[i];
+    } else {
+      f.homes[order[i]] =
+          std::to_string(-8 * (f.saved + 1 + int(i) - f.saved)) + "(%rbp)";
+    }
+  }
+}
+
+static void writeStubs() {
+  for (const std::pair<int, int> &stub : stubs) {
+    place(stub.first);
+    loadMessage(stub.second);
+    emit("jmp     rt_error");
+  }
+  stubs.clear();
+}
+
+static void function(const FunctionDef &def, FunctionInfo &f) {
+  current = &f;
+  pushed = 0;
+  returnLabel = labels++;
+
+  *out << "\nF_" << identifiers.name(def.name) << ":\n";
+  emit("pushq   %rbp");
+  emit("movq    %rsp, %rbp");
+  for (int i = 0; i < f.saved; i++)
+    emit(std::string("pushq   ") + savedRegisters[i]);
+  if (f.frame > 0)
+    emit("subq    $" + std::to_string(8 * f.frame) + ", %rsp");
+  emit("incq    rt_depth(%rip)");
+
+  for (size_t i = 0; i < f.names.size(); i++) {
+    if ((int)i >= f.parameters) {
+      emit("movq    $0, " + f.homes[i]);
+    } else if (i < 6) {
+      emit(std::string("movq    ") + argumentRegisters[i] + ", " + f.homes[i]);
+    } else {
+      emit("movq    " + std::to_string(16 + 8 * (i - 6)) + "(%rbp), %rax");
+      emit("movq    %rax, " + f.homes[i]);
+    }
+  }
+
+  for (const StmtPtr &s : def.body)
+    statement(*s);
+
+  // Falling off the end returns 0
+  emit("xorl    %eax, %eax");
+  place(returnLabel);
+  emit("decq    rt_depth(%rip)");
+  if (f.saved > 0)
+    emit("leaq    " + std::to_string(-8 * f.saved) + "(%rbp), %rsp");
+  for (int i = f.saved - 1; i >= 0; i--)
+    emit(std::string("popq    ") + savedRegisters[i]);
+  emit("popq    %rbp");
+  emit("ret");
+  writeStubs();
+}
+
+// A function returns real when any of its return values is real, and
+// boolean when all of them are boolean. Calls between functions can change
+// the answer, so repeat until nothing changes.
+static void inferReturnTypes(const Program &program) {
+  returnTypes.assign(program.functions.size(), INT_VALUE);
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = 0; i < program.functions.size(); i++) {
+      current = &functions[i];
+      std::vector<const Expr *> returns;
+      for (const StmtPtr &s : program.functions[i].body)
+        collectReturns(*s, returns);
+      if (returns.empty())
+        continue;
+      ValueType type = BOOL_VALUE;
+      for (const Expr *e : returns) {
+        ValueType returned = exprType(*e);
+        if (returned == REAL_VALUE)
+          type = REAL_VALUE;
+        else if (returned != BOOL_VALUE && type == BOOL_VALUE)
+          type = INT_VALUE;
+      }
+      if (type != returnTypes[i]) {
+        returnTypes[i] = type;
+        changed = true;
+      }
+    }
+  }
+}
+
+static std::string escaped(const std::string &text) {
+  std::string result;
+  for (char c : text) {
+    if (c == '\n') {
+      result += "\\n";
+    } else {
+      if (c == '"' || c == '\\')
+        result += '\\';
+      result += c;
+    }
+  }
+  return result;
+}
+
+void emitAssembly(const Program &program, std::ostream &output,
+                  const std::function<Location(size_t)> &locate) {
+  out = &output;
+  locator = &locate;
+  current = nullptr;
+  functions.assign(program.functions.size(), FunctionInfo());
+  globalNames.clear();
+  globalTypes.clear();
+  implicitGlobals.clear();
+  messages.clear();
+  stubs.clear();
+  labels = 0;
+  realText = false;
+
+  const std::vector<Symbol> &symbols = symbolTable.symbols();
+  slotOf.assign(symbols.size(), -1);
+  functionIndex.assign(symbols.size(), -1);
+  for (size_t i = 0; i < symbols.size(); i++) {
+    if (symbols[i].kind == GLOBAL_SYMBOL) {
+      slotOf[i] = globalNames.size();
+      globalNames.push_back(symbols[i].name);
+      globalTypes.push_back(valueType(symbols[i].type));
+    } else if (symbols[i].kind == FUNCTION_SYMBOL) {
+      for (size_t j = 0; j < symbols[i].members.size(); j++)
+        slotOf[symbols[i].members[j]] = j;
+    }
+  }
+
+  for (size_t i = 0; i < program.functions.size(); i++) {
+    const FunctionDef &def = program.functions[i];
+    const Symbol &symbol = symbols[def.symbol];
+    FunctionInfo &f = functions[i];
+    functionIndex[def.symbol] = i;
+    f.symbol = def.symbol;
+    f.name = def.name;
+    f.parameters = symbol.parameters;
+    for (int member : symbol.members) {
+      f.names.push_back(symbols[member].name);
+      f.types.push_back(valueType(symbols[member].type));
+      f.uses.push_back(0);
+    }
+  }
+  for (size_t i = 0; i < program.functions.size(); i++) {
+    current = &functions[i];
+    for (const StmtPtr &s : program.functions[i].body)
+      countStmt(*s, 1);
+    allocate(functions[i]);
+  }
+  current = nullptr;
+  for (const StmtPtr &s : program.statements)
+    countStmt(*s, 1);
+  inferReturnTypes(program);
+
+  // The main program is the entry point; it needs no frame of its own
+  *out << "        .text\n        .globl  _start\n_start:\n";
+  current = nullptr;
+  pushed = 0;
+  returnLabel = labels++;
+  for (const StmtPtr &s : program.statements)
+    statement(*s);
+  place(returnLabel);
+  emit("xorl    %edi, %edi");
+  emit("jmp     rt_exit");
+  writeStubs();
+
+  for (size_t i = 0; i < program.functions.size(); i++)
+    function(program.functions[i], functions[i]);
+
+  *out << "\n        .text" << runtime;
+  if (realText) {
+    const std::vector<uint64_t> &powers = powersOfTen();
+    *out << realRuntime << "        .balign 16\n";
+    for (int k = lowestPower; k <= highestPower; k++) {
+      if (k == 0)
+        *out << "rt_pow10:\n";
+      size_t i = 2 * (k - lowestPower);
+      *out << "        .quad   " << powers[i] << ", " << powers[i + 1]
+           << "\n";
+    }
+  }
+  for (size_t i = 0; i < messages.size(); i++)
+    *out << ".Lmsg" << i << ":\n        .ascii  \"" << escaped(messages[i])
+         << "\"\n";
+  for (size_t i = 0; i < globalNames.size(); i++)
+    *out << "        .lcomm  G_" << identifiers.name(globalNames[i])
+         << ", 8\n";
+}
@@ -0,0 +1,25 @@
+#ifndef ASM_BACKEND_HPP
+#define ASM_BACKEND_HPP
+
+#include <functional>
+#include <ostream>
+
+#include "ast.hpp"
+#include "compiler.hpp"
+#include "line_index.hpp"
+
+// Write the program as x86-64 GNU as source for Linux. The output carries
+// its own small runtime (buffered scan and print over read(2)/write(2)), so
+//
+//   as prog.s -o prog.o && ld prog.o -o prog
+//
+// gives a standalone executable. Functions follow the System V calling
+// convention; parameters and locals live in callee-saved registers where
+// they fit. Reals travel as their 64-bit patterns in the same registers
+// and homes as integers, with SSE2 doing the arithmetic; printing and
+// scanning them matches the VM digit for digit. `locate` turns offsets
+// into the locations quoted by run-time error messages.
+void emitAssembly(const Program &program, std::ostream &out,
+                  const std::function<Location(size_t)> &locate);
+
+#endif
@@ -0,0 +1,229 @@
+#include <sstream>
+
+#include "ast.hpp"
+#include "string_table.hpp"
+
+static ExprPtr makeExpr(ExprKind kind, size_t offset) {
+  ExprPtr e(new Expr());
+  e->kind = kind;
+  e->offset = offset;
+  return e;
+}
+
+ExprPtr makeInteger(int64_t value, size_t offset) {
+  ExprPtr e = makeExpr(INTEGER_EXPR, offset);
+  e->integer = value;
+  return e;
+}
+
+ExprPtr makeReal(double value, size_t offset) {
+  ExprPtr e = makeExpr(REAL_EXPR, offset);
+  e->real = value;
+  return e;
+}
+
+ExprPtr makeBoolean(bool value, size_t offset) {
+  ExprPtr e = makeExpr(BOOLEAN_EXPR, offset);
+  e->integer = value;
+  return e;
+}
+
+ExprPtr makeIdentifier(uint32_t name, size_t offset) {
+  ExprPtr e = makeExpr(IDENTIFIER_EXPR, offset);
+  e->name = name;
+  return e;
+}
+
+ExprPtr makeCall(uint32_t name, std::vector<ExprPtr> args, size_t offset) {
+  ExprPtr e = makeExpr(CALL_EXPR, offset);
+  e->name = name;
+  e->args = std::move(args);
+  return e;
+}
+
+bool isConstant(const Expr &e) {
+  return e.kind == INTEGER_EXPR || e.kind == REAL_EXPR;
+}
+
+static double realValue(const Expr &e) {
+  return e.kind == REAL_EXPR ? e.real : static_cast<double>(e.integer);
+}
+
+ExprPtr makeNegate(ExprPtr operand, size_t offset) {
+  if (operand->kind == INTEGER_EXPR && operand->integer != INT64_MIN) {
+    return makeInteger(-operand->integer, offset);
+  }
+  if (operand->kind == REAL_EXPR) {
+    return makeReal(-operand->real, offset);
+  }
+  ExprPtr e = makeExpr(NEGATE_EXPR, offset);
+  e->left = std::move(operand);
+  return e;
+}
+
+// Fold two integer constants. Returns false when the result would
+// overflow or divide by zero, which is left for run time.
+static bool foldIntegers(ExprKind kind, int64_t a, int64_t b, int64_t &result) {
+  switch (kind) {
+  case ADD_EXPR:
+    return !__builtin_add_overflow(a, b, &result);
+  case SUBTRACT_EXPR:
+    return !__builtin_sub_overflow(a, b, &result);
+  case MULTIPLY_EXPR:
+    return !__builtin_mul_overflow(a, b, &result);
+  case DIVIDE_EXPR:
+    if (b == 0 || (a == INT64_MIN && b == -1))
+      return false;
+    result = a / b;
+    return true;
+  default:
+    return false;
+  }
+}
+
+ExprPtr makeBinary(ExprKind kind, ExprPtr left, ExprPtr right) {
+  size_t offset = left->offset;
+  if (isConstant(*left) && isConstant(*right)) {
+    if (left->kind == INTEGER_EXPR && right->kind == INTEGER_EXPR) {
+      int64_t result;
+      if (foldIntegers(kind, left->integer, right->integer, result))
+        return makeInteger(result, offset);
+    } else {
+      // An integer operand is promoted to real
+      double a = realValue(*left), b = realValue(*right);
+      switch (kind) {
+      case ADD_EXPR:
+        return makeReal(a + b, offset);
+      case SUBTRACT_EXPR:
+        return makeReal(a - b, offset);
+      case MULTIPLY_EXPR:
+        return makeReal(a * b, offset);
+      case DIVIDE_EXPR:
+        if (b != 0)
+          return makeReal(a / b, offset);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  ExprPtr e = makeExpr(kind, offset);
+  e->left = std::move(left);
+  e->right = std::move(right);
+  return e;
+}
+
+ExprPtr makeToReal(ExprPtr operand) {
+  if (operand->kind == INTEGER_EXPR) {
+    ExprPtr e = makeReal(double(operand->integer), operand->offset);
+    e->type = REAL_VALUE;
+    return e;
+  }
+  ExprPtr e = makeExpr(TO_REAL_EXPR, operand->offset);
+  e->left = std::move(operand);
+  e->type = REAL_VALUE;
+  return e;
+}
+
+static void print(std::ostream &out, const Expr &e) {
+  switch (e.kind) {
+  case INTEGER_EXPR:
+    out << e.integer;
+    break;
+  case REAL_EXPR: {
+    std::ostringstream text;
+    text << e.real;
+    // Keep reals distinguishable from integers
+    out << text.str()
+        << (text.str().find_first_of(".ein") == std::string::npos ? ".0" : "");
+    break;
+  }
+  case BOOLEAN_EXPR:
+    out << (e.integer ? "true" : "false");
+    break;
+  case IDENTIFIER_EXPR:
+    out << identifiers.name(e.name);
+    break;
+  case CALL_EXPR:
+    out << identifiers.name(e.name) << '(';
+    for (size_t i = 0; i < e.args.size(); i++) {
+      out << (i ? ", " : "");
+      print(out, *e.args[i]);
+    }
+    out << ')';
+    break;
+  case NEGATE_EXPR:
+    out << "-";
+    print(out, *e.left);
+    break;
+  case TO_REAL_EXPR:
+    out << "real(";
+    print(out, *e.left);
+    out << ')';
+    break;
+  default:
+    out << '(';
+    print(out, *e.left);
+    out << (e.kind == ADD_EXPR        ? " + "
+            : e.kind == SUBTRACT_EXPR ? " - "
+            : e.kind == MULTIPLY_EXPR ? " * "
+                                      : " / ");
+    print(out, *e.right);
+    out << ')';
+    break;
+  }
+}
+
+std::string exprToString(const Expr &e) {
+  std::ostringstream out;
+  print(out, e);
+  return out.str();
+}
+
+static ExprPtr cloneExpr(const ExprPtr &e,
+                         const std::function<size_t(size_t)> &offset) {
+  if (!e)
+    return nullptr;
+  ExprPtr copy(new Expr());
+  copy->kind = e->kind;
+  copy->offset = offset(e->offset);
+  copy->integer = e->integer;
+  copy->real = e->real;
+  copy->name = e->name;
+  copy->left = cloneExpr(e->left, offset);
+  copy->right = cloneExpr(e->right, offset);
+  for (const ExprPtr &arg : e->args)
+    copy->args.push_back(cloneExpr(arg, offset));
+  copy->type = e->type;
+  return copy;
+}
+
+static StmtPtr cloneStmt(const StmtPtr &s,
+                         const std::function<size_t(size_t)> &offset) {
+  if (!s)
+    return nullptr;
+  StmtPtr copy(new Stmt());
+  copy->kind = s->kind;
+  copy->offset = offset(s->offset);
+  copy->name = s->name;
+  copy->value = cloneExpr(s->value, offset);
+  copy->condition.left = cloneExpr(s->condition.left, offset);
+  copy->condition.op = s->condition.op;
+  copy->condition.right = cloneExpr(s->condition.right, offset);
+  copy->branch = cloneStmt(s->branch, offset);
+  copy->elseBranch = cloneStmt(s->elseBranch, offset);
+  copy->body = cloneStatements(s->body, offset);
+  for (const ExprPtr &target : s->targets)
+    copy->targets.push_back(cloneExpr(target, offset));
+  return copy;
+}
+
+std::vector<StmtPtr> cloneStatements(const std::vector<StmtPtr> &statements,
+                                     const std::function<size_t(size_t)> &offset) {
+  std::vector<StmtPtr> copy;
+  copy.reserve(statements.size());
+  for (const StmtPtr &s : statements)
+    copy.push_back(cloneStmt(s, offset));
+  return copy;
+}
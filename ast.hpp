@@ -0,0 +1,121 @@
+#ifndef AST_HPP
+#define AST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Type of a value: of an expression, a variable or a run-time value
+enum ValueType : int32_t { INT_VALUE, REAL_VALUE, BOOL_VALUE };
+
+enum ExprKind {
+  INTEGER_EXPR,
+  REAL_EXPR,
+  BOOLEAN_EXPR,
+  IDENTIFIER_EXPR,
+  CALL_EXPR,
+  NEGATE_EXPR,
+  ADD_EXPR,
+  SUBTRACT_EXPR,
+  MULTIPLY_EXPR,
+  DIVIDE_EXPR,
+  TO_REAL_EXPR // integer operand promoted to real, added by checkTypes()
+};
+
+struct Expr;
+typedef std::unique_ptr<Expr> ExprPtr;
+
+// Expression tree built by Expression(), Term(), Factor() and Primary()
+struct Expr {
+  ExprKind kind;
+  size_t offset;        // first token of the expression
+  int64_t integer = 0;  // INTEGER_EXPR and BOOLEAN_EXPR value
+  double real = 0;      // REAL_EXPR value
+  uint32_t name = 0;    // IDENTIFIER_EXPR and CALL_EXPR
+  ExprPtr left, right;  // operands; NEGATE_EXPR and TO_REAL_EXPR use left
+  std::vector<ExprPtr> args; // CALL_EXPR arguments, identifiers
+  ValueType type = INT_VALUE; // from checkTypes()
+};
+
+ExprPtr makeInteger(int64_t value, size_t offset);
+ExprPtr makeReal(double value, size_t offset);
+ExprPtr makeBoolean(bool value, size_t offset);
+ExprPtr makeIdentifier(uint32_t name, size_t offset);
+ExprPtr makeCall(uint32_t name, std::vector<ExprPtr> args, size_t offset);
+
+// These fold constant operands, so the tree handed to later stages is
+// already reduced
+ExprPtr makeNegate(ExprPtr operand, size_t offset);
+ExprPtr makeBinary(ExprKind kind, ExprPtr left, ExprPtr right);
+ExprPtr makeToReal(ExprPtr operand);
+
+bool isConstant(const Expr &e);
+std::string exprToString(const Expr &e);
+
+enum StmtKind {
+  COMPOUND_STMT,
+  ASSIGN_STMT,
+  IF_STMT,
+  RETURN_STMT,
+  PRINT_STMT,
+  SCAN_STMT,
+  WHILE_STMT
+};
+
+// R24. == | != | > | < | <= | =>
+enum RelopKind {
+  EQUAL_RELOP,
+  NOT_EQUAL_RELOP,
+  GREATER_RELOP,
+  LESS_RELOP,
+  LESS_EQUAL_RELOP,
+  GREATER_EQUAL_RELOP
+};
+
+struct Comparison {
+  ExprPtr left;
+  RelopKind op = EQUAL_RELOP;
+  ExprPtr right;
+};
+
+struct Stmt;
+typedef std::unique_ptr<Stmt> StmtPtr;
+
+// Statement built by Statement() and the rules under it
+struct Stmt {
+  StmtKind kind;
+  size_t offset;
+  uint32_t name = 0;            // ASSIGN_STMT target
+  ExprPtr value;                // ASSIGN_STMT, PRINT_STMT, RETURN_STMT (may be null)
+  Comparison condition;         // IF_STMT, WHILE_STMT
+  StmtPtr branch;               // IF_STMT then branch, WHILE_STMT body
+  StmtPtr elseBranch;           // IF_STMT, may be null
+  std::vector<StmtPtr> body;    // COMPOUND_STMT
+  std::vector<ExprPtr> targets; // SCAN_STMT identifiers
+};
+
+// A function from the first $$ section. Parameters and locals are in the
+// symbol table under `symbol`.
+struct FunctionDef {
+  uint32_t name;
+  size_t offset; // of the function keyword
+  size_t end;    // one past the closing '}'
+  int symbol;
+  ValueType type = INT_VALUE; // of what it returns, from checkTypes()
+  std::vector<StmtPtr> body;
+};
+
+// Deep copy of a function body, each offset replaced by offset(old)
+std::vector<StmtPtr> cloneStatements(const std::vector<StmtPtr> &statements,
+                                     const std::function<size_t(size_t)> &offset);
+
+// A whole parsed program. Globals are in the symbol table.
+struct Program {
+  std::vector<FunctionDef> functions;
+  std::vector<StmtPtr> statements;
+};
+
+#endif
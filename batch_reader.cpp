@@ -0,0 +1,383 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "batch_reader.hpp"
+
+// One file being read: open, then reads into a pooled buffer, then close
+struct BatchReader::Slot {
+  enum { FREE, OPENING, READING, CLOSING } state = FREE;
+  size_t file = 0;
+  int fd = -1;
+  size_t size = 0;
+  std::vector<char> *buffer = nullptr;
+  unsigned position = 0; // of its operation's entry in the submission queue
+};
+
+BatchReader::BatchReader(unsigned depth, size_t bufferSize)
+    : depth(depth ? depth : 1), bufferSize(bufferSize),
+      pool(this->depth, std::vector<char>(bufferSize)) {
+  setupRing(this->depth);
+}
+
+BatchReader::~BatchReader() { closeRing(); }
+
+// Unmap and close the ring; later runs use the pread fallback
+void BatchReader::closeRing() {
+  if (sqes)
+    munmap(sqes, sqesSize);
+  if (cqRing && cqRing != sqRing)
+    munmap(cqRing, cqRingSize);
+  if (sqRing)
+    munmap(sqRing, sqRingSize);
+  if (ring >= 0)
+    close(ring);
+  sqes = nullptr;
+  sqRing = cqRing = nullptr;
+  ring = -1;
+  pending = 0;
+}
+
+// Create the ring and check the kernel supports the opcodes we need.
+// Leaves ring at -1 (pread fallback) on any failure.
+bool BatchReader::setupRing(unsigned entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0) {
+    return false;
+  }
+
+  size_t probeSize = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+  std::vector<char> probeBuffer(probeSize, 0);
+  io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probeBuffer.data());
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) <
+      0) {
+    close(fd);
+    return false;
+  }
+  for (int op : {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE}) {
+    if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+      close(fd);
+      return false;
+    }
+  }
+
+  sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) {
+    sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+  }
+
+  sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sqRing == MAP_FAILED) {
+    sqRing = nullptr;
+    close(fd);
+    return false;
+  }
+  cqRing = single ? sqRing
+                  : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqeMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (cqRing == MAP_FAILED || sqeMap == MAP_FAILED) {
+    if (cqRing != MAP_FAILED && cqRing != sqRing)
+      munmap(cqRing, cqRingSize);
+    if (sqeMap != MAP_FAILED)
+      munmap(sqeMap, sqesSize);
+    munmap(sqRing, sqRingSize);
+    sqRing = cqRing = nullptr;
+    close(fd);
+    return false;
+  }
+  sqes = static_cast<io_uring_sqe *>(sqeMap);
+
+  char *sq = static_cast<char *>(sqRing);
+  char *cq = static_cast<char *>(cqRing);
+  sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sqMask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cqMask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+  ring = fd;
+  return true;
+}
+
+void BatchReader::run(const std::vector<std::string> &paths,
+                      const FileHandler &handler) {
+  if (usingUring()) {
+    runUring(paths, handler);
+  } else {
+    runPread(paths, handler);
+  }
+}
+
+// Claim the next submission queue entry. Every slot has at most one
+// operation in flight and the ring has one entry per slot, so it never fills.
+io_uring_sqe *BatchReader::nextSqe() {
+  unsigned tail = *sqTail + pending;
+  unsigned index = tail & *sqMask;
+  io_uring_sqe *sqe = &sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqArray[index] = index;
+  pending++;
+  return sqe;
+}
+
+// Publish queued entries and wait for at least one completion. Returns 0,
+// or the errno of a failure that retrying will not cure.
+int BatchReader::submitAndWait() {
+  __atomic_store_n(sqTail, *sqTail + pending, __ATOMIC_RELEASE);
+  unsigned toSubmit = pending;
+  pending = 0;
+  while (syscall(__NR_io_uring_enter, ring, toSubmit, 1,
+                 IORING_ENTER_GETEVENTS, nullptr, 0) < 0) {
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      return errno;
+    }
+    toSubmit = 0;
+  }
+  return 0;
+}
+
+void BatchReader::runUring(const std::vector<std::string> &paths,
+                           const FileHandler &handler) {
+  std::vector<Slot> slots(depth);
+  size_t nextFile = 0;
+  size_t active = 0;
+
+  auto claim = [&](size_t s) {
+    slots[s].position = *sqTail + pending;
+    return nextSqe();
+  };
+  auto startOpen = [&](size_t s) {
+    Slot &slot = slots[s];
+    slot.state = Slot::OPENING;
+    slot.file = nextFile++;
+    slot.size = 0;
+    io_uring_sqe *sqe = claim(s);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uint64_t>(paths[slot.file].c_str());
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->user_data = s;
+    active++;
+  };
+  auto startRead = [&](size_t s) {
+    Slot &slot = slots[s];
+    slot.state = Slot::READING;
+    io_uring_sqe *sqe = claim(s);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(slot.buffer->data() + slot.size);
+    sqe->len = slot.buffer->size() - slot.size;
+    sqe->off = slot.size;
+    sqe->user_data = s;
+  };
+  auto startClose = [&](size_t s) {
+    Slot &slot = slots[s];
+    slot.state = Slot::CLOSING;
+    io_uring_sqe *sqe = claim(s);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = slot.fd;
+    sqe->user_data = s;
+  };
+
+  for (size_t s = 0; s < slots.size(); s++) {
+    slots[s].buffer = &pool[s];
+    if (nextFile < paths.size())
+      startOpen(s);
+  }
+
+  while (active > 0) {
+    if (submitAndWait() != 0) {
+      // The ring is unusable: files it has not finished are read again
+      // without it, once nothing it started can still touch a buffer
+      std::vector<std::string> rest;
+      recover(slots, paths, rest);
+      rest.insert(rest.end(), paths.begin() + nextFile, paths.end());
+      closeRing();
+      runPread(rest, handler);
+      return;
+    }
+
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      io_uring_cqe *cqe = &cqes[head & *cqMask];
+      size_t s = cqe->user_data;
+      int res = cqe->res;
+      Slot &slot = slots[s];
+
+      if (slot.state == Slot::OPENING) {
+        if (res < 0) {
+          handler(paths[slot.file], nullptr, 0, -res);
+          slot.state = Slot::FREE;
+        } else {
+          slot.fd = res;
+          startRead(s);
+        }
+      } else if (slot.state == Slot::READING) {
+        if (res < 0) {
+          handler(paths[slot.file], nullptr, 0, -res);
+          startClose(s);
+          continue;
+        }
+        if (res == 0) {
+          handler(paths[slot.file], slot.buffer->data(), slot.size, 0);
+          startClose(s);
+          continue;
+        }
+        // Only a read of nothing is the end; pipes and procfs files can
+        // return less than asked before it
+        slot.size += res;
+        if (slot.size == slot.buffer->size())
+          slot.buffer->resize(slot.buffer->size() * 2);
+        startRead(s);
+      } else if (slot.state == Slot::CLOSING) {
+        slot.state = Slot::FREE;
+      }
+
+      if (slot.state == Slot::FREE) {
+        active--;
+        if (slot.buffer->size() > bufferSize * 16) {
+          // Do not let one huge file pin a huge buffer in the pool
+          std::vector<char>(bufferSize).swap(*slot.buffer);
+        }
+        if (nextFile < paths.size())
+          startOpen(s);
+      }
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+  }
+}
+
+// Wind down a failed ring. Entries the kernel has not consumed are taken
+// back, the operations it has are cancelled and waited for, and every
+// descriptor a slot holds or an open returned is closed. A buffer whose
+// read is still running after that is abandoned, never reused. The files
+// not yet handed to the handler are added to `rest`.
+void BatchReader::recover(std::vector<Slot> &slots,
+                          const std::vector<std::string> &paths,
+                          std::vector<std::string> &rest) {
+  const uint64_t cancelTag = ~uint64_t(0);
+  // An operation is over: `ran` says whether the kernel ran it, and `res`
+  // is its result if it did
+  auto settle = [&](Slot &slot, bool ran, int res) {
+    if (slot.state == Slot::OPENING && ran && res >= 0)
+      close(res);
+    if (slot.state == Slot::READING || (slot.state == Slot::CLOSING && !ran))
+      close(slot.fd);
+    if (slot.state != Slot::CLOSING)
+      rest.push_back(paths[slot.file]);
+    slot.state = Slot::FREE;
+  };
+
+  unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  size_t running = 0;
+  for (Slot &slot : slots) {
+    if (slot.state == Slot::FREE)
+      continue;
+    if (int(slot.position - head) >= 0) {
+      settle(slot, false, 0);
+    } else {
+      running++;
+    }
+  }
+  __atomic_store_n(sqTail, head, __ATOMIC_RELEASE);
+  pending = 0;
+
+  for (size_t s = 0; s < slots.size(); s++) {
+    if (slots[s].state == Slot::FREE)
+      continue;
+    io_uring_sqe *sqe = nextSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = s;
+    sqe->user_data = cancelTag;
+  }
+  __atomic_store_n(sqTail, *sqTail + pending, __ATOMIC_RELEASE);
+  // Best effort: whatever cannot be cancelled still completes
+  syscall(__NR_io_uring_enter, ring, pending, 0, 0, nullptr, 0);
+  pending = 0;
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (running > 0 && std::chrono::steady_clock::now() < deadline) {
+    unsigned cqFirst = *cqHead;
+    unsigned cqLast = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    if (cqFirst == cqLast) {
+      if (syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS,
+                  nullptr, 0) < 0)
+        usleep(1000);
+      continue;
+    }
+    for (; cqFirst != cqLast; cqFirst++) {
+      io_uring_cqe *cqe = &cqes[cqFirst & *cqMask];
+      if (cqe->user_data == cancelTag)
+        continue;
+      settle(slots[cqe->user_data], true, cqe->res);
+      running--;
+    }
+    __atomic_store_n(cqHead, cqFirst, __ATOMIC_RELEASE);
+  }
+
+  // Still running: a close finishes by itself, and an open's descriptor
+  // is lost
+  for (Slot &slot : slots) {
+    if (slot.state == Slot::CLOSING) {
+      slot.state = Slot::FREE;
+    } else if (slot.state != Slot::FREE) {
+      if (slot.state == Slot::READING) {
+        // Deliberately leaked: the kernel may still write to it
+        new std::vector<char>(std::move(*slot.buffer));
+        std::vector<char>(bufferSize).swap(*slot.buffer);
+      }
+      settle(slot, false, 0);
+    }
+  }
+}
+
+// One file at a time with open/pread/close, for kernels without io_uring
+void BatchReader::runPread(const std::vector<std::string> &paths,
+                           const FileHandler &handler) {
+  std::vector<char> &buffer = pool[0];
+  for (const std::string &path : paths) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      handler(path, nullptr, 0, errno);
+      continue;
+    }
+    size_t size = 0;
+    int err = 0;
+    for (;;) {
+      if (size == buffer.size())
+        buffer.resize(buffer.size() * 2);
+      ssize_t n = pread(fd, buffer.data() + size, buffer.size() - size, size);
+      if (n < 0 && errno == ESPIPE) // a pipe or FIFO has no offsets
+        n = read(fd, buffer.data() + size, buffer.size() - size);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        err = errno;
+        break;
+      }
+      if (n == 0)
+        break;
+      size += n;
+    }
+    close(fd);
+    handler(path, err ? nullptr : buffer.data(), err ? 0 : size, err);
+  }
+}
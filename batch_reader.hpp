@@ -0,0 +1,62 @@
+#ifndef BATCH_READER_HPP
+#define BATCH_READER_HPP
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Called once per file with its contents, or with err set to a positive
+// errno value if the file could not be read. The buffer is only valid
+// during the call; it goes back to the pool afterwards.
+typedef std::function<void(const std::string &path, const char *data,
+                           size_t size, int err)>
+    FileHandler;
+
+// Reads many files with up to `depth` open/read/close operations in flight
+// on an io_uring, recycling a fixed pool of buffers. Falls back to plain
+// open/pread/close when io_uring is unavailable, or for the files left if
+// the ring fails part way.
+class BatchReader {
+public:
+  explicit BatchReader(unsigned depth = 64, size_t bufferSize = 1 << 16);
+  ~BatchReader();
+  BatchReader(const BatchReader &) = delete;
+  BatchReader &operator=(const BatchReader &) = delete;
+
+  void run(const std::vector<std::string> &paths, const FileHandler &handler);
+  bool usingUring() const { return ring >= 0; }
+
+private:
+  struct Slot;
+
+  bool setupRing(unsigned entries);
+  void runUring(const std::vector<std::string> &paths,
+                const FileHandler &handler);
+  void runPread(const std::vector<std::string> &paths,
+                const FileHandler &handler);
+  void recover(std::vector<Slot> &slots, const std::vector<std::string> &paths,
+               std::vector<std::string> &rest);
+  struct io_uring_sqe *nextSqe();
+  int submitAndWait();
+  void closeRing();
+
+  unsigned depth;
+  size_t bufferSize;
+  std::vector<std::vector<char>> pool;
+
+  // io_uring state, mapped from the kernel
+  int ring = -1;
+  void *sqRing = nullptr;
+  void *cqRing = nullptr;
+  size_t sqRingSize = 0;
+  size_t cqRingSize = 0;
+  struct io_uring_sqe *sqes = nullptr;
+  size_t sqesSize = 0;
+  unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+  unsigned *cqHead, *cqTail, *cqMask;
+  struct io_uring_cqe *cqes;
+  unsigned pending = 0; // SQEs queued but not yet submitted
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch_runner.hpp"
+#include "vm.hpp"
+
+static const size_t chunkRecords = 1024;
+
+struct RecordError {
+  size_t record;
+  std::string message;
+  size_t offset;
+};
+
+struct Chunk {
+  bool done = false;
+  std::string out;
+  std::vector<RecordError> errors;
+};
+
+size_t runBatch(const Bytecode &bytecode, std::string_view records,
+                unsigned threads, bool binary, std::ostream &out,
+                std::ostream &err,
+                const std::function<Location(size_t)> &locate) {
+  std::vector<std::string_view> lines;
+  for (size_t start = 0; start < records.size();) {
+    size_t end = records.find('\n', start);
+    if (end == std::string_view::npos)
+      end = records.size();
+    lines.push_back(records.substr(start, end - start));
+    start = end + 1;
+  }
+
+  std::vector<Chunk> chunks((lines.size() + chunkRecords - 1) / chunkRecords);
+  std::atomic<size_t> next = 0;
+  std::mutex mutex;
+  std::condition_variable finished;
+
+  // Workers take the next chunk until none are left
+  auto work = [&]() {
+    VmContext context(bytecode);
+    std::string text;
+    std::vector<RecordError> errors;
+    for (size_t c; (c = next++) < chunks.size();) {
+      size_t end = std::min(lines.size(), (c + 1) * chunkRecords);
+      {
+        OutputBuffer output(text, binary);
+        for (size_t r = c * chunkRecords; r < end; r++) {
+          InputBuffer input(lines[r]);
+          try {
+            context.run(input, output);
+          } catch (const RuntimeError &e) {
+            errors.push_back({r, e.what(), e.offset});
+          }
+        }
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      chunks[c].out = std::move(text);
+      chunks[c].errors = std::move(errors);
+      chunks[c].done = true;
+      finished.notify_all();
+      text.clear();
+      errors.clear();
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < std::max(threads, 1u); i++)
+    workers.emplace_back(work);
+
+  size_t failed = 0;
+  for (Chunk &chunk : chunks) {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&] { return chunk.done; });
+    std::string text = std::move(chunk.out);
+    std::vector<RecordError> errors = std::move(chunk.errors);
+    lock.unlock();
+
+    out << text;
+    for (const RecordError &e : errors) {
+      Location at = locate(e.offset);
+      err << "Record " << e.record + 1 << ": Runtime error: " << e.message
+          << " @ line " << at.line << ", column " << at.column << '\n';
+    }
+    failed += errors.size();
+  }
+  for (std::thread &worker : workers)
+    worker.join();
+  out.flush();
+  return failed;
+}
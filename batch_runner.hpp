@@ -0,0 +1,25 @@
+#ifndef BATCH_RUNNER_HPP
+#define BATCH_RUNNER_HPP
+
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <string_view>
+
+#include "bytecode.hpp"
+#include "line_index.hpp"
+
+// Runs one compiled program once per line of `records`, each line being
+// the whole input of its run. Lines are handed out in chunks to `threads`
+// workers, each with its own VmContext and output buffers (binary ones
+// given `binary`, see OutputBuffer); the calling
+// thread writes each chunk's output to `out` and its run-time errors to
+// `err` in record order as soon as the chunks before it are written.
+// `locate` maps source offsets to lines and is only called on the calling
+// thread. Returns the number of records that stopped with an error.
+size_t runBatch(const Bytecode &bytecode, std::string_view records,
+                unsigned threads, bool binary, std::ostream &out,
+                std::ostream &err,
+                const std::function<Location(size_t)> &locate);
+
+#endif
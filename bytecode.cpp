@@ -0,0 +1,126 @@
+#include <charconv>
+#include <cstdio>
+
+#include "bytecode.hpp"
+#include "string_table.hpp"
+
+ValueType valueType(const std::string &qualifier) {
+  if (qualifier == "real")
+    return REAL_VALUE;
+  if (qualifier == "boolean")
+    return BOOL_VALUE;
+  return INT_VALUE;
+}
+
+const char *typeName(ValueType type) {
+  switch (type) {
+  case REAL_VALUE:
+    return "real";
+  case BOOL_VALUE:
+    return "boolean";
+  default:
+    return "integer";
+  }
+}
+
+static const char *const names[OPCODE_COUNT] = {
+    "CONST",          "LOAD_GLOBAL",       "STORE_GLOBAL",
+    "LOAD_LOCAL",     "STORE_LOCAL",       "NEGATE_INT",
+    "NEGATE_REAL",    "ADD_INT",           "ADD_REAL",
+    "SUBTRACT_INT",   "SUBTRACT_REAL",     "MULTIPLY_INT",
+    "MULTIPLY_REAL",  "DIVIDE_INT",        "DIVIDE_REAL",
+    "TO_REAL",        "EQUAL_INT",         "EQUAL_REAL",
+    "NOT_EQUAL_INT",  "NOT_EQUAL_REAL",    "GREATER_INT",
+    "GREATER_REAL",   "LESS_INT",          "LESS_REAL",
+    "LESS_EQUAL_INT", "LESS_EQUAL_REAL",   "GREATER_EQUAL_INT",
+    "GREATER_EQUAL_REAL", "JUMP",          "JUMP_IF_FALSE",
+    "CALL",           "RETURN",            "MEMO_CALL",
+    "MEMO_RETURN",    "PRINT_INT",         "PRINT_REAL",
+    "PRINT_BOOL",     "SCAN_GLOBAL",       "SCAN_LOCAL",
+    "HALT"};
+
+const char *opcodeName(Opcode op) { return names[op]; }
+
+int operandCount(Opcode op) {
+  switch (op) {
+  case CONST_OP:
+  case LOAD_GLOBAL_OP:
+  case STORE_GLOBAL_OP:
+  case LOAD_LOCAL_OP:
+  case STORE_LOCAL_OP:
+  case JUMP_OP:
+  case JUMP_IF_FALSE_OP:
+  case CALL_OP:
+  case MEMO_CALL_OP:
+  case MEMO_RETURN_OP:
+    return 1;
+  case SCAN_GLOBAL_OP:
+  case SCAN_LOCAL_OP:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+static std::string valueToString(const Value &v) {
+  if (v.type == BOOL_VALUE)
+    return v.integer ? "true" : "false";
+  if (v.type == INT_VALUE)
+    return std::to_string(v.integer);
+  char text[32];
+  return std::string(text, std::to_chars(text, text + sizeof text, v.real).ptr);
+}
+
+// One line per instruction, with names in place of slots and indexes
+void disassemble(const Bytecode &bytecode, std::ostream &out) {
+  const FunctionCode *function = nullptr;
+  size_t next = 0; // next function to start
+  for (size_t pc = 0; pc < bytecode.code.size();) {
+    if (pc == bytecode.entry) {
+      function = nullptr;
+      out << "main:\n";
+    }
+    if (next < bytecode.functions.size() &&
+        pc == bytecode.functions[next].entry) {
+      function = &bytecode.functions[next++];
+      out << identifiers.name(function->name) << ":\n";
+    }
+
+    Opcode op = Opcode(bytecode.code[pc]);
+    const int32_t *operand = &bytecode.code[pc + 1];
+    char label[24];
+    std::snprintf(label, sizeof label, "%5zu", pc);
+    out << label << "  " << opcodeName(op);
+
+    switch (op) {
+    case CONST_OP:
+      out << ' ' << valueToString(bytecode.constants[operand[0]]);
+      break;
+    case LOAD_GLOBAL_OP:
+    case STORE_GLOBAL_OP:
+    case SCAN_GLOBAL_OP:
+      out << ' ' << identifiers.name(bytecode.globalNames[operand[0]]);
+      break;
+    case LOAD_LOCAL_OP:
+    case STORE_LOCAL_OP:
+    case SCAN_LOCAL_OP:
+      out << ' ' << identifiers.name(function->localNames[operand[0]]);
+      break;
+    case JUMP_OP:
+    case JUMP_IF_FALSE_OP:
+      out << ' ' << operand[0];
+      break;
+    case CALL_OP:
+    case MEMO_CALL_OP:
+    case MEMO_RETURN_OP:
+      out << ' ' << identifiers.name(bytecode.functions[operand[0]].name);
+      break;
+    default:
+      break;
+    }
+    if (op == SCAN_GLOBAL_OP || op == SCAN_LOCAL_OP)
+      out << ' ' << typeName(ValueType(operand[1]));
+    out << '\n';
+    pc += 1 + operandCount(op);
+  }
+}
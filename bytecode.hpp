@@ -0,0 +1,108 @@
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+
+// A run-time value. Booleans are stored in `integer` as 0 or 1.
+struct Value {
+  ValueType type = INT_VALUE;
+  union {
+    int64_t integer = 0;
+    double real;
+  };
+};
+
+ValueType valueType(const std::string &qualifier);
+const char *typeName(ValueType type);
+
+// Instructions are one opcode word followed by their operands. Everything
+// works on the value stack; locals are slots above the frame base, with
+// the parameters first. Operations are specialised by operand type (the
+// _INT forms also compare booleans), so the VM keeps values unboxed and
+// never checks a type at run time.
+enum Opcode : int32_t {
+  CONST_OP,        // constant index
+  LOAD_GLOBAL_OP,  // global slot
+  STORE_GLOBAL_OP, // global slot
+  LOAD_LOCAL_OP,   // local slot
+  STORE_LOCAL_OP,  // local slot
+  NEGATE_INT_OP,
+  NEGATE_REAL_OP,
+  ADD_INT_OP,
+  ADD_REAL_OP,
+  SUBTRACT_INT_OP,
+  SUBTRACT_REAL_OP,
+  MULTIPLY_INT_OP,
+  MULTIPLY_REAL_OP,
+  DIVIDE_INT_OP,
+  DIVIDE_REAL_OP,
+  TO_REAL_OP,
+  EQUAL_INT_OP,
+  EQUAL_REAL_OP,
+  NOT_EQUAL_INT_OP,
+  NOT_EQUAL_REAL_OP,
+  GREATER_INT_OP,
+  GREATER_REAL_OP,
+  LESS_INT_OP,
+  LESS_REAL_OP,
+  LESS_EQUAL_INT_OP,
+  LESS_EQUAL_REAL_OP,
+  GREATER_EQUAL_INT_OP,
+  GREATER_EQUAL_REAL_OP,
+  JUMP_OP,          // target
+  JUMP_IF_FALSE_OP, // target; pops the condition
+  CALL_OP,          // function index; arguments are on the stack
+  RETURN_OP,        // pops the result
+  MEMO_CALL_OP,     // function index; CALL through its result cache
+  MEMO_RETURN_OP,   // function index; RETURN, caching the result
+  PRINT_INT_OP,
+  PRINT_REAL_OP,
+  PRINT_BOOL_OP,
+  SCAN_GLOBAL_OP, // global slot, value type
+  SCAN_LOCAL_OP,  // local slot, value type
+  HALT_OP,
+  OPCODE_COUNT
+};
+
+struct FunctionCode {
+  uint32_t name;
+  size_t entry;
+  int parameters;
+  int frameSize; // locals plus the deepest expression stack
+  bool memoized = false; // pure, called with MEMO_CALL_OP
+  std::vector<uint32_t> localNames;
+  std::vector<ValueType> localTypes;
+};
+
+// A while loop: where its condition starts and its jump back to it
+struct LoopCode {
+  size_t offset; // of the while keyword
+  size_t top;
+  size_t back;
+};
+
+// A compiled program. `offsets` maps every code word to the source offset
+// of the statement or expression it came from, for run-time errors.
+struct Bytecode {
+  std::vector<int32_t> code;
+  std::vector<size_t> offsets;
+  std::vector<Value> constants;
+  std::vector<FunctionCode> functions;
+  std::vector<uint32_t> globalNames;
+  std::vector<ValueType> globalTypes;
+  std::vector<LoopCode> loops;
+  size_t entry = 0;     // first instruction of the main program
+  int mainStack = 0;    // deepest expression stack of the main program
+};
+
+int operandCount(Opcode op);
+const char *opcodeName(Opcode op);
+void disassemble(const Bytecode &bytecode, std::ostream &out);
+
+#endif
@@ -0,0 +1,174 @@
+#include <algorithm>
+
+#include "call_graph.hpp"
+#include "string_table.hpp"
+#include "symbol_table.hpp"
+
+bool eliminateDeadFunctions = true;
+bool showCallGraph = false;
+
+static int functionSymbol; // of the function being walked, -1 for main
+static std::vector<int> functionIndex; // by symbol
+static std::vector<int> *calls;
+
+static void callsInExpr(const Expr &e) {
+  if (e.kind == CALL_EXPR) {
+    // Bad calls fail to compile anyway
+    int symbol = symbolTable.lookup(e.name, functionSymbol);
+    if (symbol >= 0 && functionIndex[symbol] >= 0)
+      calls->push_back(functionIndex[symbol]);
+  }
+  if (e.left)
+    callsInExpr(*e.left);
+  if (e.right)
+    callsInExpr(*e.right);
+}
+
+static void callsInStmt(const Stmt &s) {
+  if (s.value)
+    callsInExpr(*s.value);
+  if (s.condition.left)
+    callsInExpr(*s.condition.left);
+  if (s.condition.right)
+    callsInExpr(*s.condition.right);
+  if (s.branch)
+    callsInStmt(*s.branch);
+  if (s.elseBranch)
+    callsInStmt(*s.elseBranch);
+  for (const StmtPtr &statement : s.body)
+    callsInStmt(*statement);
+}
+
+static void collectCalls(const std::vector<StmtPtr> &statements, int symbol,
+                         std::vector<int> &out) {
+  functionSymbol = symbol;
+  calls = &out;
+  for (const StmtPtr &statement : statements)
+    callsInStmt(*statement);
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+// Tarjan's strongly connected components, with an explicit stack so long
+// call chains cannot overflow the native one
+static void findCycles(CallGraph &graph) {
+  int count = graph.callees.size();
+  std::vector<int> index(count, -1), low(count), members;
+  std::vector<bool> onStack(count, false);
+  std::vector<std::pair<int, size_t>> walk; // function, next callee
+  int next = 0;
+
+  for (int start = 0; start < count; start++) {
+    if (index[start] >= 0)
+      continue;
+    walk.push_back({start, 0});
+    index[start] = low[start] = next++;
+    members.push_back(start);
+    onStack[start] = true;
+
+    while (!walk.empty()) {
+      auto &[f, edge] = walk.back();
+      if (edge < graph.callees[f].size()) {
+        int callee = graph.callees[f][edge++];
+        if (index[callee] < 0) {
+          index[callee] = low[callee] = next++;
+          members.push_back(callee);
+          onStack[callee] = true;
+          walk.push_back({callee, 0});
+        } else if (onStack[callee]) {
+          low[f] = std::min(low[f], index[callee]);
+        }
+        continue;
+      }
+
+      int done = f;
+      walk.pop_back();
+      if (!walk.empty())
+        low[walk.back().first] = std::min(low[walk.back().first], low[done]);
+      if (low[done] != index[done])
+        continue;
+
+      std::vector<int> component;
+      int member;
+      do {
+        member = members.back();
+        members.pop_back();
+        onStack[member] = false;
+        component.push_back(member);
+      } while (member != done);
+      bool selfCall = std::binary_search(graph.callees[done].begin(),
+                                         graph.callees[done].end(), done);
+      if (component.size() > 1 || selfCall) {
+        std::sort(component.begin(), component.end());
+        graph.cycles.push_back(std::move(component));
+      }
+    }
+  }
+  std::sort(graph.cycles.begin(), graph.cycles.end());
+}
+
+CallGraph buildCallGraph(const Program &program) {
+  functionIndex.assign(symbolTable.symbols().size(), -1);
+  for (size_t i = 0; i < program.functions.size(); i++)
+    functionIndex[program.functions[i].symbol] = i;
+
+  CallGraph graph;
+  graph.callees.resize(program.functions.size());
+  for (size_t i = 0; i < program.functions.size(); i++)
+    collectCalls(program.functions[i].body, program.functions[i].symbol,
+                 graph.callees[i]);
+  collectCalls(program.statements, -1, graph.roots);
+  calls = nullptr;
+
+  graph.reachable.assign(program.functions.size(), false);
+  std::vector<int> pending;
+  for (int root : graph.roots) {
+    graph.reachable[root] = true;
+    pending.push_back(root);
+  }
+  while (!pending.empty()) {
+    int f = pending.back();
+    pending.pop_back();
+    for (int callee : graph.callees[f]) {
+      if (!graph.reachable[callee]) {
+        graph.reachable[callee] = true;
+        pending.push_back(callee);
+      }
+    }
+  }
+
+  findCycles(graph);
+  return graph;
+}
+
+Elimination removeUnreachable(Program &program, const CallGraph &graph) {
+  Elimination removed;
+  size_t kept = 0;
+  for (size_t i = 0; i < program.functions.size(); i++) {
+    FunctionDef &def = program.functions[i];
+    if (graph.reachable[i]) {
+      if (kept != i)
+        program.functions[kept] = std::move(def);
+      kept++;
+    } else {
+      removed.functions++;
+      removed.bytes += def.end - def.offset;
+    }
+  }
+  program.functions.resize(kept);
+  return removed;
+}
+
+void writeCallGraph(const Program &program, const CallGraph &graph,
+                    std::ostream &out) {
+  size_t reachable =
+      std::count(graph.reachable.begin(), graph.reachable.end(), true);
+  out << "Call graph: " << reachable << " of " << program.functions.size()
+      << " functions reachable from the main statements\n";
+  for (const std::vector<int> &cycle : graph.cycles) {
+    out << "Recursive:";
+    for (int f : cycle)
+      out << ' ' << identifiers.name(program.functions[f].name);
+    out << (graph.reachable[cycle[0]] ? "\n" : " (unreachable)\n");
+  }
+}
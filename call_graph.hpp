@@ -0,0 +1,43 @@
+#ifndef CALL_GRAPH_HPP
+#define CALL_GRAPH_HPP
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+#include "ast.hpp"
+
+// Calls between the functions of a program, from the call sites Primary()
+// recognised, resolved through symbolTable. Functions are numbered by
+// their index in program.functions.
+struct CallGraph {
+  std::vector<std::vector<int>> callees; // sorted, without repeats
+  std::vector<int> roots;                // called from the main statements
+  std::vector<bool> reachable;           // from the main statements
+  // Functions that call themselves, alone or through each other; each
+  // cycle in definition order
+  std::vector<std::vector<int>> cycles;
+};
+
+CallGraph buildCallGraph(const Program &program);
+
+struct Elimination {
+  size_t functions = 0;
+  size_t bytes = 0; // of source text
+};
+
+// Remove the functions the main statements cannot reach. Their symbols
+// stay in symbolTable, so names and diagnostics do not change.
+Elimination removeUnreachable(Program &program, const CallGraph &graph);
+
+// The reachable count and every recursion cycle, by name
+void writeCallGraph(const Program &program, const CallGraph &graph,
+                    std::ostream &out);
+
+// Compiling modes drop unreachable functions right after parsing, unless
+// this is cleared; with showCallGraph they report the graph and what went
+// to standard error, so standard output is only the program's own
+extern bool eliminateDeadFunctions;
+extern bool showCallGraph;
+
+#endif
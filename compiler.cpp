@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <unordered_map>
+
+#include "compiler.hpp"
+#include "purity.hpp"
+#include "string_table.hpp"
+#include "symbol_table.hpp"
+
+// Where a name lives at run time
+struct Slot {
+  bool global;
+  int index;
+  ValueType type;
+};
+
+bool memoizeCalls = true;
+
+static Bytecode *out;
+static FunctionCode *function; // being compiled, null for the main program
+static int functionSymbol;     // its symbol, -1 for the main program
+static std::vector<int> slotOf;        // global or local slot by symbol
+static std::vector<int> functionIndex; // function index by symbol
+static std::unordered_map<uint32_t, int> implicitGlobals;
+static std::unordered_map<uint32_t, int> implicitLocals;
+static ValueType returnType; // of the function being compiled
+static int depth, maxDepth; // expression stack
+static size_t offset;       // of what is being compiled
+
+static std::string quoted(uint32_t name) {
+  return "'" + std::string(identifiers.name(name)) + "'";
+}
+
+static void emit(int32_t word) {
+  out->code.push_back(word);
+  out->offsets.push_back(offset);
+}
+
+static void emit(Opcode op, int32_t operand) {
+  emit(op);
+  emit(operand);
+}
+
+static void stack(int change) {
+  depth += change;
+  maxDepth = std::max(maxDepth, depth);
+}
+
+// Emit a jump and return where its target goes, for patch()
+static size_t jump(Opcode op) {
+  emit(op, 0);
+  return out->code.size() - 1;
+}
+
+static void patch(size_t at) { out->code[at] = out->code.size(); }
+
+// Return from the function being compiled
+static void ret() {
+  if (function->memoized) {
+    emit(MEMO_RETURN_OP, function - out->functions.data());
+  } else {
+    emit(RETURN_OP);
+  }
+}
+
+static void constant(const Value &v) {
+  emit(CONST_OP, out->constants.size());
+  out->constants.push_back(v);
+  stack(1);
+}
+
+static void zero(ValueType type) {
+  Value v;
+  v.type = type;
+  constant(v);
+}
+
+static Slot variable(uint32_t name, size_t at) {
+  const std::vector<Symbol> &symbols = symbolTable.symbols();
+  int symbol = symbolTable.lookup(name, functionSymbol);
+  if (symbol >= 0) {
+    const Symbol &s = symbols[symbol];
+    if (s.kind == FUNCTION_SYMBOL)
+      throw CompileError("function " + quoted(name) + " used as a variable",
+                         at);
+    return {s.kind == GLOBAL_SYMBOL, slotOf[symbol], valueType(s.type)};
+  }
+
+  // Undeclared: an integer in the innermost scope
+  if (function == nullptr) {
+    auto [it, added] = implicitGlobals.emplace(name, out->globalNames.size());
+    if (added) {
+      out->globalNames.push_back(name);
+      out->globalTypes.push_back(INT_VALUE);
+    }
+    return {true, it->second, INT_VALUE};
+  }
+  auto [it, added] = implicitLocals.emplace(name, function->localNames.size());
+  if (added) {
+    function->localNames.push_back(name);
+    function->localTypes.push_back(INT_VALUE);
+  }
+  return {false, it->second, INT_VALUE};
+}
+
+static void load(uint32_t name, size_t at) {
+  Slot slot = variable(name, at);
+  emit(slot.global ? LOAD_GLOBAL_OP : LOAD_LOCAL_OP, slot.index);
+  stack(1);
+}
+
+static void compileExpr(const Expr &e) {
+  offset = e.offset;
+  switch (e.kind) {
+  case INTEGER_EXPR: {
+    Value v;
+    v.integer = e.integer;
+    constant(v);
+    break;
+  }
+  case REAL_EXPR: {
+    Value v;
+    v.type = REAL_VALUE;
+    v.real = e.real;
+    constant(v);
+    break;
+  }
+  case BOOLEAN_EXPR: {
+    Value v;
+    v.type = BOOL_VALUE;
+    v.integer = e.integer;
+    constant(v);
+    break;
+  }
+  case IDENTIFIER_EXPR:
+    load(e.name, e.offset);
+    break;
+  case CALL_EXPR: {
+    int symbol = symbolTable.lookup(e.name, functionSymbol);
+    if (symbol < 0)
+      throw CompileError("undeclared function " + quoted(e.name), e.offset);
+    const Symbol &callee = symbolTable.symbols()[symbol];
+    if (callee.kind != FUNCTION_SYMBOL)
+      throw CompileError(quoted(e.name) + " is not a function", e.offset);
+    if ((int)e.args.size() != callee.parameters)
+      throw CompileError(quoted(e.name) + " expects " +
+                             std::to_string(callee.parameters) +
+                             " argument(s), got " +
+                             std::to_string(e.args.size()),
+                         e.offset);
+    for (const ExprPtr &arg : e.args)
+      compileExpr(*arg);
+    offset = e.offset;
+    int index = functionIndex[symbol];
+    emit(out->functions[index].memoized ? MEMO_CALL_OP : CALL_OP, index);
+    stack(1 - (int)e.args.size());
+    break;
+  }
+  case NEGATE_EXPR:
+    compileExpr(*e.left);
+    offset = e.offset;
+    emit(e.type == REAL_VALUE ? NEGATE_REAL_OP : NEGATE_INT_OP);
+    break;
+  case TO_REAL_EXPR:
+    compileExpr(*e.left);
+    offset = e.offset;
+    emit(TO_REAL_OP);
+    break;
+  default: {
+    compileExpr(*e.left);
+    compileExpr(*e.right);
+    offset = e.offset;
+    // Operands have the expression's type
+    static const Opcode ops[][2] = {{ADD_INT_OP, ADD_REAL_OP},
+                                    {SUBTRACT_INT_OP, SUBTRACT_REAL_OP},
+                                    {MULTIPLY_INT_OP, MULTIPLY_REAL_OP},
+                                    {DIVIDE_INT_OP, DIVIDE_REAL_OP}};
+    emit(ops[e.kind - ADD_EXPR][e.type == REAL_VALUE]);
+    stack(-1);
+    break;
+  }
+  }
+}
+
+static void compileCondition(const Comparison &c) {
+  compileExpr(*c.left);
+  compileExpr(*c.right);
+  // Both sides have one type; booleans compare as integers
+  static const Opcode ops[][2] = {
+      {EQUAL_INT_OP, EQUAL_REAL_OP},
+      {NOT_EQUAL_INT_OP, NOT_EQUAL_REAL_OP},
+      {GREATER_INT_OP, GREATER_REAL_OP},
+      {LESS_INT_OP, LESS_REAL_OP},
+      {LESS_EQUAL_INT_OP, LESS_EQUAL_REAL_OP},
+      {GREATER_EQUAL_INT_OP, GREATER_EQUAL_REAL_OP}};
+  emit(ops[c.op][c.left->type == REAL_VALUE]);
+  stack(-1);
+}
+
+static void compileStmt(const Stmt &s) {
+  offset = s.offset;
+  switch (s.kind) {
+  case COMPOUND_STMT:
+    for (const StmtPtr &statement : s.body)
+      compileStmt(*statement);
+    break;
+  case ASSIGN_STMT: {
+    compileExpr(*s.value);
+    offset = s.offset;
+    Slot slot = variable(s.name, s.offset);
+    emit(slot.global ? STORE_GLOBAL_OP : STORE_LOCAL_OP, slot.index);
+    stack(-1);
+    break;
+  }
+  case IF_STMT: {
+    compileCondition(s.condition);
+    size_t skip = jump(JUMP_IF_FALSE_OP);
+    stack(-1);
+    compileStmt(*s.branch);
+    if (s.elseBranch) {
+      size_t end = jump(JUMP_OP);
+      patch(skip);
+      compileStmt(*s.elseBranch);
+      patch(end);
+    } else {
+      patch(skip);
+    }
+    break;
+  }
+  case WHILE_STMT: {
+    size_t top = out->code.size();
+    compileCondition(s.condition);
+    size_t exit = jump(JUMP_IF_FALSE_OP);
+    stack(-1);
+    compileStmt(*s.branch);
+    offset = s.offset;
+    emit(JUMP_OP, top);
+    out->loops.push_back({s.offset, top, out->code.size() - 2});
+    patch(exit);
+    break;
+  }
+  case RETURN_STMT:
+    // A return in the main program ends it
+    if (function == nullptr) {
+      emit(HALT_OP);
+      break;
+    }
+    if (s.value) {
+      compileExpr(*s.value);
+    } else {
+      zero(returnType);
+    }
+    offset = s.offset;
+    ret();
+    stack(-1);
+    break;
+  case PRINT_STMT:
+    compileExpr(*s.value);
+    offset = s.offset;
+    emit(s.value->type == REAL_VALUE   ? PRINT_REAL_OP
+         : s.value->type == BOOL_VALUE ? PRINT_BOOL_OP
+                                       : PRINT_INT_OP);
+    stack(-1);
+    break;
+  case SCAN_STMT:
+    for (const ExprPtr &target : s.targets) {
+      offset = target->offset;
+      Slot slot = variable(target->name, target->offset);
+      emit(slot.global ? SCAN_GLOBAL_OP : SCAN_LOCAL_OP, slot.index);
+      emit(slot.type);
+    }
+    break;
+  }
+}
+
+Bytecode compileProgram(const Program &program) {
+  Bytecode bytecode;
+  out = &bytecode;
+  implicitGlobals.clear();
+
+  const std::vector<Symbol> &symbols = symbolTable.symbols();
+  slotOf.assign(symbols.size(), -1);
+  functionIndex.assign(symbols.size(), -1);
+  for (size_t i = 0; i < symbols.size(); i++) {
+    if (symbols[i].kind == GLOBAL_SYMBOL) {
+      slotOf[i] = bytecode.globalNames.size();
+      bytecode.globalNames.push_back(symbols[i].name);
+      bytecode.globalTypes.push_back(valueType(symbols[i].type));
+    } else if (symbols[i].kind == FUNCTION_SYMBOL) {
+      for (size_t j = 0; j < symbols[i].members.size(); j++)
+        slotOf[symbols[i].members[j]] = j;
+    }
+  }
+  for (size_t i = 0; i < program.functions.size(); i++)
+    functionIndex[program.functions[i].symbol] = i;
+
+  // Functions first; calls name them by index, so nothing needs patching
+  bytecode.functions.resize(program.functions.size());
+  if (memoizeCalls) {
+    std::vector<bool> pure = findPureFunctions(program);
+    for (size_t i = 0; i < pure.size(); i++)
+      bytecode.functions[i].memoized = pure[i];
+  }
+  for (size_t i = 0; i < program.functions.size(); i++) {
+    const FunctionDef &def = program.functions[i];
+    const Symbol &symbol = symbols[def.symbol];
+    function = &bytecode.functions[i];
+    functionSymbol = def.symbol;
+    implicitLocals.clear();
+    depth = maxDepth = 0;
+    returnType = def.type;
+
+    function->name = def.name;
+    function->entry = bytecode.code.size();
+    function->parameters = symbol.parameters;
+    for (int member : symbol.members) {
+      function->localNames.push_back(symbols[member].name);
+      function->localTypes.push_back(valueType(symbols[member].type));
+    }
+    for (const StmtPtr &statement : def.body)
+      compileStmt(*statement);
+
+    // Falling off the end returns 0
+    offset = def.end;
+    zero(returnType);
+    ret();
+    function->frameSize = function->localNames.size() + maxDepth;
+  }
+
+  function = nullptr;
+  functionSymbol = -1;
+  depth = maxDepth = 0;
+  bytecode.entry = bytecode.code.size();
+  for (const StmtPtr &statement : program.statements)
+    compileStmt(*statement);
+  emit(HALT_OP);
+  bytecode.mainStack = maxDepth;
+  return bytecode;
+}
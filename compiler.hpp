@@ -0,0 +1,28 @@
+#ifndef COMPILER_HPP
+#define COMPILER_HPP
+
+#include <stdexcept>
+#include <string>
+
+#include "ast.hpp"
+#include "bytecode.hpp"
+
+// A program the parser accepted but that cannot be compiled: calls to
+// something that is not a function, or with the wrong argument count
+struct CompileError : std::runtime_error {
+  CompileError(const std::string &msg, size_t offset)
+      : std::runtime_error(msg), offset(offset) {}
+  size_t offset;
+};
+
+// Compile the parsed program, resolving names through symbolTable. Names
+// that were never declared become integer variables of the function (or
+// of the main program) they appear in. The program must have passed
+// checkTypes(), whose types pick the instructions.
+Bytecode compileProgram(const Program &program);
+
+// Call pure functions through a result cache (see findPureFunctions());
+// on by default
+extern bool memoizeCalls;
+
+#endif
@@ -0,0 +1,28 @@
+#include <string>
+#include <vector>
+
+#include "embedded.hpp"
+#include "string_table.hpp"
+#include "syntax_analyzer.hpp"
+
+// The tokens lexer() would have returned, then the usual parse over them;
+// identifiers are interned and literals converted here, at run time
+void parseEmbedded(std::string_view text, const EmbeddedToken *tokens,
+                   size_t count) {
+  LineIndex lines;
+  lines.add(text.data(), text.size(), 0);
+
+  std::vector<TokenResult> replayed;
+  replayed.reserve(count);
+  for (size_t i = 0; i < count && tokens[i].kind != EMBEDDED_EOF; i++) {
+    const EmbeddedToken &token = tokens[i];
+    replayed.push_back({embeddedKindNames[token.kind],
+                        std::string(text.substr(token.offset, token.length)),
+                        token.offset});
+    if (token.kind == EMBEDDED_IDENTIFIER) {
+      replayed.back().id = identifiers.intern(replayed.back().lexeme);
+    }
+    convertLiteral(replayed.back());
+  }
+  parseTokens(replayed, lines);
+}
@@ -0,0 +1,366 @@
+#ifndef EMBEDDED_HPP
+#define EMBEDDED_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "lexer.hpp"
+
+// Rat25S programs embedded in C++ as string literals:
+//
+//   constexpr auto &doubler =
+//       embeddedProgram<"$$ $$ integer x; $$ scan(x); print(x * 2); $$">;
+//   parseEmbedded(doubler);
+//
+// The text is lexed with the token rules of lexer() and checked against
+// the grammar during constant evaluation, so a syntax error fails the
+// build: the compiler's notes show the rule and expected token, and its
+// error the line. At run time parseEmbedded() only builds `program` from
+// the token array, as parseTokens() does, and can only find semantic
+// errors.
+
+enum EmbeddedKind : uint8_t {
+  EMBEDDED_KEYWORD,
+  EMBEDDED_IDENTIFIER,
+  EMBEDDED_INTEGER,
+  EMBEDDED_REAL,
+  EMBEDDED_SEPARATOR,
+  EMBEDDED_OPERATOR,
+  EMBEDDED_INVALID,
+  EMBEDDED_EOF
+};
+
+// As in TokenResult::token
+inline constexpr const char *embeddedKindNames[] = {
+    "Keyword",  "Identifier", "Integer", "Real",
+    "Separator", "Operator",  "Invalid", "EOF"};
+
+struct EmbeddedToken {
+  EmbeddedKind kind;
+  uint32_t offset;
+  uint32_t length;
+};
+
+// A string literal as a template argument
+template <size_t N> struct ProgramText {
+  char chars[N];
+
+  consteval ProgramText(const char (&text)[N]) {
+    for (size_t i = 0; i < N; i++)
+      chars[i] = text[i];
+  }
+  constexpr std::string_view view() const { return {chars, N - 1}; }
+};
+
+// The text and its tokens, ending with an EMBEDDED_EOF token
+template <size_t Size, size_t Count> struct EmbeddedProgram {
+  ProgramText<Size> text;
+  std::array<EmbeddedToken, Count> tokens;
+};
+
+// Stops constant evaluation: reading past error_at_line is not a constant
+// expression, and the compiler reports the index it was given
+consteval void embeddedSyntaxError(std::string_view text, size_t offset) {
+  size_t line = 1;
+  for (size_t i = 0; i < offset && i < text.size(); i++)
+    line += text[i] == '\n';
+  const bool error_at_line[1] = {};
+  if (!error_at_line[line])
+    return;
+}
+
+// Next token at or after pos, by the rules of lexer()
+consteval EmbeddedToken scanEmbedded(std::string_view text, size_t pos) {
+  auto at = [&](size_t i) -> int {
+    return i < text.size() ? static_cast<unsigned char>(text[i]) : -1;
+  };
+  while (pos < text.size()) {
+    size_t start = pos;
+    int c = at(pos++);
+    auto token = [&](EmbeddedKind kind) {
+      return EmbeddedToken{kind, uint32_t(start), uint32_t(pos - start)};
+    };
+    if (isBlank(c)) {
+      continue;
+    }
+    if (isLetter(c)) {
+      while (isWordChar(at(pos)))
+        pos++;
+      return token(isKeyword(text.substr(start, pos - start))
+                       ? EMBEDDED_KEYWORD
+                       : EMBEDDED_IDENTIFIER);
+    }
+    if (isDigit(c)) {
+      while (isDigit(at(pos)))
+        pos++;
+      if (at(pos) != '.')
+        return token(EMBEDDED_INTEGER);
+      pos++;
+      if (!isDigit(at(pos)))
+        return token(EMBEDDED_INVALID);
+      while (isDigit(at(pos)))
+        pos++;
+      return token(EMBEDDED_REAL);
+    }
+    if (c == '[' && at(pos) == '*') {
+      pos++;
+      while (pos < text.size() && !(at(pos) == '*' && at(pos + 1) == ']'))
+        pos++;
+      pos = pos < text.size() ? pos + 2 : pos;
+      continue;
+    }
+    if (isSeparator(c))
+      return token(EMBEDDED_SEPARATOR);
+    if (c == '$' && at(pos) == '$') {
+      pos++;
+      return token(EMBEDDED_SEPARATOR);
+    }
+    if (isOperator(c)) {
+      if (isTwoCharOperator(c, at(pos)))
+        pos++;
+      return token(EMBEDDED_OPERATOR);
+    }
+    return token(EMBEDDED_INVALID);
+  }
+  return {EMBEDDED_EOF, uint32_t(text.size()), 0};
+}
+
+// Tokens in text, EOF included; an invalid token is an error
+consteval size_t countEmbeddedTokens(std::string_view text) {
+  size_t count = 0;
+  EmbeddedToken token{};
+  do {
+    token = scanEmbedded(text, token.offset + token.length);
+    if (token.kind == EMBEDDED_INVALID)
+      embeddedSyntaxError(text, token.offset);
+    count++;
+  } while (token.kind != EMBEDDED_EOF);
+  return count;
+}
+
+// The rules of syntax_analyzer.cpp as recursive descent over a token
+// array, building nothing
+struct EmbeddedChecker {
+  std::string_view text;
+  const EmbeddedToken *tokens;
+  size_t pos = 0;
+
+  consteval bool is(EmbeddedKind kind, std::string_view lexeme = {}) const {
+    const EmbeddedToken &token = tokens[pos];
+    return token.kind == kind &&
+           (lexeme.empty() ||
+            text.substr(token.offset, token.length) == lexeme);
+  }
+
+  consteval void expect(EmbeddedKind kind, std::string_view lexeme = {}) {
+    if (!is(kind, lexeme))
+      embeddedSyntaxError(text, tokens[pos].offset);
+    pos++;
+  }
+
+  consteval bool isQualifier() const {
+    return is(EMBEDDED_KEYWORD, "integer") || is(EMBEDDED_KEYWORD, "boolean") ||
+           is(EMBEDDED_KEYWORD, "real");
+  }
+
+  // R1. <Rat25S> ::= $$ <Opt Function Definitions> $$ <Opt Declaration
+  // List> $$ <Statement List> $$
+  consteval void rat25s() {
+    expect(EMBEDDED_SEPARATOR, "$$");
+    while (is(EMBEDDED_KEYWORD, "function"))
+      function();
+    expect(EMBEDDED_SEPARATOR, "$$");
+    optDeclarationList();
+    expect(EMBEDDED_SEPARATOR, "$$");
+    statementList();
+    expect(EMBEDDED_SEPARATOR, "$$");
+    expect(EMBEDDED_EOF);
+  }
+
+  // R4. <Function> ::= function <Identifier> ( <Opt Parameter List> ) <Opt
+  // Declaration List> <Body>
+  consteval void function() {
+    expect(EMBEDDED_KEYWORD, "function");
+    expect(EMBEDDED_IDENTIFIER);
+    expect(EMBEDDED_SEPARATOR, "(");
+    if (is(EMBEDDED_IDENTIFIER)) {
+      // R6, R7. <Parameter> ::= <IDs> <Qualifier>, separated by commas
+      ids();
+      qualifier();
+      while (is(EMBEDDED_SEPARATOR, ",")) {
+        pos++;
+        ids();
+        qualifier();
+      }
+    }
+    expect(EMBEDDED_SEPARATOR, ")");
+    optDeclarationList();
+    expect(EMBEDDED_SEPARATOR, "{");
+    statementList();
+    expect(EMBEDDED_SEPARATOR, "}");
+  }
+
+  // R8. <Qualifier> ::= integer | boolean | real
+  consteval void qualifier() {
+    if (!isQualifier())
+      embeddedSyntaxError(text, tokens[pos].offset);
+    pos++;
+  }
+
+  // R10-R12. <Declaration> ::= <Qualifier> <IDs>, each followed by ;
+  consteval void optDeclarationList() {
+    while (isQualifier()) {
+      qualifier();
+      ids();
+      expect(EMBEDDED_SEPARATOR, ";");
+    }
+  }
+
+  // R13. <IDs> ::= <Identifier> | <Identifier>, <IDs>
+  consteval void ids() {
+    expect(EMBEDDED_IDENTIFIER);
+    while (is(EMBEDDED_SEPARATOR, ",")) {
+      pos++;
+      expect(EMBEDDED_IDENTIFIER);
+    }
+  }
+
+  // R14. <Statement List> ::= <Statement> | <Statement> <Statement List>
+  consteval void statementList() {
+    do {
+      statement();
+    } while (!is(EMBEDDED_SEPARATOR, "}") && !is(EMBEDDED_SEPARATOR, "$$"));
+  }
+
+  // R15-R22
+  consteval void statement() {
+    if (is(EMBEDDED_SEPARATOR, "{")) {
+      pos++;
+      statementList();
+      expect(EMBEDDED_SEPARATOR, "}");
+    } else if (is(EMBEDDED_IDENTIFIER)) {
+      pos++;
+      expect(EMBEDDED_OPERATOR, "=");
+      expression();
+      expect(EMBEDDED_SEPARATOR, ";");
+    } else if (is(EMBEDDED_KEYWORD, "if")) {
+      pos++;
+      expect(EMBEDDED_SEPARATOR, "(");
+      condition();
+      expect(EMBEDDED_SEPARATOR, ")");
+      statement();
+      if (is(EMBEDDED_KEYWORD, "else")) {
+        pos++;
+        statement();
+      }
+      expect(EMBEDDED_KEYWORD, "endif");
+    } else if (is(EMBEDDED_KEYWORD, "return")) {
+      pos++;
+      if (!is(EMBEDDED_SEPARATOR, ";"))
+        expression();
+      expect(EMBEDDED_SEPARATOR, ";");
+    } else if (is(EMBEDDED_KEYWORD, "print")) {
+      pos++;
+      expect(EMBEDDED_SEPARATOR, "(");
+      expression();
+      expect(EMBEDDED_SEPARATOR, ")");
+      expect(EMBEDDED_SEPARATOR, ";");
+    } else if (is(EMBEDDED_KEYWORD, "scan")) {
+      pos++;
+      expect(EMBEDDED_SEPARATOR, "(");
+      ids();
+      expect(EMBEDDED_SEPARATOR, ")");
+      expect(EMBEDDED_SEPARATOR, ";");
+    } else if (is(EMBEDDED_KEYWORD, "while")) {
+      pos++;
+      expect(EMBEDDED_SEPARATOR, "(");
+      condition();
+      expect(EMBEDDED_SEPARATOR, ")");
+      statement();
+      expect(EMBEDDED_KEYWORD, "endwhile");
+    } else {
+      embeddedSyntaxError(text, tokens[pos].offset);
+    }
+  }
+
+  // R23, R24. <Condition> ::= <Expression> <Relop> <Expression>
+  consteval void condition() {
+    expression();
+    if (!is(EMBEDDED_OPERATOR, "==") && !is(EMBEDDED_OPERATOR, "!=") &&
+        !is(EMBEDDED_OPERATOR, ">") && !is(EMBEDDED_OPERATOR, "<") &&
+        !is(EMBEDDED_OPERATOR, "<=") && !is(EMBEDDED_OPERATOR, "=>"))
+      embeddedSyntaxError(text, tokens[pos].offset);
+    pos++;
+    expression();
+  }
+
+  // R25, R26. <Expression> and <Term> with their primed rules as loops
+  consteval void expression() {
+    term();
+    while (is(EMBEDDED_OPERATOR, "+") || is(EMBEDDED_OPERATOR, "-")) {
+      pos++;
+      term();
+    }
+  }
+
+  consteval void term() {
+    factor();
+    while (is(EMBEDDED_OPERATOR, "*") || is(EMBEDDED_OPERATOR, "/")) {
+      pos++;
+      factor();
+    }
+  }
+
+  // R27, R28. <Factor> ::= - <Primary> | <Primary>
+  consteval void factor() {
+    if (is(EMBEDDED_OPERATOR, "-"))
+      pos++;
+    if (is(EMBEDDED_IDENTIFIER)) {
+      pos++;
+      if (is(EMBEDDED_SEPARATOR, "(")) {
+        pos++;
+        ids();
+        expect(EMBEDDED_SEPARATOR, ")");
+      }
+    } else if (is(EMBEDDED_SEPARATOR, "(")) {
+      pos++;
+      expression();
+      expect(EMBEDDED_SEPARATOR, ")");
+    } else if (is(EMBEDDED_INTEGER) || is(EMBEDDED_REAL) ||
+               is(EMBEDDED_KEYWORD, "true") || is(EMBEDDED_KEYWORD, "false")) {
+      pos++;
+    } else {
+      embeddedSyntaxError(text, tokens[pos].offset);
+    }
+  }
+};
+
+template <ProgramText text> consteval auto embedProgram() {
+  constexpr size_t count = countEmbeddedTokens(text.view());
+  EmbeddedProgram<sizeof(text.chars), count> program{text, {}};
+  EmbeddedToken token{};
+  for (size_t i = 0; i < count; i++) {
+    token = scanEmbedded(text.view(), token.offset + token.length);
+    program.tokens[i] = token;
+  }
+  EmbeddedChecker checker{text.view(), program.tokens.data()};
+  checker.rat25s();
+  return program;
+}
+
+template <ProgramText text>
+inline constexpr auto embeddedProgram = embedProgram<text>();
+
+// Build `program` from an embedded program's tokens; throws SyntaxError
+// only for what the grammar check cannot see, which is nothing
+void parseEmbedded(std::string_view text, const EmbeddedToken *tokens,
+                   size_t count);
+
+template <size_t Size, size_t Count>
+void parseEmbedded(const EmbeddedProgram<Size, Count> &embedded) {
+  parseEmbedded(embedded.text.view(), embedded.tokens.data(), Count);
+}
+
+#endif
@@ -0,0 +1,81 @@
+#include "function_cache.hpp"
+#include "string_table.hpp"
+
+// The class's first letter, and third for the I's, then the lexeme. No
+// lexeme holds a newline, so the key splits back into tokens one way only.
+void FunctionCache::addToken(std::string &key, const TokenResult &token) {
+  key += token.token[0];
+  if (token.token[0] == 'I')
+    key += token.token[2];
+  key += token.lexeme;
+  key += '\n';
+}
+
+std::vector<TokenResult>
+FunctionCache::tokens(std::string_view key,
+                      const std::vector<size_t> &offsets) {
+  std::vector<TokenResult> result;
+  result.reserve(offsets.size());
+  size_t i = 0;
+  for (size_t offset : offsets) {
+    TokenResult token;
+    switch (key[i++]) {
+    case 'K':
+      token.token = "Keyword";
+      break;
+    case 'I':
+      token.token = key[i] == 'e' ? "Identifier"
+                    : key[i] == 't' ? "Integer" : "Invalid";
+      i++;
+      break;
+    case 'R':
+      token.token = "Real";
+      break;
+    case 'S':
+      token.token = "Separator";
+      break;
+    case 'O':
+      token.token = "Operator";
+      break;
+    default:
+      token.token = "EOF";
+      break;
+    }
+    size_t end = key.find('\n', i);
+    token.lexeme = key.substr(i, end - i);
+    i = end + 1;
+    token.offset = offset;
+    if (token.token == "Identifier")
+      token.id = identifiers.intern(token.lexeme);
+    convertLiteral(token);
+    result.push_back(std::move(token));
+  }
+  return result;
+}
+
+const CachedFunction *FunctionCache::find(const std::string &key) {
+  auto found = entries.find(key);
+  if (found == entries.end()) {
+    counts.misses++;
+    return nullptr;
+  }
+  counts.hits++;
+  return &found->second;
+}
+
+// Once full, new functions are still parsed, just not kept
+void FunctionCache::insert(std::string key, CachedFunction entry) {
+  if (entries.size() < maxEntries)
+    entries.emplace(std::move(key), std::move(entry));
+}
+
+void FunctionCache::clear() {
+  entries.clear();
+  counts = FunctionCacheStats();
+}
+
+FunctionCacheStats FunctionCache::stats() const {
+  FunctionCacheStats result = counts;
+  result.entries = entries.size();
+  return result;
+}
@@ -0,0 +1,78 @@
+#ifndef FUNCTION_CACHE_HPP
+#define FUNCTION_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+#include "lexer.hpp"
+#include "symbol_table.hpp"
+
+// A call Function() made into the symbol table, at a token of its span
+struct SymbolCall {
+  enum Op : uint8_t { DECLARE, REFERENCE, REPORT } op;
+  bool parameter = false;              // DECLARE
+  ReferenceKind kind = READ_REFERENCE; // REFERENCE
+  int arity = 0;                       // REFERENCE
+  uint32_t name = 0;
+  uint32_t token = 0; // index in the span
+  std::string text;   // DECLARE qualifier, REPORT message
+};
+
+// One entry of a function's trace fragment
+struct TraceItem {
+  enum Kind : uint8_t { PRODUCTION, TOKEN, EXPRESSION } kind;
+  uint16_t depth = 0; // rule depth below Function()
+  const char *production = nullptr;
+  uint32_t expression = 0; // index in CachedFunction::expressions
+};
+
+// What parsing one function produced. Offsets are kept as indexes into the
+// function's tokens, so an identical span anywhere rebuilds it at its own.
+struct CachedFunction {
+  std::vector<std::pair<std::string, std::string>> params; // name, qualifier
+  std::vector<SymbolCall> symbols;
+  std::vector<TraceItem> trace;
+  std::vector<std::string> expressions; // "Expression:" lines, --folded
+  std::vector<StmtPtr> body;
+};
+
+struct FunctionCacheStats {
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t entries = 0;
+  size_t bytesSaved = 0; // source bytes of reused functions
+};
+
+// Parsed functions by their normalised token sequence: the class and lexeme
+// of each token from `function` to the closing '}', without offsets. Kept
+// for the whole process, so the files of a batch share it.
+class FunctionCache {
+public:
+  static const size_t maxTokens = 2048; // longer functions are parsed as usual
+  static const size_t maxEntries = 1 << 16;
+
+  static void addToken(std::string &key, const TokenResult &token);
+  // The tokens appended to a key, as the lexer made them at `offsets`
+  static std::vector<TokenResult> tokens(std::string_view key,
+                                         const std::vector<size_t> &offsets);
+
+  // Counts a hit or a miss
+  const CachedFunction *find(const std::string &key);
+  void insert(std::string key, CachedFunction entry);
+  void reused(size_t bytes) { counts.bytesSaved += bytes; }
+  void clear();
+
+  FunctionCacheStats stats() const;
+
+private:
+  std::unordered_map<std::string, CachedFunction> entries;
+  FunctionCacheStats counts;
+};
+
+#endif
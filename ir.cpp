@@ -0,0 +1,886 @@
+#include <charconv>
+#include <string>
+#include <unordered_map>
+
+#include "compiler.hpp"
+#include "ir.hpp"
+#include "string_table.hpp"
+#include "symbol_table.hpp"
+#include "vm.hpp"
+
+bool isTerminator(IrOp op) {
+  return op == IR_JUMP || op == IR_BRANCH || op == IR_RETURN || op == IR_HALT;
+}
+
+std::vector<int> successors(const IrFunction &f, int block) {
+  const IrInstr &last = f.values[f.blocks[block].instrs.back()];
+  std::vector<int> result;
+  for (int target : last.targets) {
+    if (target >= 0)
+      result.push_back(target);
+  }
+  return result;
+}
+
+// Lowering builds SSA directly from the tree (Braun et al., "Simple and
+// Efficient Construction of Static Single Assignment Form"): a variable
+// read looks for its definition in the block, then in the predecessors,
+// placing a phi where paths meet. Loop headers stay unsealed, with
+// operand-less phis, until their back edge is known.
+
+struct Variable {
+  bool memory; // a global in memory, else an SSA variable
+  int index;   // global slot or variable number
+};
+
+static IrModule *module;
+static IrFunction *fn;
+static int functionSymbol;
+static int current; // block, -1 after a terminator
+static std::vector<std::unordered_map<int, int>> definitions; // by block
+static std::vector<bool> sealed;
+static std::vector<std::vector<std::pair<int, int>>> incomplete; // var, phi
+static std::vector<int> forward; // replacement of a removed phi, or -1
+static std::vector<ValueType> variableTypes;
+static std::vector<uint32_t> variableNames;
+static std::unordered_map<uint32_t, int> implicitVariables;
+static std::vector<int> slotOf;        // global slot or variable, by symbol
+static std::vector<int> functionIndex; // by symbol
+static std::vector<bool> inMemory;     // by global slot
+static ValueType returnType;           // of the function being lowered
+
+static std::string quoted(uint32_t name) {
+  return "'" + std::string(identifiers.name(name)) + "'";
+}
+
+static int find(int value) {
+  while (forward[value] >= 0)
+    value = forward[value];
+  return value;
+}
+
+static int newBlock(bool seal) {
+  fn->blocks.push_back(IrBlock());
+  definitions.emplace_back();
+  sealed.push_back(seal);
+  incomplete.emplace_back();
+  return fn->blocks.size() - 1;
+}
+
+static int newValue(IrOp op, size_t offset, int block) {
+  IrInstr instr;
+  instr.op = op;
+  instr.offset = offset;
+  instr.block = block;
+  fn->values.push_back(instr);
+  forward.push_back(-1);
+  return fn->values.size() - 1;
+}
+
+// Append to the current block, starting an unreachable one after a
+// terminator
+static int append(IrOp op, size_t offset, std::vector<int> args = {}) {
+  if (current < 0)
+    current = newBlock(true);
+  int value = newValue(op, offset, current);
+  fn->values[value].args = std::move(args);
+  fn->blocks[current].instrs.push_back(value);
+  return value;
+}
+
+// Insert after the phis of a block
+static int prepend(IrOp op, size_t offset, int block) {
+  int value = newValue(op, offset, block);
+  std::vector<int> &instrs = fn->blocks[block].instrs;
+  size_t at = 0;
+  while (at < instrs.size() && fn->values[instrs[at]].op == IR_PHI)
+    at++;
+  instrs.insert(instrs.begin() + at, value);
+  return value;
+}
+
+static int zero(ValueType type, size_t offset, int block) {
+  int value = prepend(IR_CONST, offset, block);
+  fn->values[value].constant.type = type;
+  return value;
+}
+
+static void edge(int from, int to) { fn->blocks[to].preds.push_back(from); }
+
+static void jump(int target, size_t offset) {
+  if (current < 0)
+    return;
+  int value = append(IR_JUMP, offset);
+  fn->values[value].targets[0] = target;
+  edge(current, target);
+  current = -1;
+}
+
+static int readVariable(int variable, int block);
+
+// Drop a phi whose operands are all one other value
+static int removeTrivialPhi(int variable, int phi) {
+  int same = -1;
+  for (int arg : fn->values[phi].args) {
+    arg = find(arg);
+    if (arg == same || arg == phi)
+      continue;
+    if (same >= 0)
+      return phi;
+    same = arg;
+  }
+  if (same < 0)
+    same = zero(variableTypes[variable], fn->values[phi].offset,
+                fn->values[phi].block);
+  forward[phi] = same;
+  return same;
+}
+
+static int addPhiOperands(int variable, int phi) {
+  int block = fn->values[phi].block;
+  for (int pred : fn->blocks[block].preds) {
+    // Reading may add values and move the phi, so index it afterwards
+    int value = readVariable(variable, pred);
+    fn->values[phi].args.push_back(value);
+  }
+  return removeTrivialPhi(variable, phi);
+}
+
+static int newPhi(int variable, int block) {
+  int phi = newValue(IR_PHI, 0, block);
+  fn->values[phi].name = variableNames[variable];
+  std::vector<int> &instrs = fn->blocks[block].instrs;
+  instrs.insert(instrs.begin(), phi);
+  return phi;
+}
+
+static int readVariable(int variable, int block) {
+  auto found = definitions[block].find(variable);
+  if (found != definitions[block].end())
+    return find(found->second);
+
+  int value;
+  const std::vector<int> &preds = fn->blocks[block].preds;
+  if (!sealed[block]) {
+    value = newPhi(variable, block);
+    incomplete[block].push_back({variable, value});
+  } else if (preds.empty()) {
+    // Variables start at zero, as in the VM
+    value = zero(variableTypes[variable], 0, block);
+  } else if (preds.size() == 1) {
+    value = readVariable(variable, preds[0]);
+  } else {
+    value = newPhi(variable, block);
+    definitions[block][variable] = value;
+    value = addPhiOperands(variable, value);
+  }
+  definitions[block][variable] = value;
+  return value;
+}
+
+static void seal(int block) {
+  for (auto [variable, phi] : incomplete[block])
+    addPhiOperands(variable, phi);
+  incomplete[block].clear();
+  sealed[block] = true;
+}
+
+static int variableFor(uint32_t name, ValueType type) {
+  variableTypes.push_back(type);
+  variableNames.push_back(name);
+  return variableTypes.size() - 1;
+}
+
+static Variable resolve(uint32_t name, size_t offset) {
+  int symbol = symbolTable.lookup(name, functionSymbol);
+  if (symbol >= 0) {
+    const Symbol &s = symbolTable.symbols()[symbol];
+    if (s.kind == FUNCTION_SYMBOL)
+      throw CompileError("function " + quoted(name) + " used as a variable",
+                         offset);
+    if (s.kind == GLOBAL_SYMBOL) {
+      int slot = slotOf[symbol];
+      if (inMemory[slot] || functionSymbol >= 0)
+        return {true, slot};
+      // A global only the main program uses is an SSA variable there
+      auto [it, added] = implicitVariables.emplace(name, 0);
+      if (added)
+        it->second = variableFor(name, valueType(s.type));
+      return {false, it->second};
+    }
+    return {false, slotOf[symbol]};
+  }
+
+  // Undeclared: an integer in the innermost scope, which no function can
+  // see even in the main program
+  auto [it, added] = implicitVariables.emplace(name, 0);
+  if (added)
+    it->second = variableFor(name, INT_VALUE);
+  return {false, it->second};
+}
+
+static int load(uint32_t name, size_t offset) {
+  Variable v = resolve(name, offset);
+  if (!v.memory) {
+    if (current < 0)
+      current = newBlock(true);
+    return readVariable(v.index, current);
+  }
+  int value = append(IR_LOAD, offset);
+  fn->values[value].index = v.index;
+  return value;
+}
+
+static void store(uint32_t name, int value, size_t offset) {
+  Variable v = resolve(name, offset);
+  if (!v.memory) {
+    if (current < 0)
+      current = newBlock(true);
+    definitions[current][v.index] = value;
+    return;
+  }
+  int instr = append(IR_STORE, offset, {value});
+  fn->values[instr].index = v.index;
+}
+
+static int lowerExpr(const Expr &e) {
+  switch (e.kind) {
+  case INTEGER_EXPR:
+  case REAL_EXPR:
+  case BOOLEAN_EXPR: {
+    int value = append(IR_CONST, e.offset);
+    Value &c = fn->values[value].constant;
+    c.type = e.kind == REAL_EXPR      ? REAL_VALUE
+             : e.kind == BOOLEAN_EXPR ? BOOL_VALUE
+                                      : INT_VALUE;
+    if (c.type == REAL_VALUE) {
+      c.real = e.real;
+    } else {
+      c.integer = e.integer;
+    }
+    return value;
+  }
+  case IDENTIFIER_EXPR:
+    return load(e.name, e.offset);
+  case CALL_EXPR: {
+    int symbol = symbolTable.lookup(e.name, functionSymbol);
+    if (symbol < 0)
+      throw CompileError("undeclared function " + quoted(e.name), e.offset);
+    const Symbol &callee = symbolTable.symbols()[symbol];
+    if (callee.kind != FUNCTION_SYMBOL)
+      throw CompileError(quoted(e.name) + " is not a function", e.offset);
+    if ((int)e.args.size() != callee.parameters)
+      throw CompileError(quoted(e.name) + " expects " +
+                             std::to_string(callee.parameters) +
+                             " argument(s), got " +
+                             std::to_string(e.args.size()),
+                         e.offset);
+    std::vector<int> args;
+    for (const ExprPtr &arg : e.args)
+      args.push_back(lowerExpr(*arg));
+    int value = append(IR_CALL, e.offset, args);
+    fn->values[value].index = functionIndex[symbol];
+    return value;
+  }
+  case NEGATE_EXPR: {
+    int operand = lowerExpr(*e.left);
+    return append(IR_NEGATE, e.offset, {operand});
+  }
+  case TO_REAL_EXPR: {
+    int operand = lowerExpr(*e.left);
+    return append(IR_TO_REAL, e.offset, {operand});
+  }
+  default: {
+    int left = lowerExpr(*e.left);
+    int right = lowerExpr(*e.right);
+    return append(IrOp(IR_ADD + (e.kind - ADD_EXPR)), e.offset, {left, right});
+  }
+  }
+}
+
+static int lowerCondition(const Comparison &c) {
+  int left = lowerExpr(*c.left);
+  int right = lowerExpr(*c.right);
+  return append(IrOp(IR_EQUAL + int(c.op)), c.left->offset, {left, right});
+}
+
+static void branch(int condition, int whenTrue, int whenFalse, size_t offset) {
+  int value = append(IR_BRANCH, offset, {condition});
+  fn->values[value].targets[0] = whenTrue;
+  fn->values[value].targets[1] = whenFalse;
+  edge(current, whenTrue);
+  edge(current, whenFalse);
+  current = -1;
+}
+
+static void lowerStmt(const Stmt &s) {
+  switch (s.kind) {
+  case COMPOUND_STMT:
+    for (const StmtPtr &statement : s.body)
+      lowerStmt(*statement);
+    break;
+  case ASSIGN_STMT:
+    store(s.name, lowerExpr(*s.value), s.offset);
+    break;
+  case IF_STMT: {
+    int condition = lowerCondition(s.condition);
+    int then = newBlock(false);
+    int join = newBlock(false);
+    int otherwise = s.elseBranch ? newBlock(false) : join;
+    branch(condition, then, otherwise, s.offset);
+    seal(then);
+    current = then;
+    lowerStmt(*s.branch);
+    jump(join, s.offset);
+    if (s.elseBranch) {
+      seal(otherwise);
+      current = otherwise;
+      lowerStmt(*s.elseBranch);
+      jump(join, s.offset);
+    }
+    seal(join);
+    current = join;
+    break;
+  }
+  case WHILE_STMT: {
+    // The block before the header is the loop's only entry, so LICM
+    // can hoist into it
+    int header = newBlock(false);
+    jump(header, s.offset);
+    current = header;
+    int condition = lowerCondition(s.condition);
+    int body = newBlock(false);
+    int exit = newBlock(false);
+    branch(condition, body, exit, s.offset);
+    seal(body);
+    current = body;
+    lowerStmt(*s.branch);
+    jump(header, s.offset);
+    seal(header);
+    seal(exit);
+    current = exit;
+    break;
+  }
+  case RETURN_STMT:
+    if (fn->name == 0) {
+      append(IR_HALT, s.offset);
+    } else if (s.value) {
+      int value = lowerExpr(*s.value);
+      append(IR_RETURN, s.offset, {value});
+    } else {
+      int value = append(IR_CONST, s.offset);
+      fn->values[value].constant.type = returnType;
+      append(IR_RETURN, s.offset, {value});
+    }
+    current = -1;
+    break;
+  case PRINT_STMT: {
+    int value = lowerExpr(*s.value);
+    append(IR_PRINT, s.offset, {value});
+    break;
+  }
+  case SCAN_STMT:
+    for (const ExprPtr &target : s.targets) {
+      Variable v = resolve(target->name, target->offset);
+      ValueType type = v.memory ? module->globalTypes[v.index]
+                                : variableTypes[v.index];
+      int value = append(IR_SCAN, target->offset);
+      fn->values[value].type = type;
+      fn->values[value].name = target->name;
+      store(target->name, value, target->offset);
+    }
+    break;
+  }
+}
+
+// Remove phis made trivial by later removals, point arguments past
+// removed phis and drop those phis from their blocks
+static void finish() {
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t phi = 0; phi < fn->values.size(); phi++) {
+      if (fn->values[phi].op != IR_PHI || forward[phi] >= 0)
+        continue;
+      int same = -1;
+      bool trivial = true;
+      for (int arg : fn->values[phi].args) {
+        arg = find(arg);
+        if (arg == same || arg == (int)phi)
+          continue;
+        if (same >= 0) {
+          trivial = false;
+          break;
+        }
+        same = arg;
+      }
+      if (trivial && same >= 0) {
+        forward[phi] = same;
+        changed = true;
+      }
+    }
+  }
+
+  for (IrInstr &instr : fn->values) {
+    for (int &arg : instr.args)
+      arg = find(arg);
+  }
+  for (size_t i = 0; i < fn->values.size(); i++) {
+    if (forward[i] >= 0)
+      fn->values[i].block = -1;
+  }
+  for (IrBlock &block : fn->blocks) {
+    std::vector<int> kept;
+    for (int value : block.instrs) {
+      if (fn->values[value].block >= 0)
+        kept.push_back(value);
+    }
+    block.instrs = std::move(kept);
+  }
+}
+
+static void startFunction(IrFunction &f, int symbol) {
+  fn = &f;
+  functionSymbol = symbol;
+  definitions.clear();
+  sealed.clear();
+  incomplete.clear();
+  forward.clear();
+  variableTypes.clear();
+  variableNames.clear();
+  implicitVariables.clear();
+  current = newBlock(true);
+}
+
+// Globals any function names stay in memory everywhere
+static void markMemory(const Stmt &s, int symbol);
+
+static void markName(uint32_t name, int symbol) {
+  int found = symbolTable.lookup(name, symbol);
+  if (found >= 0 && symbolTable.symbols()[found].kind == GLOBAL_SYMBOL)
+    inMemory[slotOf[found]] = true;
+}
+
+static void markMemory(const Expr &e, int symbol) {
+  if (e.kind == IDENTIFIER_EXPR)
+    markName(e.name, symbol);
+  for (const ExprPtr &arg : e.args)
+    markMemory(*arg, symbol);
+  if (e.left)
+    markMemory(*e.left, symbol);
+  if (e.right)
+    markMemory(*e.right, symbol);
+}
+
+static void markMemory(const Stmt &s, int symbol) {
+  if (s.kind == ASSIGN_STMT)
+    markName(s.name, symbol);
+  if (s.value)
+    markMemory(*s.value, symbol);
+  if (s.condition.left) {
+    markMemory(*s.condition.left, symbol);
+    markMemory(*s.condition.right, symbol);
+  }
+  for (const ExprPtr &target : s.targets)
+    markMemory(*target, symbol);
+  for (const StmtPtr &statement : s.body)
+    markMemory(*statement, symbol);
+  if (s.branch)
+    markMemory(*s.branch, symbol);
+  if (s.elseBranch)
+    markMemory(*s.elseBranch, symbol);
+}
+
+IrModule lowerProgram(const Program &program) {
+  IrModule result;
+  module = &result;
+  inMemory.clear();
+
+  const std::vector<Symbol> &symbols = symbolTable.symbols();
+  slotOf.assign(symbols.size(), -1);
+  functionIndex.assign(symbols.size(), -1);
+  for (size_t i = 0; i < symbols.size(); i++) {
+    if (symbols[i].kind == GLOBAL_SYMBOL) {
+      slotOf[i] = result.globalNames.size();
+      result.globalNames.push_back(symbols[i].name);
+      result.globalTypes.push_back(valueType(symbols[i].type));
+      inMemory.push_back(false);
+    } else if (symbols[i].kind == FUNCTION_SYMBOL) {
+      for (size_t j = 0; j < symbols[i].members.size(); j++)
+        slotOf[symbols[i].members[j]] = j;
+    }
+  }
+  for (size_t i = 0; i < program.functions.size(); i++) {
+    functionIndex[program.functions[i].symbol] = i;
+    for (const StmtPtr &s : program.functions[i].body)
+      markMemory(*s, program.functions[i].symbol);
+  }
+
+  result.functions.resize(program.functions.size());
+  for (size_t i = 0; i < program.functions.size(); i++) {
+    const FunctionDef &def = program.functions[i];
+    const Symbol &symbol = symbols[def.symbol];
+    IrFunction &f = result.functions[i];
+    f.name = def.name;
+    f.parameters = symbol.parameters;
+    returnType = def.type;
+    startFunction(f, def.symbol);
+
+    // Members are variables 0.. in declaration order, parameters first
+    for (int member : symbol.members)
+      variableFor(symbols[member].name, valueType(symbols[member].type));
+    for (int p = 0; p < symbol.parameters; p++) {
+      int value = append(IR_PARAM, def.offset);
+      f.values[value].index = p;
+      f.values[value].name = variableNames[p];
+      definitions[current][p] = value;
+    }
+    for (const StmtPtr &s : def.body)
+      lowerStmt(*s);
+    if (current >= 0) {
+      int value = append(IR_CONST, def.end);
+      fn->values[value].constant.type = returnType;
+      append(IR_RETURN, def.end, {value});
+    }
+    finish();
+  }
+
+  startFunction(result.main, -1);
+  for (const StmtPtr &s : program.statements)
+    lowerStmt(*s);
+  if (current >= 0)
+    append(IR_HALT, 0);
+  finish();
+  return result;
+}
+
+static const char *const opNames[IR_OP_COUNT] = {
+    "const", "param",  "phi",  "neg",  "toreal", "add",   "sub",  "mul",
+    "div",   "eq",     "ne",   "gt",   "lt",     "le",    "ge",   "load",
+    "store", "call",   "print", "scan", "jump",  "br",    "ret",  "halt"};
+
+static std::string valueText(const Value &v) {
+  if (v.type == BOOL_VALUE)
+    return v.integer ? "true" : "false";
+  if (v.type == INT_VALUE)
+    return std::to_string(v.integer);
+  char text[32];
+  return std::string(text, std::to_chars(text, text + sizeof text, v.real).ptr);
+}
+
+static void dumpFunction(const IrModule &m, const IrFunction &f,
+                         std::ostream &out) {
+  if (f.name == 0) {
+    out << "main:\n";
+  } else {
+    out << "function " << identifiers.name(f.name) << ":\n";
+  }
+  for (size_t b = 0; b < f.blocks.size(); b++) {
+    const IrBlock &block = f.blocks[b];
+    out << "b" << b << ":";
+    if (!block.preds.empty()) {
+      out << "  ; preds";
+      for (int pred : block.preds)
+        out << " b" << pred;
+    }
+    out << '\n';
+
+    for (int value : block.instrs) {
+      const IrInstr &instr = f.values[value];
+      out << "  ";
+      if (!isTerminator(instr.op) && instr.op != IR_STORE &&
+          instr.op != IR_PRINT)
+        out << '%' << value << " = ";
+      out << opNames[instr.op];
+
+      switch (instr.op) {
+      case IR_CONST:
+        out << ' ' << valueText(instr.constant);
+        break;
+      case IR_PARAM:
+        out << ' ' << instr.index << " ; " << identifiers.name(instr.name);
+        break;
+      case IR_PHI:
+        for (size_t i = 0; i < instr.args.size(); i++)
+          out << (i ? ", [%" : " [%") << instr.args[i] << ", b"
+              << block.preds[i] << ']';
+        out << " ; " << identifiers.name(instr.name);
+        break;
+      case IR_LOAD:
+        out << ' ' << identifiers.name(m.globalNames[instr.index]);
+        break;
+      case IR_STORE:
+        out << ' ' << identifiers.name(m.globalNames[instr.index]) << ", %"
+            << instr.args[0];
+        break;
+      case IR_CALL:
+        out << ' ' << identifiers.name(m.functions[instr.index].name);
+        for (size_t i = 0; i < instr.args.size(); i++)
+          out << (i ? ", %" : " %") << instr.args[i];
+        break;
+      case IR_SCAN:
+        out << ' ' << typeName(instr.type) << " ; "
+            << identifiers.name(instr.name);
+        break;
+      case IR_JUMP:
+        out << " b" << instr.targets[0];
+        break;
+      case IR_BRANCH:
+        out << " %" << instr.args[0] << ", b" << instr.targets[0] << ", b"
+            << instr.targets[1];
+        break;
+      default:
+        for (size_t i = 0; i < instr.args.size(); i++)
+          out << (i ? ", %" : " %") << instr.args[i];
+        break;
+      }
+      out << '\n';
+    }
+  }
+}
+
+void dumpModule(const IrModule &module, std::ostream &out) {
+  for (const IrFunction &f : module.functions) {
+    dumpFunction(module, f, out);
+    out << '\n';
+  }
+  dumpFunction(module, module.main, out);
+}
+
+static const size_t maxCalls = 1 << 16; // as in the VM
+
+static bool numeric(const Value &v) { return v.type != BOOL_VALUE; }
+
+static double toReal(const Value &v) {
+  return v.type == REAL_VALUE ? v.real : double(v.integer);
+}
+
+static Value arithmetic(IrOp op, const Value &a, const Value &b,
+                        size_t offset) {
+  static const char *const verbs[] = {"add", "subtract", "multiply", "divide"};
+  Value result;
+  if (!numeric(a) || !numeric(b))
+    throw RuntimeError(std::string("cannot ") + verbs[op - IR_ADD] +
+                           " a boolean",
+                       offset);
+  if (a.type == INT_VALUE && b.type == INT_VALUE) {
+    uint64_t x = a.integer, y = b.integer;
+    switch (op) {
+    case IR_ADD:
+      result.integer = int64_t(x + y);
+      break;
+    case IR_SUBTRACT:
+      result.integer = int64_t(x - y);
+      break;
+    case IR_MULTIPLY:
+      result.integer = int64_t(x * y);
+      break;
+    default:
+      if (b.integer == 0)
+        throw RuntimeError("division by zero", offset);
+      result.integer =
+          b.integer == -1 ? int64_t(0 - x) : a.integer / b.integer;
+      break;
+    }
+    return result;
+  }
+  double x = toReal(a), y = toReal(b);
+  result.type = REAL_VALUE;
+  result.real = op == IR_ADD        ? x + y
+                : op == IR_SUBTRACT ? x - y
+                : op == IR_MULTIPLY ? x * y
+                                    : x / y;
+  return result;
+}
+
+static Value compare(IrOp op, const Value &a, const Value &b, size_t offset) {
+  int order; // <0, 0, >0
+  if (a.type == b.type && a.type != REAL_VALUE) {
+    order = (a.integer > b.integer) - (a.integer < b.integer);
+  } else if (numeric(a) && numeric(b)) {
+    double x = toReal(a), y = toReal(b);
+    if (x != x || y != y) {
+      order = 2; // unordered: only != holds
+    } else {
+      order = (x > y) - (x < y);
+    }
+  } else {
+    throw RuntimeError("cannot compare a boolean with a number", offset);
+  }
+  bool result;
+  switch (op) {
+  case IR_EQUAL:
+    result = order == 0;
+    break;
+  case IR_NOT_EQUAL:
+    result = order != 0;
+    break;
+  case IR_GREATER:
+    result = order == 1;
+    break;
+  case IR_LESS:
+    result = order == -1;
+    break;
+  case IR_LESS_EQUAL:
+    result = order == -1 || order == 0;
+    break;
+  default:
+    result = order == 1 || order == 0;
+    break;
+  }
+  Value v;
+  v.type = BOOL_VALUE;
+  v.integer = result;
+  return v;
+}
+
+struct IrFrame {
+  const IrFunction *f;
+  std::vector<Value> values;
+  std::vector<Value> args;
+  int block = 0;
+  size_t pos = 0;
+};
+
+// Move to `target`, giving its phis their values for the edge from `from`
+static void enter(IrFrame &frame, int from, int target) {
+  const IrFunction &f = *frame.f;
+  const IrBlock &block = f.blocks[target];
+  size_t edge = 0;
+  while (block.preds[edge] != from)
+    edge++;
+  std::vector<Value> incoming;
+  for (int value : block.instrs) {
+    if (f.values[value].op != IR_PHI)
+      break;
+    incoming.push_back(frame.values[f.values[value].args[edge]]);
+  }
+  for (size_t i = 0; i < incoming.size(); i++)
+    frame.values[block.instrs[i]] = incoming[i];
+  frame.block = target;
+  frame.pos = incoming.size();
+}
+
+void runModule(const IrModule &module, std::istream &in, std::ostream &out,
+               uint64_t &executed) {
+  std::vector<Value> globals(module.globalTypes.size());
+  for (size_t i = 0; i < globals.size(); i++)
+    globals[i].type = module.globalTypes[i];
+
+  std::vector<IrFrame> frames(1);
+  frames[0].f = &module.main;
+  frames[0].values.resize(module.main.values.size());
+
+  while (true) {
+    IrFrame &frame = frames.back();
+    const IrFunction &f = *frame.f;
+    int id = f.blocks[frame.block].instrs[frame.pos++];
+    const IrInstr &instr = f.values[id];
+    std::vector<Value> &v = frame.values;
+    executed++;
+
+    switch (instr.op) {
+    case IR_CONST:
+      v[id] = instr.constant;
+      break;
+    case IR_PARAM:
+      v[id] = frame.args[instr.index];
+      break;
+    case IR_PHI:
+      executed--;
+      break;
+    case IR_NEGATE: {
+      Value a = v[instr.args[0]];
+      if (a.type == INT_VALUE) {
+        a.integer = int64_t(0 - uint64_t(a.integer));
+      } else if (a.type == REAL_VALUE) {
+        a.real = -a.real;
+      } else {
+        throw RuntimeError("cannot negate a boolean", instr.offset);
+      }
+      v[id] = a;
+      break;
+    }
+    case IR_TO_REAL: {
+      const Value &a = v[instr.args[0]];
+      v[id].type = REAL_VALUE;
+      v[id].real = double(a.integer);
+      break;
+    }
+    case IR_ADD:
+    case IR_SUBTRACT:
+    case IR_MULTIPLY:
+    case IR_DIVIDE:
+      v[id] = arithmetic(instr.op, v[instr.args[0]], v[instr.args[1]],
+                         instr.offset);
+      break;
+    case IR_LOAD:
+      v[id] = globals[instr.index];
+      break;
+    case IR_STORE:
+      globals[instr.index] = v[instr.args[0]];
+      break;
+    case IR_CALL: {
+      if (frames.size() - 1 >= maxCalls)
+        throw RuntimeError("call stack overflow", instr.offset);
+      IrFrame callee;
+      callee.f = &module.functions[instr.index];
+      callee.values.resize(callee.f->values.size());
+      for (int arg : instr.args)
+        callee.args.push_back(v[arg]);
+      frames.push_back(std::move(callee));
+      continue;
+    }
+    case IR_PRINT: {
+      const Value &value = v[instr.args[0]];
+      if (value.type == BOOL_VALUE) {
+        out << (value.integer ? "true\n" : "false\n");
+      } else {
+        out << valueText(value) << '\n';
+      }
+      break;
+    }
+    case IR_SCAN: {
+      Value &value = v[id];
+      value.type = instr.type;
+      bool ok;
+      if (instr.type == INT_VALUE) {
+        ok = bool(in >> value.integer);
+      } else if (instr.type == REAL_VALUE) {
+        ok = bool(in >> value.real);
+      } else {
+        std::string word;
+        ok = bool(in >> word) && (word == "true" || word == "1" ||
+                                  word == "false" || word == "0");
+        value.integer = word == "true" || word == "1";
+      }
+      if (!ok)
+        throw RuntimeError(std::string("scan expected a value of type ") +
+                               typeName(instr.type),
+                           instr.offset);
+      break;
+    }
+    case IR_JUMP:
+      enter(frame, frame.block, instr.targets[0]);
+      break;
+    case IR_BRANCH:
+      enter(frame, frame.block,
+            instr.targets[v[instr.args[0]].integer ? 0 : 1]);
+      break;
+    case IR_RETURN: {
+      Value result = v[instr.args[0]];
+      frames.pop_back();
+      IrFrame &caller = frames.back();
+      int call = caller.f->blocks[caller.block].instrs[caller.pos - 1];
+      caller.values[call] = result;
+      break;
+    }
+    case IR_HALT:
+      out.flush();
+      return;
+    default:
+      v[id] = compare(instr.op, v[instr.args[0]], v[instr.args[1]],
+                      instr.offset);
+      break;
+    }
+  }
+}
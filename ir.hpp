@@ -0,0 +1,93 @@
+#ifndef IR_HPP
+#define IR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "ast.hpp"
+#include "bytecode.hpp"
+
+// Three-address SSA form. Every instruction is a value numbered by its
+// index in IrFunction::values; arguments name other values. Parameters,
+// locals and globals no function touches are SSA values with phis at
+// joins. Globals that functions use stay in memory behind IR_LOAD and
+// IR_STORE, and every call may change them.
+enum IrOp {
+  IR_CONST,
+  IR_PARAM, // index = parameter number
+  IR_PHI,   // one argument per predecessor, in IrBlock::preds order
+  IR_NEGATE,
+  IR_TO_REAL, // integer to real
+  IR_ADD,
+  IR_SUBTRACT,
+  IR_MULTIPLY,
+  IR_DIVIDE,
+  IR_EQUAL,
+  IR_NOT_EQUAL,
+  IR_GREATER,
+  IR_LESS,
+  IR_LESS_EQUAL,
+  IR_GREATER_EQUAL,
+  IR_LOAD,  // index = global slot
+  IR_STORE, // index = global slot; stores args[0]
+  IR_CALL,  // index = function
+  IR_PRINT,
+  IR_SCAN, // type = what to read
+  IR_JUMP,
+  IR_BRANCH, // on args[0]: targets[0] if true, else targets[1]
+  IR_RETURN,
+  IR_HALT,
+  IR_OP_COUNT
+};
+
+struct IrInstr {
+  IrOp op;
+  size_t offset; // source, for run-time errors
+  std::vector<int> args;
+  Value constant;           // IR_CONST
+  int index = 0;            // IR_PARAM, IR_LOAD, IR_STORE, IR_CALL
+  ValueType type = INT_VALUE; // IR_SCAN
+  uint32_t name = 0;        // variable an IR_PHI, IR_PARAM or IR_SCAN is for
+  int targets[2] = {-1, -1};
+  int block = -1;    // -1 once removed
+  uint8_t types = 0; // bit per ValueType it may have, from inferTypes()
+};
+
+// Phis come first and the terminator last
+struct IrBlock {
+  std::vector<int> instrs;
+  std::vector<int> preds;
+};
+
+struct IrFunction {
+  uint32_t name = 0; // 0 for the main program
+  int parameters = 0;
+  std::vector<IrInstr> values;
+  std::vector<IrBlock> blocks; // block 0 is the entry
+};
+
+struct IrModule {
+  std::vector<IrFunction> functions;
+  IrFunction main;
+  std::vector<uint32_t> globalNames;
+  std::vector<ValueType> globalTypes;
+};
+
+bool isTerminator(IrOp op);
+std::vector<int> successors(const IrFunction &f, int block);
+
+// Names resolve through symbolTable as in compileProgram(), and the
+// program must have passed checkTypes(); throws CompileError for bad calls
+IrModule lowerProgram(const Program &program);
+
+void dumpModule(const IrModule &module, std::ostream &out);
+
+// Run the IR directly with the VM's semantics; counts executed
+// instructions (phis excluded) in `executed`. Throws RuntimeError.
+void runModule(const IrModule &module, std::istream &in, std::ostream &out,
+               uint64_t &executed);
+
+#endif
@@ -0,0 +1,722 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include "ir_passes.hpp"
+
+static const uint8_t INT_BIT = 1 << INT_VALUE;
+static const uint8_t REAL_BIT = 1 << REAL_VALUE;
+static const uint8_t BOOL_BIT = 1 << BOOL_VALUE;
+static const uint8_t NUMBER_BITS = INT_BIT | REAL_BIT;
+
+static uint8_t arithmeticTypes(uint8_t a, uint8_t b) {
+  uint8_t result = 0;
+  if ((a & INT_BIT) && (b & INT_BIT))
+    result |= INT_BIT;
+  if (((a & REAL_BIT) && (b & NUMBER_BITS)) ||
+      ((b & REAL_BIT) && (a & NUMBER_BITS)))
+    result |= REAL_BIT;
+  return result;
+}
+
+// Iterate to a fixed point: globals start as their declared type and gain
+// whatever is stored in them, parameters whatever is passed, calls whatever
+// the callee returns
+void inferTypes(IrModule &module) {
+  std::vector<uint8_t> globals(module.globalTypes.size());
+  for (size_t i = 0; i < globals.size(); i++)
+    globals[i] = 1 << module.globalTypes[i];
+  std::vector<std::vector<uint8_t>> parameters(module.functions.size());
+  std::vector<uint8_t> returns(module.functions.size());
+  for (size_t i = 0; i < module.functions.size(); i++)
+    parameters[i].assign(module.functions[i].parameters, 0);
+
+  std::vector<IrFunction *> functions;
+  for (IrFunction &f : module.functions)
+    functions.push_back(&f);
+  functions.push_back(&module.main);
+  for (IrFunction *f : functions) {
+    for (IrInstr &instr : f->values)
+      instr.types = 0;
+  }
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t fi = 0; fi < functions.size(); fi++) {
+      IrFunction &f = *functions[fi];
+      for (IrInstr &instr : f.values) {
+        if (instr.block < 0)
+          continue;
+        auto arg = [&](int i) { return f.values[instr.args[i]].types; };
+        auto widen = [&](uint8_t &mask, uint8_t more) {
+          if ((mask | more) != mask) {
+            mask |= more;
+            changed = true;
+          }
+        };
+
+        uint8_t types = instr.types;
+        switch (instr.op) {
+        case IR_CONST:
+          types = 1 << instr.constant.type;
+          break;
+        case IR_SCAN:
+          types = 1 << instr.type;
+          break;
+        case IR_PARAM:
+          types = parameters[fi][instr.index];
+          break;
+        case IR_PHI:
+          for (size_t i = 0; i < instr.args.size(); i++)
+            types |= arg(i);
+          break;
+        case IR_LOAD:
+          types = globals[instr.index];
+          break;
+        case IR_STORE:
+          widen(globals[instr.index], arg(0));
+          break;
+        case IR_CALL:
+          for (size_t i = 0; i < instr.args.size(); i++)
+            widen(parameters[instr.index][i], arg(i));
+          types = returns[instr.index];
+          break;
+        case IR_RETURN:
+          widen(returns[fi], arg(0));
+          break;
+        case IR_NEGATE:
+          types = arg(0) & NUMBER_BITS;
+          break;
+        case IR_TO_REAL:
+          types = REAL_BIT;
+          break;
+        case IR_ADD:
+        case IR_SUBTRACT:
+        case IR_MULTIPLY:
+        case IR_DIVIDE:
+          types = arithmeticTypes(arg(0), arg(1));
+          break;
+        case IR_EQUAL:
+        case IR_NOT_EQUAL:
+        case IR_GREATER:
+        case IR_LESS:
+        case IR_LESS_EQUAL:
+        case IR_GREATER_EQUAL:
+          types = BOOL_BIT;
+          break;
+        default:
+          break;
+        }
+        widen(instr.types, types);
+      }
+    }
+  }
+}
+
+bool mayFail(const IrFunction &f, const IrInstr &instr) {
+  auto arg = [&](int i) { return f.values[instr.args[i]].types; };
+  switch (instr.op) {
+  case IR_NEGATE:
+    return arg(0) & BOOL_BIT;
+  case IR_ADD:
+  case IR_SUBTRACT:
+  case IR_MULTIPLY:
+    return (arg(0) | arg(1)) & BOOL_BIT;
+  case IR_DIVIDE: {
+    if ((arg(0) | arg(1)) & BOOL_BIT)
+      return true;
+    const IrInstr &divisor = f.values[instr.args[1]];
+    bool nonZero = divisor.op == IR_CONST && divisor.constant.integer != 0;
+    return (arg(0) & INT_BIT) && (arg(1) & INT_BIT) && !nonZero;
+  }
+  case IR_EQUAL:
+  case IR_NOT_EQUAL:
+  case IR_GREATER:
+  case IR_LESS:
+  case IR_LESS_EQUAL:
+  case IR_GREATER_EQUAL:
+    return ((arg(0) & BOOL_BIT) && (arg(1) & NUMBER_BITS)) ||
+           ((arg(0) & NUMBER_BITS) && (arg(1) & BOOL_BIT));
+  case IR_CALL:
+  case IR_SCAN:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool hasSideEffect(const IrFunction &f, const IrInstr &instr) {
+  switch (instr.op) {
+  case IR_STORE:
+  case IR_CALL:
+  case IR_PRINT:
+  case IR_SCAN:
+    return true;
+  default:
+    return isTerminator(instr.op) || mayFail(f, instr);
+  }
+}
+
+static void removeFromBlock(IrFunction &f, int value) {
+  std::vector<int> &instrs = f.blocks[f.values[value].block].instrs;
+  instrs.erase(std::find(instrs.begin(), instrs.end(), value));
+  f.values[value].block = -1;
+}
+
+// Reachable blocks in reverse postorder
+static std::vector<int> reversePostorder(const IrFunction &f) {
+  std::vector<int> order;
+  std::vector<bool> seen(f.blocks.size());
+  std::vector<std::pair<int, size_t>> stack = {{0, 0}};
+  seen[0] = true;
+  while (!stack.empty()) {
+    auto &[block, next] = stack.back();
+    std::vector<int> succs = successors(f, block);
+    if (next < succs.size()) {
+      int succ = succs[next++];
+      if (!seen[succ]) {
+        seen[succ] = true;
+        stack.push_back({succ, 0});
+      }
+    } else {
+      order.push_back(block);
+      stack.pop_back();
+    }
+  }
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+// Immediate dominators (Cooper, Harvey and Kennedy); -1 if unreachable
+static std::vector<int> dominators(const IrFunction &f,
+                                   const std::vector<int> &order) {
+  std::vector<int> index(f.blocks.size(), -1);
+  for (size_t i = 0; i < order.size(); i++)
+    index[order[i]] = i;
+  std::vector<int> idom(f.blocks.size(), -1);
+  idom[0] = 0;
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = 1; i < order.size(); i++) {
+      int block = order[i];
+      int dom = -1;
+      for (int pred : f.blocks[block].preds) {
+        if (idom[pred] < 0)
+          continue;
+        if (dom < 0) {
+          dom = pred;
+          continue;
+        }
+        int a = pred, b = dom;
+        while (a != b) {
+          while (index[a] > index[b])
+            a = idom[a];
+          while (index[b] > index[a])
+            b = idom[b];
+        }
+        dom = a;
+      }
+      if (idom[block] != dom) {
+        idom[block] = dom;
+        changed = true;
+      }
+    }
+  }
+  return idom;
+}
+
+static bool dominates(const std::vector<int> &idom, int a, int b) {
+  while (b != a && b != 0)
+    b = idom[b];
+  return b == a;
+}
+
+// Mark from the instructions that must run; drop everything unmarked
+size_t eliminateDeadCode(IrFunction &f) {
+  std::vector<bool> live(f.values.size());
+  std::vector<int> work;
+  for (const IrBlock &block : f.blocks) {
+    for (int value : block.instrs) {
+      if (hasSideEffect(f, f.values[value])) {
+        live[value] = true;
+        work.push_back(value);
+      }
+    }
+  }
+  while (!work.empty()) {
+    int value = work.back();
+    work.pop_back();
+    for (int arg : f.values[value].args) {
+      if (!live[arg]) {
+        live[arg] = true;
+        work.push_back(arg);
+      }
+    }
+  }
+
+  size_t removed = 0;
+  for (IrBlock &block : f.blocks) {
+    std::vector<int> kept;
+    for (int value : block.instrs) {
+      if (live[value]) {
+        kept.push_back(value);
+      } else {
+        f.values[value].block = -1;
+        removed++;
+      }
+    }
+    block.instrs = std::move(kept);
+  }
+  return removed;
+}
+
+static bool commutative(IrOp op) {
+  return op == IR_ADD || op == IR_MULTIPLY || op == IR_EQUAL ||
+         op == IR_NOT_EQUAL;
+}
+
+// Value numbering over the dominator tree: an instruction equal to one in
+// a dominating block is replaced by it. Loads are keyed by the version of
+// the global they read: the last store to it or call before them, or the
+// block itself when it has several predecessors. A store makes its value
+// available to later loads of the same global.
+struct MemoryState {
+  int64_t base = 0; // last call, or the block that merged paths
+  std::map<int, int64_t> stores; // last store to each global since base
+
+  int64_t version(int global) const {
+    auto found = stores.find(global);
+    return found != stores.end() ? found->second : base;
+  }
+};
+
+size_t eliminateCommonSubexpressions(IrFunction &f) {
+  std::vector<int> order = reversePostorder(f);
+  std::vector<int> idom = dominators(f, order);
+  std::vector<std::vector<int>> children(f.blocks.size());
+  for (int block : order) {
+    if (block != 0)
+      children[idom[block]].push_back(block);
+  }
+
+  std::vector<int> forward(f.values.size(), -1);
+  auto find = [&](int value) {
+    while (forward[value] >= 0)
+      value = forward[value];
+    return value;
+  };
+
+  typedef std::vector<int64_t> Key;
+  std::map<Key, int> available;
+  std::vector<std::vector<Key>> added(f.blocks.size());
+  std::vector<MemoryState> memoryAtExit(f.blocks.size());
+  size_t removed = 0;
+
+  std::vector<std::pair<int, bool>> stack = {{0, false}};
+  while (!stack.empty()) {
+    auto [block, done] = stack.back();
+    stack.pop_back();
+    if (done) {
+      for (const Key &key : added[block])
+        available.erase(key);
+      continue;
+    }
+    stack.push_back({block, true});
+    for (int child : children[block])
+      stack.push_back({child, false});
+
+    const std::vector<int> &preds = f.blocks[block].preds;
+    MemoryState memory;
+    if (preds.size() == 1) {
+      memory = memoryAtExit[preds[0]];
+    } else {
+      memory.base = -1 - int64_t(block);
+    }
+    std::vector<int> instrs = f.blocks[block].instrs;
+    for (int value : instrs) {
+      IrInstr &instr = f.values[value];
+      for (int &arg : instr.args)
+        arg = find(arg);
+
+      Key key = {instr.op};
+      switch (instr.op) {
+      case IR_STORE:
+        memory.stores[instr.index] = value;
+        // A later load of this global sees the stored value
+        key = {IR_LOAD, instr.index, value};
+        if (available.emplace(key, instr.args[0]).second)
+          added[block].push_back(key);
+        continue;
+      case IR_CALL:
+        memory.base = value;
+        memory.stores.clear();
+        continue;
+      case IR_PHI:
+      case IR_PARAM:
+      case IR_SCAN:
+      case IR_PRINT:
+        continue;
+      case IR_CONST: {
+        int64_t bits;
+        std::memcpy(&bits, &instr.constant.integer, sizeof bits);
+        key.push_back(instr.constant.type);
+        key.push_back(bits);
+        break;
+      }
+      case IR_LOAD:
+        key.push_back(instr.index);
+        key.push_back(memory.version(instr.index));
+        break;
+      default:
+        if (isTerminator(instr.op))
+          continue;
+        if (commutative(instr.op) && instr.args[0] > instr.args[1]) {
+          key.push_back(instr.args[1]);
+          key.push_back(instr.args[0]);
+        } else {
+          key.insert(key.end(), instr.args.begin(), instr.args.end());
+        }
+        break;
+      }
+
+      auto [it, fresh] = available.emplace(key, value);
+      if (fresh) {
+        added[block].push_back(key);
+      } else {
+        forward[value] = it->second;
+        removeFromBlock(f, value);
+        removed++;
+      }
+    }
+    memoryAtExit[block] = std::move(memory);
+  }
+
+  // Phi operands can come from blocks visited later
+  for (IrInstr &instr : f.values) {
+    for (int &arg : instr.args)
+      arg = find(arg);
+  }
+  return removed;
+}
+
+// Move instructions whose operands are all defined outside a loop into
+// the block before its header. Only instructions that cannot fail move,
+// so running them when the loop does not is harmless; loads move only out
+// of loops with no store to that global and no call.
+size_t hoistLoopInvariants(IrFunction &f) {
+  std::vector<int> order = reversePostorder(f);
+  std::vector<int> idom = dominators(f, order);
+
+  // Natural loops, merged by header
+  std::map<int, std::vector<bool>> loops;
+  for (int block : order) {
+    for (int header : successors(f, block)) {
+      if (idom[header] < 0 || !dominates(idom, header, block))
+        continue;
+      std::vector<bool> &body = loops[header];
+      body.resize(f.blocks.size());
+      body[header] = true;
+      std::vector<int> work;
+      if (!body[block]) {
+        body[block] = true;
+        work.push_back(block);
+      }
+      while (!work.empty()) {
+        int b = work.back();
+        work.pop_back();
+        for (int pred : f.blocks[b].preds) {
+          if (!body[pred] && idom[pred] >= 0) {
+            body[pred] = true;
+            work.push_back(pred);
+          }
+        }
+      }
+    }
+  }
+
+  // Inner loops first, so what they hoist can move again
+  std::vector<std::pair<size_t, int>> bySize;
+  for (const auto &[header, body] : loops)
+    bySize.push_back({std::count(body.begin(), body.end(), true), header});
+  std::sort(bySize.begin(), bySize.end());
+
+  size_t moved = 0;
+  for (auto [size, header] : bySize) {
+    const std::vector<bool> &body = loops[header];
+    int preheader = -1;
+    for (int pred : f.blocks[header].preds) {
+      if (body[pred])
+        continue;
+      if (preheader >= 0 || successors(f, pred).size() != 1) {
+        preheader = -1;
+        break;
+      }
+      preheader = pred;
+    }
+    if (preheader < 0)
+      continue;
+
+    bool calls = false;
+    std::vector<bool> stored;
+    for (int block : order) {
+      if (!body[block])
+        continue;
+      for (int value : f.blocks[block].instrs) {
+        const IrInstr &instr = f.values[value];
+        if (instr.op == IR_CALL)
+          calls = true;
+        if (instr.op == IR_STORE) {
+          if ((int)stored.size() <= instr.index)
+            stored.resize(instr.index + 1);
+          stored[instr.index] = true;
+        }
+      }
+    }
+
+    for (int block : order) {
+      if (!body[block])
+        continue;
+      std::vector<int> instrs = f.blocks[block].instrs;
+      for (int value : instrs) {
+        IrInstr &instr = f.values[value];
+        if (instr.op == IR_PHI || instr.op == IR_PARAM ||
+            hasSideEffect(f, instr))
+          continue;
+        if (instr.op == IR_LOAD &&
+            (calls ||
+             ((int)stored.size() > instr.index && stored[instr.index])))
+          continue;
+        bool invariant = true;
+        for (int arg : instr.args) {
+          if (body[f.values[arg].block])
+            invariant = false;
+        }
+        if (!invariant)
+          continue;
+
+        removeFromBlock(f, value);
+        std::vector<int> &target = f.blocks[preheader].instrs;
+        target.insert(target.end() - 1, value);
+        instr.block = preheader;
+        moved++;
+      }
+    }
+  }
+  return moved;
+}
+
+size_t inlineBudget = 200;
+size_t inlineMaxSize = 40;
+std::vector<InlinedCall> inlinedCalls;
+
+// Functions that can reach a call to themselves
+static std::vector<bool> recursiveFunctions(const IrModule &module) {
+  size_t count = module.functions.size();
+  std::vector<std::vector<int>> calls(count);
+  for (size_t i = 0; i < count; i++) {
+    for (const IrInstr &instr : module.functions[i].values) {
+      if (instr.block >= 0 && instr.op == IR_CALL)
+        calls[i].push_back(instr.index);
+    }
+  }
+
+  std::vector<bool> recursive(count);
+  for (size_t i = 0; i < count; i++) {
+    std::vector<bool> seen(count);
+    std::vector<int> work = calls[i];
+    while (!work.empty() && !recursive[i]) {
+      int callee = work.back();
+      work.pop_back();
+      if (callee == (int)i)
+        recursive[i] = true;
+      if (seen[callee])
+        continue;
+      seen[callee] = true;
+      work.insert(work.end(), calls[callee].begin(), calls[callee].end());
+    }
+  }
+  return recursive;
+}
+
+// Instructions a copy of the function adds; parameters are not copied
+static size_t inlineSize(const IrFunction &f, bool &returns) {
+  size_t size = 0;
+  returns = false;
+  for (const IrBlock &block : f.blocks) {
+    for (int value : block.instrs) {
+      if (f.values[value].op == IR_RETURN)
+        returns = true;
+      if (f.values[value].op != IR_PARAM)
+        size++;
+    }
+  }
+  return size;
+}
+
+// Split the caller's block after the call, copy the callee's blocks in
+// between and turn its returns into jumps to the second half, which gets
+// a phi of the returned values when there are several
+size_t inlineCalls(IrModule &module, IrFunction &f) {
+  std::vector<bool> recursive = recursiveFunctions(module);
+  std::vector<int> work;
+  for (const IrBlock &block : f.blocks) {
+    for (int value : block.instrs) {
+      if (f.values[value].op == IR_CALL)
+        work.push_back(value);
+    }
+  }
+
+  size_t added = 0, inlined = 0;
+  for (size_t w = 0; w < work.size(); w++) {
+    int call = work[w];
+    int index = f.values[call].index;
+    const IrFunction &callee = module.functions[index];
+    bool returns;
+    size_t size = inlineSize(callee, returns);
+    if (&callee == &f || recursive[index] || !returns ||
+        size > inlineMaxSize || added + size > inlineBudget)
+      continue;
+    std::vector<int> args = f.values[call].args;
+    size_t offset = f.values[call].offset;
+
+    // The rest of the block moves to `after`
+    int block = f.values[call].block;
+    int after = f.blocks.size();
+    f.blocks.emplace_back();
+    std::vector<int> &instrs = f.blocks[block].instrs;
+    auto at = std::find(instrs.begin(), instrs.end(), call);
+    f.blocks[after].instrs.assign(at + 1, instrs.end());
+    instrs.erase(at, instrs.end());
+    f.values[call].block = -1;
+    for (int value : f.blocks[after].instrs)
+      f.values[value].block = after;
+    for (int succ : successors(f, after)) {
+      std::vector<int> &preds = f.blocks[succ].preds;
+      std::replace(preds.begin(), preds.end(), block, after);
+    }
+
+    // Number the copies first, since arguments may refer forward
+    std::vector<int> blockMap(callee.blocks.size(), -1);
+    std::vector<int> valueMap(callee.values.size(), -1);
+    for (size_t b = 0; b < callee.blocks.size(); b++) {
+      if (callee.blocks[b].instrs.empty())
+        continue;
+      blockMap[b] = f.blocks.size();
+      f.blocks.emplace_back();
+      for (int value : callee.blocks[b].instrs) {
+        const IrInstr &instr = callee.values[value];
+        if (instr.op == IR_PARAM) {
+          valueMap[value] = args[instr.index];
+        } else {
+          valueMap[value] = f.values.size();
+          f.values.push_back(instr);
+        }
+      }
+    }
+
+    std::vector<int> results;
+    for (size_t b = 0; b < callee.blocks.size(); b++) {
+      if (blockMap[b] < 0)
+        continue;
+      IrBlock &copy = f.blocks[blockMap[b]];
+      for (int pred : callee.blocks[b].preds)
+        copy.preds.push_back(blockMap[pred]);
+      for (int value : callee.blocks[b].instrs) {
+        if (callee.values[value].op == IR_PARAM)
+          continue;
+        int id = valueMap[value];
+        IrInstr &instr = f.values[id];
+        instr.block = blockMap[b];
+        for (int &arg : instr.args)
+          arg = valueMap[arg];
+        for (int &target : instr.targets) {
+          if (target >= 0)
+            target = blockMap[target];
+        }
+        if (instr.op == IR_RETURN) {
+          results.push_back(instr.args[0]);
+          instr.op = IR_JUMP;
+          instr.args.clear();
+          instr.targets[0] = after;
+          f.blocks[after].preds.push_back(blockMap[b]);
+        }
+        if (instr.op == IR_CALL)
+          work.push_back(id);
+        copy.instrs.push_back(id);
+      }
+    }
+    f.blocks[blockMap[0]].preds.push_back(block);
+
+    IrInstr jump;
+    jump.op = IR_JUMP;
+    jump.offset = offset;
+    jump.targets[0] = blockMap[0];
+    jump.block = block;
+    f.blocks[block].instrs.push_back(f.values.size());
+    f.values.push_back(jump);
+
+    int result = results[0];
+    if (results.size() > 1) {
+      IrInstr phi;
+      phi.op = IR_PHI;
+      phi.offset = offset;
+      phi.args = results;
+      phi.block = after;
+      result = f.values.size();
+      f.values.push_back(phi);
+      std::vector<int> &merged = f.blocks[after].instrs;
+      merged.insert(merged.begin(), result);
+    }
+    for (IrInstr &instr : f.values) {
+      if (instr.block < 0)
+        continue;
+      for (int &arg : instr.args) {
+        if (arg == call)
+          arg = result;
+      }
+    }
+
+    inlinedCalls.push_back({f.name, callee.name, offset, size});
+    added += size;
+    inlined++;
+  }
+  return inlined;
+}
+
+const std::vector<IrPass> &irPasses() {
+  static const std::vector<IrPass> passes = {
+      {"inline", "copy small non-recursive functions into their callers",
+       inlineCalls},
+      {"dce", "remove instructions whose results are never used",
+       [](IrModule &, IrFunction &f) { return eliminateDeadCode(f); }},
+      {"cse", "share values computed in a dominating block",
+       [](IrModule &, IrFunction &f) {
+         return eliminateCommonSubexpressions(f);
+       }},
+      {"licm", "hoist loop-invariant instructions out of loops",
+       [](IrModule &, IrFunction &f) { return hoistLoopInvariants(f); }},
+  };
+  return passes;
+}
+
+const IrPass *findPass(const std::string &name) {
+  for (const IrPass &pass : irPasses()) {
+    if (name == pass.name)
+      return &pass;
+  }
+  return nullptr;
+}
+
+std::vector<size_t> PassManager::run(IrModule &module) const {
+  std::vector<size_t> changes;
+  for (const IrPass *pass : passes) {
+    inferTypes(module);
+    size_t changed = 0;
+    for (IrFunction &f : module.functions)
+      changed += pass->run(module, f);
+    changed += pass->run(module, module.main);
+    changes.push_back(changed);
+  }
+  return changes;
+}
@@ -0,0 +1,66 @@
+#ifndef IR_PASSES_HPP
+#define IR_PASSES_HPP
+
+#include <string>
+#include <vector>
+
+#include "ir.hpp"
+
+// Whole-program inference of the types each value may have: a bit per
+// ValueType in IrInstr::types. Values are dynamically typed at run time,
+// so this is what tells which operations can fail.
+void inferTypes(IrModule &module);
+
+// Can stop the program with a run-time error (needs inferTypes())
+bool mayFail(const IrFunction &f, const IrInstr &instr);
+// Must run even if its result is unused
+bool hasSideEffect(const IrFunction &f, const IrInstr &instr);
+
+// A pass transforms one function of a module and returns how many
+// instructions it removed, moved or inlined
+struct IrPass {
+  const char *name;
+  const char *description;
+  size_t (*run)(IrModule &module, IrFunction &f);
+};
+
+size_t eliminateDeadCode(IrFunction &f);
+size_t eliminateCommonSubexpressions(IrFunction &f);
+size_t hoistLoopInvariants(IrFunction &f);
+
+// Inlining copies the body of a small, non-recursive callee over each call
+// site: parameters become the call's arguments and every other value of
+// the callee gets a fresh number in the caller. A caller may grow by at
+// most inlineBudget instructions; callees larger than inlineMaxSize are
+// never inlined.
+struct InlinedCall {
+  uint32_t caller; // 0 for the main program
+  uint32_t callee;
+  size_t offset;   // of the call
+  size_t size;     // instructions copied
+};
+
+extern size_t inlineBudget;
+extern size_t inlineMaxSize;
+extern std::vector<InlinedCall> inlinedCalls; // appended by each run
+
+size_t inlineCalls(IrModule &module, IrFunction &f);
+
+const std::vector<IrPass> &irPasses();
+const IrPass *findPass(const std::string &name);
+
+// Runs passes in the order added over every function of a module,
+// refreshing the type facts before each one
+class PassManager {
+public:
+  void add(const IrPass *pass) { passes.push_back(pass); }
+  bool empty() const { return passes.empty(); }
+
+  // Returns the change count of each pass
+  std::vector<size_t> run(IrModule &module) const;
+
+private:
+  std::vector<const IrPass *> passes;
+};
+
+#endif
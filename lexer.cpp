@@ -1,170 +1,108 @@
+#include <charconv>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
-#include <set>
 #include <string>
 #include <vector>
 
 #include "lexer.hpp"
-enum State {
-  START,
-  IDENTIFIER,
-  INTEGER,
-  REAL,
-  SEPARATOR,
-  OPERAND,
-  COMMENT,
-  DONE
-};
+#include "string_table.hpp"
 
-std::set<std::string> keywords = {"function", "integer", "boolean", "real",
-                                  "if",       "else",    "endif",   "while",
-                                  "endwhile", "return",  "scan",    "print"};
-
-extern int line_number;
+// Convert a numeric lexeme once, when it is lexed, so the parser and later
+// stages never re-read the digits. Out-of-range values are flagged and
+// saturate.
+void convertLiteral(TokenResult &token) {
+  const char *first = token.lexeme.data();
+  const char *last = first + token.lexeme.size();
+  if (token.token == "Integer") {
+    if (std::from_chars(first, last, token.integer).ec ==
+        std::errc::result_out_of_range) {
+      token.integer = INT64_MAX;
+      token.overflow = true;
+    }
+  } else if (token.token == "Real") {
+    if (std::from_chars(first, last, token.real).ec ==
+        std::errc::result_out_of_range) {
+      token.real = HUGE_VAL;
+      token.overflow = true;
+    }
+  }
+}
 
-TokenResult lexer(std::istream &stream) {
-  State state = START;
-  std::string lexeme;
-  char c;
+// Each token is recognised by peeking at the next character before
+// consuming it, so nothing is ever pushed back into the source.
+TokenResult lexer(Source &source) {
+  int c;
 
-  while (stream.get(c)) {
-    if (c == '\n') {
-      line_number++; // Increment line number on newline
+  while ((c = source.get()) >= 0) {
+    if (isBlank(c)) {
+      continue;
     }
-    switch (state) {
-    case START:
-      if (isalpha(c)) {
-        state = IDENTIFIER;
-        lexeme += c;
-      } else if (isdigit(c)) {
-        state = INTEGER;
-        lexeme += c;
-      } else if (c == '[' && stream.peek() == '*') {
-        state = COMMENT;
-        stream.get(); // Consume '*'
-      } else if (isspace(c)) {
-        continue;
-      } else if (c == '(' || c == ')' || c == ';' || c == ',' || c == '[' ||
-                 c == ']' || c == '{' || c == '}') {
-        state = SEPARATOR;
-        lexeme += c;
-      } else if (c == '$' && stream.peek() == '$') {
-        state = SEPARATOR;
-        lexeme += c;
-        stream.get(c);
-        lexeme += c;
-        return {"Separator", lexeme};
-      } else if (c == '+' || c == '-' || c == '*' || c == '/' || c == '=' ||
-                 c == '<' || c == '>' || c == '!') {
-        state = OPERAND;
-        lexeme += c;
-      } else {
-        state = DONE;
-        return {"Invalid", std::string(1, c)};
-      }
-      break;
 
-    case IDENTIFIER:
-      while (isalnum(c) || c == '_') {
-        lexeme += c;
-        if (!stream.get(c))
-          break;
-      }
-      stream.putback(c);
-      state = DONE;
-      return {keywords.count(lexeme) ? "Keyword" : "Identifier", lexeme};
-      break;
+    size_t start = source.offset() - 1;
+    std::string lexeme(1, static_cast<char>(c));
 
-    case INTEGER:
-      while (isdigit(c)) {
-        lexeme += c;
-        if (!stream.get(c))
-          break;
+    if (isLetter(c)) {
+      while (isWordChar(source.peek())) {
+        lexeme += static_cast<char>(source.get());
       }
-      if (c == '.') {
-        lexeme += c;
-        if (!stream.get(c) || !isdigit(c)) {
-          return {"Invalid", lexeme};
-          state = DONE;
-        } else {
-          state = REAL;
-          lexeme += c;
-        }
-      } else {
-        stream.putback(c);
-        state = DONE;
-        return {"Integer", lexeme};
+      if (isKeyword(lexeme)) {
+        return {"Keyword", lexeme, start};
       }
-      break;
+      return {"Identifier", lexeme, start, identifiers.intern(lexeme)};
+    }
 
-    case REAL:
-      while (isdigit(c)) {
-        lexeme += c;
-        if (!stream.get(c))
-          break;
+    if (isDigit(c)) {
+      while (isDigit(source.peek())) {
+        lexeme += static_cast<char>(source.get());
+      }
+      if (source.peek() != '.') {
+        TokenResult token{"Integer", lexeme, start};
+        convertLiteral(token);
+        return token;
+      }
+      lexeme += static_cast<char>(source.get());
+      if (!isDigit(source.peek())) {
+        // The character after a dangling '.' is consumed with it
+        source.get();
+        return {"Invalid", lexeme, start};
       }
-      stream.putback(c);
-      state = DONE;
-      return {"Real", lexeme};
-      break;
+      while (isDigit(source.peek())) {
+        lexeme += static_cast<char>(source.get());
+      }
+      TokenResult token{"Real", lexeme, start};
+      convertLiteral(token);
+      return token;
+    }
 
-    case COMMENT:
-      while (stream.get(c)) {
-        if (c == '*' && stream.peek() == ']') {
-          stream.get(); // Consume ']'
-          state = START;
+    if (c == '[' && source.peek() == '*') {
+      source.get(); // Consume '*'
+      while ((c = source.get()) >= 0) {
+        if (c == '*' && source.peek() == ']') {
+          source.get(); // Consume ']'
           break;
         }
       }
-      break;
+      continue;
+    }
 
-    case SEPARATOR:
-      state = DONE;
-      stream.putback(c);
-      return {"Separator", lexeme};
-      break;
+    if (isSeparator(c)) {
+      return {"Separator", lexeme, start};
+    }
 
-    case OPERAND: {
-      // For '<': form "<=" if possible.
-      if (lexeme == "<") {
-        if (c == '=') {
-          lexeme += c;
-        } else {
-          stream.putback(c);
-        }
-      }
-      // For '=': form "=>" if the next character is '>', otherwise "==" if the
-      // next is '='.
-      else if (lexeme == "=") {
-        if (c == '>') {
-          lexeme += c; // Now lexeme becomes "=>"
-        } else if (c == '=') {
-          lexeme += c; // Now lexeme becomes "=="
-        } else {
-          stream.putback(c);
-        }
-      }
-      // For '!': form "!=" if supported.
-      else if (lexeme == "!") {
-        if (c == '=') {
-          lexeme += c; // Now lexeme becomes "!="
-        } else {
-          stream.putback(c);
-        }
-      }
-      state = DONE;
-      return {"Operator", lexeme};
+    if (c == '$' && source.peek() == '$') {
+      lexeme += static_cast<char>(source.get());
+      return {"Separator", lexeme, start};
     }
 
-    case DONE:
-      stream.putback(c);
-      lexeme.clear();
-      state = START;
-      break;
+    if (isOperator(c)) {
+      if (isTwoCharOperator(c, source.peek())) {
+        lexeme += static_cast<char>(source.get());
+      }
+      return {"Operator", lexeme, start};
     }
+
+    return {"Invalid", lexeme, start};
   }
-  if (stream.eof()) {
-    return {"EOF", ""};
-  } else {
-    return {"Invalid", std::string(1, c)};
-  }
-}
\ No newline at end of file
+  return {"EOF", "", source.offset()};
+}
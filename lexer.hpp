@@ -1,17 +1,68 @@
 #ifndef LEXER_HPP
 #define LEXER_HPP
 
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <set>
+
+#include "source.hpp"
 
 typedef struct
 {
     std::string token;
     std::string lexeme;
+    size_t offset = 0; // byte offset of the first character
+    uint32_t id = 0;   // interned name, for identifiers
+    int64_t integer = 0; // value of an Integer token
+    double real = 0;     // value of a Real token
+    bool overflow = false; // the literal is out of range
 } TokenResult;
 
-TokenResult lexer(std::istream &stream = std::cin);
+TokenResult lexer(Source &source);
+
+void convertLiteral(TokenResult &token);
+
+// Token rules shared by lexer(), the push lexer and the constant evaluated
+// lexer of embedded.hpp. Characters are classed as <cctype> does in the
+// "C" locale, so the rules can run at compile time.
+constexpr bool isBlank(int c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+constexpr bool isLetter(int c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+constexpr bool isDigit(int c) { return c >= '0' && c <= '9'; }
+// Continues an identifier after its first letter
+constexpr bool isWordChar(int c) {
+  return isLetter(c) || isDigit(c) || c == '_';
+}
+
+constexpr bool isSeparator(int c) {
+  return c == '(' || c == ')' || c == ';' || c == ',' || c == '[' ||
+         c == ']' || c == '{' || c == '}';
+}
+
+constexpr bool isOperator(int c) {
+  return c == '+' || c == '-' || c == '*' || c == '/' || c == '=' ||
+         c == '<' || c == '>' || c == '!';
+}
+
+// "<=", "=>", "==" and "!=" are the two-character operators
+constexpr bool isTwoCharOperator(int c, int next) {
+  return (c == '<' && next == '=') || (c == '=' && (next == '>' || next == '=')) ||
+         (c == '!' && next == '=');
+}
+
+inline constexpr std::string_view keywords[] = {
+    "function", "integer", "boolean", "real",   "if",    "else",  "endif",
+    "while",    "endwhile", "return", "scan",   "print", "true",  "false"};
+
+constexpr bool isKeyword(std::string_view lexeme) {
+  for (std::string_view keyword : keywords) {
+    if (keyword == lexeme)
+      return true;
+  }
+  return false;
+}
 
 #endif // LEXER_H
\ No newline at end of file
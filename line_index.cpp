@@ -0,0 +1,75 @@
+#include <algorithm>
+
+#include "line_index.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+LineIndex::LineIndex(size_t start, int line) : starts{start}, firstLine(line) {}
+
+void LineIndex::add(const char *data, size_t size, size_t offset) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+    while (mask) {
+      starts.push_back(offset + i + __builtin_ctz(mask) + 1);
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; i < size; i++) {
+    if (data[i] == '\n')
+      starts.push_back(offset + i + 1);
+  }
+}
+
+void LineIndex::advance(const char *data, size_t size, size_t offset) {
+  size_t count = 0;
+  size_t last = 0; // one past the last newline, 0 if none
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; i + 16 <= size; i += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+    if (mask) {
+      count += __builtin_popcount(mask);
+      last = i + 32 - __builtin_clz(mask);
+    }
+  }
+#endif
+  for (; i < size; i++) {
+    if (data[i] == '\n') {
+      count++;
+      last = i + 1;
+    }
+  }
+
+  firstLine += starts.size() - 1 + count;
+  size_t start = last ? offset + last : starts.back();
+  starts.assign(1, start);
+}
+
+void LineIndex::forget(size_t offset) {
+  size_t i = std::upper_bound(starts.begin(), starts.end(), offset) -
+             starts.begin();
+  if (i < 2 || i - 1 < starts.size() / 2)
+    return;
+  starts.erase(starts.begin(), starts.begin() + (i - 1));
+  firstLine += i - 1;
+}
+
+Location LineIndex::locate(size_t offset) const {
+  size_t i = std::upper_bound(starts.begin(), starts.end(), offset) -
+             starts.begin();
+  if (i == 0) {
+    // Older than the line starts still kept; only the line is known
+    return {firstLine, 1};
+  }
+  return {firstLine + static_cast<int>(i - 1),
+          static_cast<int>(offset - starts[i - 1]) + 1};
+}
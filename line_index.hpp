@@ -0,0 +1,39 @@
+#ifndef LINE_INDEX_HPP
+#define LINE_INDEX_HPP
+
+#include <cstddef>
+#include <vector>
+
+struct Location {
+  int line;
+  int column;
+};
+
+// Byte offsets of line starts, filled by a vectorised scan for '\n'. Tokens
+// only carry offsets; line and column are looked up here by binary search
+// when a diagnostic actually needs them.
+class LineIndex {
+public:
+  // The first indexed line starts at `start` and has number `line`
+  explicit LineIndex(size_t start = 0, int line = 1);
+
+  // Record the line starts in data, which sits at `offset` in the input
+  void add(const char *data, size_t size, size_t offset);
+
+  // Forget all but the last line start, after counting the newlines in
+  // data in bulk. Used when a streaming window is discarded, so memory
+  // does not grow with the input.
+  void advance(const char *data, size_t size, size_t offset);
+
+  // Forget the starts of lines that end before offset, once they are at
+  // least half of those kept, so dropping them costs amortised O(1)
+  void forget(size_t offset);
+
+  Location locate(size_t offset) const;
+
+private:
+  std::vector<size_t> starts;
+  int firstLine;
+};
+
+#endif
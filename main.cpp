@@ -1,13 +1,906 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include "asm_backend.hpp"
+#include "batch_reader.hpp"
+#include "batch_runner.hpp"
+#include "call_graph.hpp"
+#include "compiler.hpp"
+#include "embedded.hpp"
+#include "ir.hpp"
+#include "ir_passes.hpp"
 #include "lexer.hpp"
+#include "push_parser.hpp"
+#include "string_table.hpp"
+#include "structure_check.hpp"
 #include "syntax_analyzer.hpp"
+#include "type_checker.hpp"
+#include "vm.hpp"
+#include "xref_index.hpp"
 
-int main() {
-    nextToken();
-    Rat25S();
+size_t reportDiagnostics(bool compiling = false);
+std::string errorLine(const char *kind, const char *msg, Location at);
+
+// Feed standard input to a ParseSession in chunks of the given size
+int pushParse(size_t chunkSize, bool check) {
+    ParseSession session;
+    std::vector<char> chunk(chunkSize);
+    while (std::cin.read(chunk.data(), chunk.size()) || std::cin.gcount() > 0) {
+      if (!session.push(chunk.data(), std::cin.gcount())) {
+        break; // the error is known; the rest cannot change it
+      }
+    }
+    if (!session.finish()) {
+      std::cerr << session.errorMessage() << '\n';
+      return 1;
+    }
+    if (check && reportDiagnostics() > 0) {
+      return 1;
+    }
+    return 0;
+  }
+
+// Validate many files without tracing; only failures are printed
+int batchParse(std::vector<std::string> paths) {
+    if (paths.empty()) {
+      std::string path;
+      while (std::getline(std::cin, path)) {
+        if (!path.empty())
+          paths.push_back(path);
+      }
+    }
+
+    debug = false;
+    size_t failed = 0;
+    BatchReader reader;
+    auto start = std::chrono::steady_clock::now();
+
+    reader.run(paths, [&](const std::string &path, const char *data,
+                          size_t size, int err) {
+      if (err != 0) {
+        std::cout << path << ": " << strerror(err) << '\n';
+        failed++;
+        return;
+      }
+      Source source(data, size);
+      StructureError structure;
+      if (!checkStructure(data, size, !lazyBodies, structure)) {
+        std::cout << path << ": "
+                  << errorLine("Syntax", structure.message.c_str(),
+                               source.locate(structure.offset));
+        failed++;
+        return;
+      }
+      try {
+        parseSource(source);
+      } catch (const SyntaxError &e) {
+        std::cout << path << ": " << e.what() << '\n';
+        failed++;
+      }
+    });
+
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::cerr << paths.size() << " files, " << failed << " failed, "
+              << std::fixed << std::setprecision(0)
+              << (seconds > 0 ? paths.size() / seconds : 0) << " files/s ("
+              << (reader.usingUring() ? "io_uring" : "pread") << ")\n";
+    if (cacheFunctions) {
+      FunctionCacheStats cache = functionCache.stats();
+      size_t lookups = cache.hits + cache.misses;
+      std::cerr << "function cache: " << cache.hits << " hits of " << lookups
+                << " (" << (lookups > 0 ? 100.0 * cache.hits / lookups : 0)
+                << "%), " << cache.entries << " entries, " << cache.bytesSaved
+                << " bytes not reparsed\n";
+    }
+    return failed == 0 ? 0 : 1;
+  }
+
+// Index identifier definitions and uses of many files; paths come from
+// standard input when none are given
+int xrefIndex(const std::string &indexPath, std::vector<std::string> paths) {
+    if (paths.empty()) {
+      std::string path;
+      while (std::getline(std::cin, path)) {
+        if (!path.empty())
+          paths.push_back(path);
+      }
+    }
+
+    XrefBuildStats stats;
+    std::string error;
+    if (!buildXrefIndex(indexPath, paths, std::cout, stats, error)) {
+      std::cerr << error << '\n';
+      return 1;
+    }
+    std::cerr << paths.size() << " files: " << stats.parsed << " parsed, "
+              << stats.unchanged << " unchanged, " << stats.failed
+              << " failed; " << stats.names << " names, " << stats.postings
+              << " postings\n";
+    return stats.failed == 0 ? 0 : 1;
+  }
+
+// Print where a name is defined and used, from an index
+int xrefQuery(const std::string &indexPath, const std::string &name) {
+    XrefIndex index;
+    std::string error;
+    if (!index.open(indexPath, error)) {
+      std::cerr << error << '\n';
+      return 1;
+    }
+    std::span<const XrefPosting> postings = index.find(name);
+    for (const XrefPosting &posting : postings) {
+      if (posting.file >= index.files().size() || posting.kind > SCAN_USE)
+        continue;
+      std::cout << index.path(index.files()[posting.file]) << ':'
+                << posting.line << ':' << posting.column << ": "
+                << xrefKindNames[posting.kind] << ' ' << name << '\n';
+    }
+    return postings.empty() ? 1 : 0;
+  }
+
+// Read a whole program file; reports why on failure
+bool readFile(const std::string &path, std::string &data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      std::cerr << path << ": " << strerror(errno) << '\n';
+      return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    data = text.str();
+    return true;
+  }
+
+std::string errorLine(const char *kind, const char *msg, Location at) {
+    return std::string(kind) + " error: " + msg + " @ line " +
+           std::to_string(at.line) + ", column " + std::to_string(at.column) +
+           "\n";
+  }
+
+// Drop the functions the main statements never reach, before any later
+// stage spends time on them
+void dropDeadFunctions() {
+    if (!eliminateDeadFunctions && !showCallGraph) {
+      return;
+    }
+    CallGraph graph = buildCallGraph(program);
+    if (showCallGraph) {
+      writeCallGraph(program, graph, std::cerr);
+    }
+    if (eliminateDeadFunctions) {
+      Elimination removed = removeUnreachable(program, graph);
+      if (showCallGraph) {
+        std::cerr << "Eliminated " << removed.functions << " functions, "
+                  << removed.bytes << " bytes\n";
+      }
+    }
+  }
+
+// Parse a program to compile it. Bodies are always parsed, whatever
+// --lazy says: a skipped one would compile to an empty function.
+void parseProgram(Source &source) {
+    lazyBodies = false;
+    parseSource(source);
+    dropDeadFunctions();
+  }
+
+// Check the parsed program before it is compiled: what the symbol table
+// found, then types. Prints every problem and fails on any that stops
+// compilation; an undeclared variable, for one, is only a warning.
+bool checkProgram(Source &source) {
+    if (reportDiagnostics(true) > 0) {
+      return false;
+    }
+    std::vector<TypeError> errors = checkTypes(program);
+    for (const TypeError &e : errors) {
+      std::cerr << errorLine("Type", e.message.c_str(), source.locate(e.offset));
+    }
+    return errors.empty();
+  }
+
+// Compile a program file and run it; scan reads standard input and print
+// writes standard output, as text or `binary` values. With
+// `profiling` the profile report goes to standard error and, given a
+// `stacksPath`, collapsed stacks to that file, also after a run-time error.
+int runFile(const std::string &path, bool listing, bool showStats,
+            bool binary, bool profiling, const std::string &stacksPath) {
+    std::string data;
+    if (!readFile(path, data)) {
+      return 1;
+    }
+
+    debug = false;
+    keepProgram = true;
+    Source source(data.data(), data.size());
+    Bytecode bytecode;
+    Profile profile;
+    auto writeProfile = [&]() {
+      if (!profiling) {
+        return;
+      }
+      writeProfileReport(bytecode, profile, data,
+                         [&](size_t offset) { return source.locate(offset); },
+                         std::cerr);
+      if (!stacksPath.empty()) {
+        std::ofstream stacks(stacksPath);
+        writeCollapsedStacks(bytecode, profile, stacks);
+        if (!stacks) {
+          std::cerr << stacksPath << ": " << strerror(errno) << '\n';
+        }
+      }
+    };
+    try {
+      parseProgram(source);
+      if (!checkProgram(source)) {
+        return 1;
+      }
+      bytecode = compileProgram(program);
+      if (listing) {
+        disassemble(bytecode, std::cout);
+        return 0;
+      }
+
+      RunStats stats;
+      auto start = std::chrono::steady_clock::now();
+      InputBuffer input(STDIN_FILENO);
+      OutputBuffer output(STDOUT_FILENO, binary);
+      VmContext(bytecode).run(input, output, &stats,
+                              profiling ? &profile : nullptr);
+      double seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+      if (showStats) {
+        std::cerr << stats.instructions << " instructions, " << stats.calls
+                  << " calls, " << std::fixed << std::setprecision(3)
+                  << seconds << " s, " << std::setprecision(1)
+                  << (seconds > 0 ? stats.instructions / seconds / 1e6 : 0)
+                  << " Mops/s\n";
+        for (const MemoStats &memo : stats.memo) {
+          std::cerr << "memoized " << identifiers.name(memo.name) << ": "
+                    << memo.hits << " hits, " << memo.misses << " misses\n";
+        }
+      }
+      writeProfile();
+    } catch (const SyntaxError &e) {
+      std::cerr << e.what() << '\n';
+      return 1;
+    } catch (const CompileError &e) {
+      std::cerr << errorLine("Compile", e.what(), source.locate(e.offset));
+      return 1;
+    } catch (const RuntimeError &e) {
+      std::cerr << errorLine("Runtime", e.what(), source.locate(e.offset));
+      writeProfile();
+      return 1;
+    }
+    return 0;
+  }
+
+// Compile a program file once and run it over every line of a records
+// file on `threads` threads, with output in record order
+int runRecords(const std::string &path, const std::string &recordsPath,
+               unsigned threads, bool binary, bool showStats) {
+    std::string data, records;
+    if (!readFile(path, data) || !readFile(recordsPath, records)) {
+      return 1;
+    }
+
+    debug = false;
+    keepProgram = true;
+    Source source(data.data(), data.size());
+    try {
+      parseProgram(source);
+      if (!checkProgram(source)) {
+        return 1;
+      }
+      Bytecode bytecode = compileProgram(program);
+
+      auto start = std::chrono::steady_clock::now();
+      size_t count = std::count(records.begin(), records.end(), '\n') +
+                     (!records.empty() && records.back() != '\n');
+      size_t failed = runBatch(
+          bytecode, records, threads, binary, std::cout, std::cerr,
+          [&](size_t offset) { return source.locate(offset); });
+      double seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+      if (showStats) {
+        std::cerr << count << " records, " << failed << " failed, "
+                  << threads << " threads, " << std::fixed
+                  << std::setprecision(3) << seconds << " s, "
+                  << std::setprecision(0)
+                  << (seconds > 0 ? count / seconds : 0) << " records/s\n";
+      }
+      return failed == 0 ? 0 : 1;
+    } catch (const SyntaxError &e) {
+      std::cerr << e.what() << '\n';
+      return 1;
+    } catch (const CompileError &e) {
+      std::cerr << errorLine("Compile", e.what(), source.locate(e.offset));
+      return 1;
+    }
+  }
+
+// Write a program file as x86-64 assembly on standard output
+int emitFile(const std::string &path) {
+    std::string data;
+    if (!readFile(path, data)) {
+      return 1;
+    }
+
+    debug = false;
+    keepProgram = true;
+    Source source(data.data(), data.size());
+    try {
+      parseProgram(source);
+      if (!checkProgram(source)) {
+        return 1;
+      }
+      emitAssembly(program, std::cout,
+                   [&](size_t offset) { return source.locate(offset); });
+    } catch (const SyntaxError &e) {
+      std::cerr << e.what() << '\n';
+      return 1;
+    } catch (const CompileError &e) {
+      std::cerr << errorLine("Compile", e.what(), source.locate(e.offset));
+      return 1;
+    }
+    return 0;
+  }
+
+// Run a program file on the VM and as a native executable with standard
+// input as the input of both, and compare output, errors and exit status
+int nativeTest(const std::string &path) {
+    std::string data;
+    if (!readFile(path, data)) {
+      return 1;
+    }
+    std::stringstream stdinText;
+    stdinText << std::cin.rdbuf();
+    std::string inputText = stdinText.str();
+
+    debug = false;
+    keepProgram = true;
+    Source source(data.data(), data.size());
+    std::ostringstream assembly;
+    std::ostringstream vmOut;
+    std::string vmErr;
+    int vmStatus = 0;
+    try {
+      parseProgram(source);
+      if (!checkProgram(source)) {
+        return 1;
+      }
+      emitAssembly(program, assembly,
+                   [&](size_t offset) { return source.locate(offset); });
+      Bytecode bytecode = compileProgram(program);
+      std::istringstream vmIn(inputText);
+      try {
+        runProgram(bytecode, vmIn, vmOut);
+      } catch (const RuntimeError &e) {
+        vmErr = errorLine("Runtime", e.what(), source.locate(e.offset));
+        vmStatus = 1;
+      }
+    } catch (const SyntaxError &e) {
+      std::cerr << e.what() << '\n';
+      return 1;
+    } catch (const CompileError &e) {
+      std::cerr << errorLine("Compile", e.what(), source.locate(e.offset));
+      return 1;
+    }
+
+    char dirTemplate[] = "/tmp/rat25s-XXXXXX";
+    if (mkdtemp(dirTemplate) == nullptr) {
+      std::cerr << "mkdtemp: " << strerror(errno) << '\n';
+      return 1;
+    }
+    std::string dir = dirTemplate;
+    std::ofstream(dir + "/prog.s") << assembly.str();
+    std::ofstream(dir + "/input") << inputText;
+
+    std::string build = "as -o " + dir + "/prog.o " + dir + "/prog.s && ld -o " +
+                        dir + "/prog " + dir + "/prog.o";
+    int status = std::system(build.c_str());
+    std::string nativeOut, nativeErr;
+    int nativeStatus = -1;
+    if (status == 0) {
+      std::string run = dir + "/prog < " + dir + "/input > " + dir +
+                        "/out 2> " + dir + "/err";
+      status = std::system(run.c_str());
+      nativeStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+      readFile(dir + "/out", nativeOut);
+      readFile(dir + "/err", nativeErr);
+    }
+    std::filesystem::remove_all(dir);
+
+    if (nativeStatus < 0) {
+      std::cout << "FAIL " << path << ": assembly did not build\n";
+      return 1;
+    }
+    if (nativeOut != vmOut.str() || nativeErr != vmErr ||
+        nativeStatus != vmStatus) {
+      std::cout << "FAIL " << path << ": native "
+                << (nativeOut != vmOut.str() ? "output"
+                    : nativeErr != vmErr     ? "error"
+                                             : "exit status")
+                << " differs from the VM\n";
+      return 1;
+    }
+    std::cout << "PASS " << path << '\n';
+    return 0;
+  }
+
+// Parse a comma-separated pass list into `passes`; "none" is no passes
+bool parsePasses(const std::string &list, PassManager &passes) {
+    if (list == "none") {
+      return true;
+    }
+    std::stringstream names(list);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+      const IrPass *pass = findPass(name);
+      if (pass == nullptr) {
+        std::cerr << "Unknown pass " << name << "; passes are:\n";
+        for (const IrPass &known : irPasses()) {
+          std::cerr << "  " << std::left << std::setw(6) << known.name
+                    << known.description << '\n';
+        }
+        return false;
+      }
+      passes.add(pass);
+    }
+    return true;
+  }
+
+// Lower a program file to SSA, optimize it and print the IR
+int irFile(const std::string &path, const std::string &passList) {
+    PassManager passes;
+    std::string data;
+    if (!parsePasses(passList, passes) || !readFile(path, data)) {
+      return 1;
+    }
+
+    debug = false;
+    keepProgram = true;
+    Source source(data.data(), data.size());
+    try {
+      parseProgram(source);
+      if (!checkProgram(source)) {
+        return 1;
+      }
+      IrModule module = lowerProgram(program);
+      inlinedCalls.clear();
+      passes.run(module);
+      for (const InlinedCall &call : inlinedCalls) {
+        Location at = source.locate(call.offset);
+        std::cerr << "Inlined " << identifiers.name(call.callee) << " into "
+                  << (call.caller ? identifiers.name(call.caller) : "main")
+                  << " @ line " << at.line << ", column " << at.column << " ("
+                  << call.size << " instructions)\n";
+      }
+      dumpModule(module, std::cout);
+    } catch (const SyntaxError &e) {
+      std::cerr << e.what() << '\n';
+      return 1;
+    } catch (const CompileError &e) {
+      std::cerr << errorLine("Compile", e.what(), source.locate(e.offset));
+      return 1;
+    }
+    return 0;
+  }
+
+// Run a program file's IR unoptimized, after each pass alone and after
+// the full pipeline, with standard input as input. Every run must match
+// the VM; the executed instruction counts show what each pass saves.
+int irTest(const std::string &path, const std::string &pipeline) {
+    std::string data;
+    if (!readFile(path, data)) {
+      return 1;
+    }
+    std::stringstream stdinText;
+    stdinText << std::cin.rdbuf();
+    std::string inputText = stdinText.str();
+
+    std::vector<std::string> configurations = {"none"};
+    for (const IrPass &pass : irPasses()) {
+      configurations.push_back(pass.name);
+    }
+    configurations.push_back(pipeline);
+
+    debug = false;
+    keepProgram = true;
+    Source source(data.data(), data.size());
+    auto run = [&](auto execute, std::string &errors) {
+      std::istringstream in(inputText);
+      std::ostringstream out;
+      try {
+        execute(in, out);
+      } catch (const RuntimeError &e) {
+        errors = errorLine("Runtime", e.what(), source.locate(e.offset));
+      }
+      return out.str();
+    };
+
+    bool passed = true;
+    try {
+      parseProgram(source);
+      if (!checkProgram(source)) {
+        return 1;
+      }
+      Bytecode bytecode = compileProgram(program);
+      std::string vmErrors;
+      std::string vmOut = run(
+          [&](std::istream &in, std::ostream &out) {
+            runProgram(bytecode, in, out);
+          },
+          vmErrors);
+
+      uint64_t baseline = 0;
+      for (const std::string &configuration : configurations) {
+        PassManager passes;
+        if (!parsePasses(configuration, passes)) {
+          return 1;
+        }
+        IrModule module = lowerProgram(program);
+        passes.run(module);
+
+        uint64_t executed = 0;
+        std::string errors;
+        std::string out = run(
+            [&](std::istream &in, std::ostream &out) {
+              runModule(module, in, out, executed);
+            },
+            errors);
+        if (configuration == "none") {
+          baseline = executed;
+        }
+
+        std::cout << std::left << std::setw(20) << configuration << std::right
+                  << std::setw(12) << executed << " instructions";
+        if (baseline > 0 && configuration != "none") {
+          std::cout << std::fixed << std::setprecision(1) << "  ("
+                    << 100.0 * (double(executed) - baseline) / baseline
+                    << "%)";
+        }
+        if (out != vmOut || errors != vmErrors) {
+          std::cout << "  output differs from the VM";
+          passed = false;
+        }
+        std::cout << '\n';
+      }
+    } catch (const SyntaxError &e) {
+      std::cerr << e.what() << '\n';
+      return 1;
+    } catch (const CompileError &e) {
+      std::cerr << errorLine("Compile", e.what(), source.locate(e.offset));
+      return 1;
+    }
+    std::cout << (passed ? "PASS " : "FAIL ") << path << '\n';
+    return passed ? 0 : 1;
+  }
+
+// Programs compiled into the binary, lexed and checked at compile time
+constexpr auto &embeddedEcho =
+    embeddedProgram<"$$\n$$\ninteger a;\n$$\nscan(a);\nprint(a);\n$$\n">;
+constexpr auto &embeddedConvert = embeddedProgram<R"($$
+function convertx (fahr integer)
+{
+    return 5 * (fahr - 32) / 9;
+}
+$$
+integer low, high, step; [* declarations *]
+$$
+scan(low, high, step);
+while (low <= high)
+{
+    print(low);
+    print(convertx(low));
+    low = low + step;
+}
+endwhile
+$$
+)">;
+constexpr auto &embeddedMixed = embeddedProgram<R"($$
+function scale (x real, n integer) real r;
+{
+    r = x * n;
+    if (r => 100.0) return -r; else return r / 2; endif
+}
+$$
+real total; integer i; boolean done;
+$$
+total = 0.5; i = 0; done = false;
+while (i < 10) { total = total + scale(total, i); i = i + 1; } endwhile
+if (total != 0) { done = true; } endif
+print(total); print(done);
+$$
+)">;
+
+// Check each embedded program against the runtime path: lexer() must give
+// the same tokens, and parseSource() must give the same bytecode
+int embeddedTest() {
+    struct Embedded {
+      const char *name;
+      std::string_view text;
+      const EmbeddedToken *tokens;
+      size_t count;
+    };
+    auto entry = [](const char *name, const auto &embedded) {
+      return Embedded{name, embedded.text.view(), embedded.tokens.data(),
+                      embedded.tokens.size()};
+    };
+    std::vector<Embedded> programs = {entry("echo", embeddedEcho),
+                                      entry("convert", embeddedConvert),
+                                      entry("mixed", embeddedMixed)};
+
+    debug = false;
+    keepProgram = true;
+    bool passed = true;
+    for (const Embedded &embedded : programs) {
+      Source source(embedded.text.data(), embedded.text.size());
+      std::string problem;
+      for (size_t i = 0; i < embedded.count && problem.empty(); i++) {
+        const EmbeddedToken &expected = embedded.tokens[i];
+        TokenResult token = lexer(source);
+        if (token.token != embeddedKindNames[expected.kind] ||
+            token.offset != expected.offset ||
+            token.lexeme != embedded.text.substr(expected.offset,
+                                                 expected.kind == EMBEDDED_EOF
+                                                     ? 0
+                                                     : expected.length)) {
+          problem = "token " + std::to_string(i) + " differs from lexer()";
+        }
+      }
+
+      std::ostringstream fromEmbedded, fromSource;
+      try {
+        Source parsed(embedded.text.data(), embedded.text.size());
+        if (problem.empty()) {
+          parseEmbedded(embedded.text, embedded.tokens, embedded.count);
+          if (!checkProgram(parsed)) {
+            return 1;
+          }
+          disassemble(compileProgram(program), fromEmbedded);
+          parseSource(parsed);
+          checkProgram(parsed);
+          disassemble(compileProgram(program), fromSource);
+          if (fromEmbedded.str() != fromSource.str()) {
+            problem = "bytecode differs from parseSource()";
+          }
+        }
+      } catch (const SyntaxError &e) {
+        problem = e.what();
+      } catch (const CompileError &e) {
+        problem = std::string("Compile error: ") + e.what();
+      }
+      std::cout << (problem.empty() ? "PASS " : "FAIL ") << embedded.name
+                << " (" << embedded.count << " tokens)";
+      if (!problem.empty()) {
+        std::cout << ": " << problem;
+        passed = false;
+      }
+      std::cout << '\n';
+    }
+    return passed ? 0 : 1;
+  }
+
+// Print what the symbol table found in source order; returns the number of
+// errors. Every diagnostic is an error for --check; when `compiling`, only
+// the fatal ones are and the rest are printed as warnings.
+size_t reportDiagnostics(bool compiling) {
+    std::vector<Diagnostic> found = symbolTable.diagnostics();
+    std::stable_sort(found.begin(), found.end(),
+                     [](const Diagnostic &a, const Diagnostic &b) {
+                       return a.at.line != b.at.line ? a.at.line < b.at.line
+                                                     : a.at.column < b.at.column;
+                     });
+    size_t errors = 0;
+    for (const Diagnostic &d : found) {
+      bool error = d.fatal || !compiling;
+      std::cerr << (error ? "Semantic error: " : "Semantic warning: ")
+                << d.message << " @ line " << d.at.line << ", column "
+                << d.at.column << '\n';
+      errors += error;
+    }
+    return errors;
+  }
+
+// Read the value of a count option: digits only, from `least` to `most`.
+// False sends main() to the usage text.
+bool parseCount(const char *text, size_t least, size_t most, size_t &value) {
+    if (!isdigit((unsigned char)text[0])) {
+      return false;
+    }
+    try {
+      size_t used;
+      unsigned long count = std::stoul(text, &used);
+      if (text[used] != '\0' || count < least || count > most) {
+        return false;
+      }
+      value = count;
+      return true;
+    } catch (const std::invalid_argument &) {
+      return false;
+    } catch (const std::out_of_range &) {
+      return false;
+    }
+  }
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string> expand;
+    size_t chunkSize = 0;
+    bool check = false;
+    std::string runPath;
+    bool listing = false;
+    bool showStats = false;
+    bool profiling = false;
+    bool binary = false;
+    std::string recordsPath;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string stacksPath;
+    std::string irPath;
+    std::string irTestPath;
+    std::string passList = "inline,cse,licm,dce";
+    const size_t anyCount = std::numeric_limits<size_t>::max();
+    size_t count;
+
+    for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      if (arg == "--lazy") {
+        lazyBodies = true;
+      } else if (arg == "--expand" && i + 1 < argc) {
+        lazyBodies = true;
+        expand.push_back(argv[++i]);
+      } else if (arg == "--folded") {
+        showExpressions = true;
+      } else if (arg == "--check") {
+        check = true;
+      } else if (arg == "--function-cache") {
+        cacheFunctions = true;
+      } else if (arg == "--flight-recorder" && i + 1 < argc &&
+                 parseCount(argv[i + 1], 1, anyCount, count)) {
+        // Keep the last events instead of printing the trace
+        debug = false;
+        flightRecorder.resize(count);
+        i++;
+      } else if (arg == "--chunk" && i + 1 < argc &&
+                 parseCount(argv[i + 1], 1, anyCount, chunkSize)) {
+        i++;
+      } else if (arg == "--run" && i + 1 < argc) {
+        runPath = argv[++i];
+      } else if (arg == "--asm" && i + 1 < argc) {
+        return emitFile(argv[i + 1]);
+      } else if (arg == "--native-test" && i + 1 < argc) {
+        return nativeTest(argv[i + 1]);
+      } else if (arg == "--embedded-test") {
+        return embeddedTest();
+      } else if (arg == "--ir" && i + 1 < argc) {
+        irPath = argv[++i];
+      } else if (arg == "--ir-test" && i + 1 < argc) {
+        irTestPath = argv[++i];
+      } else if (arg == "--passes" && i + 1 < argc) {
+        passList = argv[++i];
+      } else if (arg == "--inline-budget" && i + 1 < argc &&
+                 parseCount(argv[i + 1], 0, anyCount, inlineBudget)) {
+        // 0 turns inlining off
+        i++;
+      } else if (arg == "--bytecode") {
+        listing = true;
+      } else if (arg == "--records" && i + 1 < argc) {
+        recordsPath = argv[++i];
+      } else if (arg == "--threads" && i + 1 < argc &&
+                 parseCount(argv[i + 1], 1,
+                            std::numeric_limits<unsigned>::max(), count)) {
+        threads = count;
+        i++;
+      } else if (arg == "--binary-output") {
+        binary = true;
+      } else if (arg == "--profile") {
+        profiling = true;
+      } else if (arg == "--profile-stacks" && i + 1 < argc) {
+        profiling = true;
+        stacksPath = argv[++i];
+      } else if (arg == "--keep-dead-functions") {
+        eliminateDeadFunctions = false;
+      } else if (arg == "--call-graph") {
+        showCallGraph = true;
+      } else if (arg == "--no-memo") {
+        memoizeCalls = false;
+      } else if (arg == "--stats") {
+        showStats = true;
+      } else if (arg == "--xref-index" && i + 1 < argc) {
+        // Remaining arguments are files, as for --batch
+        return xrefIndex(argv[i + 1],
+                         std::vector<std::string>(argv + i + 2, argv + argc));
+      } else if (arg == "--xref" && i + 2 < argc) {
+        return xrefQuery(argv[i + 1], argv[i + 2]);
+      } else if (arg == "--batch") {
+        // Remaining arguments are files; none means read paths from stdin
+        return batchParse(std::vector<std::string>(argv + i + 1, argv + argc));
+      } else {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--lazy] [--expand <function>] [--chunk <bytes>] [--check]\n"
+                  << "       " << "  [--function-cache]\n"
+                  << "       " << "  [--flight-recorder <events>]\n"
+                  << "       " << argv[0] << " [--folded]\n"
+                  << "       " << argv[0] << " [--lazy] [--function-cache] --batch [file...]\n"
+                  << "       " << argv[0] << " [--function-cache] --xref-index <index> [file...]\n"
+                  << "       " << argv[0] << " --xref <index> <name>\n"
+                  << "       " << argv[0] << " --run <file> [--bytecode] [--stats] [--no-memo] [--binary-output]\n"
+                  << "       " << "  [--profile] [--profile-stacks <file>]\n"
+                  << "       " << argv[0] << " --run <file> --records <file> [--threads <n>] [--binary-output] [--stats]\n"
+                  << "       " << argv[0] << " --asm <file> | --native-test <file>\n"
+                  << "       " << "  [--call-graph] [--keep-dead-functions], before any of these\n"
+                  << "       " << argv[0] << " --embedded-test\n"
+                  << "       " << argv[0] << " [--passes <list>] [--inline-budget <n>]\n"
+                  << "       " << "  --ir <file> | --ir-test <file>\n";
+        return 1;
+      }
+    }
+
+    if (!irPath.empty()) {
+      return irFile(irPath, passList);
+    }
+    if (!irTestPath.empty()) {
+      return irTest(irTestPath, passList);
+    }
+    if (!runPath.empty()) {
+      if (!recordsPath.empty()) {
+        return runRecords(runPath, recordsPath, threads, binary, showStats);
+      }
+      return runFile(runPath, listing, showStats, binary, profiling,
+                     stacksPath);
+    }
+    if (chunkSize > 0) {
+      return pushParse(chunkSize, check);
+    }
+
+    // Function() reads cached spans ahead, which needs the whole input in
+    // memory to locate every token
+    std::string text;
+    std::unique_ptr<Source> whole;
+    if (cacheFunctions) {
+      std::stringstream in;
+      in << std::cin.rdbuf();
+      text = in.str();
+      whole = std::make_unique<Source>(text.data(), text.size());
+      input = whole.get();
+    }
+
+    try {
+      nextToken();
+      Rat25S();
+
+      for (const std::string &name : expand) {
+        FunctionHeader *header = findFunction(name);
+        if (header == nullptr) {
+          std::cerr << "No function named " << name << '\n';
+          return 1;
+        }
+        ExpandBody(*header);
+      }
+    } catch (const SyntaxError &e) {
+      std::cerr << e.what() << '\n';
+      return 1;
+    }
+    if (check && reportDiagnostics() > 0) {
+      return 1;
+    }
     return 0;
   }
-  
\ No newline at end of file
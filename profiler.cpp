@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <string>
+
+#include "profiler.hpp"
+#include "string_table.hpp"
+
+static std::string functionName(const Bytecode &bytecode, int function) {
+  if (function < 0)
+    return "main";
+  return std::string(identifiers.name(bytecode.functions[function].name));
+}
+
+// Text of a line, without surrounding blanks
+static std::string_view lineText(std::string_view text, int line) {
+  size_t start = 0;
+  for (int i = 1; i < line && start != std::string_view::npos; i++) {
+    start = text.find('\n', start);
+    if (start != std::string_view::npos)
+      start++;
+  }
+  if (start == std::string_view::npos)
+    return {};
+  size_t end = std::min(text.find('\n', start), text.size());
+  std::string_view result = text.substr(start, end - start);
+  size_t first = result.find_first_not_of(" \t\r");
+  size_t last = result.find_last_not_of(" \t\r");
+  return first == std::string_view::npos
+             ? std::string_view()
+             : result.substr(first, last - first + 1);
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+  return whole ? 100.0 * part / whole : 0;
+}
+
+void writeProfileReport(const Bytecode &bytecode, const Profile &profile,
+                        std::string_view text,
+                        const std::function<Location(size_t)> &locate,
+                        std::ostream &out) {
+  auto ms = [&](uint64_t cycles) {
+    return cycles * profile.secondsPerCycle * 1e3;
+  };
+  char row[256];
+
+  // A line runs as often as its busiest instruction
+  struct Line {
+    uint64_t hits = 0, instructions = 0, cycles = 0;
+  };
+  std::map<int, Line> lines;
+  for (size_t pc = 0; pc < bytecode.code.size();
+       pc += 1 + operandCount(Opcode(bytecode.code[pc]))) {
+    if (profile.counts[pc] == 0)
+      continue;
+    Line &line = lines[locate(bytecode.offsets[pc]).line];
+    line.hits = std::max(line.hits, profile.counts[pc]);
+    line.instructions += profile.counts[pc];
+    line.cycles += profile.cycles[pc];
+  }
+  std::vector<std::pair<int, Line>> byTime(lines.begin(), lines.end());
+  std::stable_sort(byTime.begin(), byTime.end(),
+                   [](const auto &a, const auto &b) {
+                     return a.second.cycles > b.second.cycles;
+                   });
+
+  std::snprintf(row, sizeof row, "Profile: %.3f ms total\n\n",
+                ms(profile.total));
+  out << row;
+  out << "Lines by time:\n"
+      << "   line         hits  instructions     time ms      %  source\n";
+  for (const auto &[number, line] : byTime) {
+    std::snprintf(row, sizeof row, "%7d %12llu %13llu %11.3f %6.2f  ",
+                  number, (unsigned long long)line.hits,
+                  (unsigned long long)line.instructions, ms(line.cycles),
+                  percent(line.cycles, profile.total));
+    out << row << lineText(text, number) << '\n';
+  }
+
+  std::vector<int> functions;
+  for (size_t i = 0; i < bytecode.functions.size(); i++) {
+    if (profile.calls[i] > 0)
+      functions.push_back(i);
+  }
+  std::stable_sort(functions.begin(), functions.end(), [&](int a, int b) {
+    return profile.inclusive[a] > profile.inclusive[b];
+  });
+  out << "\nFunctions by inclusive time:\n"
+      << "  function                calls  inclusive ms      %\n";
+  std::snprintf(row, sizeof row, "  %-16s %12d %13.3f %6.2f\n", "main", 1,
+                ms(profile.total), 100.0);
+  out << row;
+  for (int f : functions) {
+    std::snprintf(row, sizeof row, "  %-16s %12llu %13.3f %6.2f\n",
+                  functionName(bytecode, f).c_str(),
+                  (unsigned long long)profile.calls[f],
+                  ms(profile.inclusive[f]),
+                  percent(profile.inclusive[f], profile.total));
+    out << row;
+  }
+
+  // Every pass back to the condition is one trip
+  if (bytecode.loops.empty())
+    return;
+  out << "\nLoops:\n"
+      << "   line      entries         trips   trips/entry\n";
+  for (const LoopCode &loop : bytecode.loops) {
+    uint64_t trips = profile.counts[loop.back];
+    uint64_t entries = profile.counts[loop.top] - trips;
+    std::snprintf(row, sizeof row, "%7d %12llu %13llu %13.1f\n",
+                  locate(loop.offset).line, (unsigned long long)entries,
+                  (unsigned long long)trips,
+                  entries ? double(trips) / entries : 0.0);
+    out << row;
+  }
+}
+
+void writeCollapsedStacks(const Bytecode &bytecode, const Profile &profile,
+                          std::ostream &out) {
+  std::vector<std::string> paths(profile.stacks.size());
+  for (size_t i = 0; i < profile.stacks.size(); i++) {
+    const Profile::Stack &stack = profile.stacks[i];
+    // Parents come before their children
+    paths[i] = (stack.parent < 0 ? "" : paths[stack.parent] + ";") +
+               functionName(bytecode, stack.function);
+    uint64_t us = stack.self * profile.secondsPerCycle * 1e6;
+    if (us > 0)
+      out << paths[i] << ' ' << us << '\n';
+  }
+}
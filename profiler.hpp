@@ -0,0 +1,46 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "line_index.hpp"
+
+// What runProgram() measured while profiling. Time is in timestamp-counter
+// cycles, charged to the instruction that was running; secondsPerCycle
+// converts them.
+struct Profile {
+  std::vector<uint64_t> counts; // executions, by code index
+  std::vector<uint64_t> cycles; // by code index
+  std::vector<uint64_t> calls;  // by function
+  std::vector<uint64_t> inclusive; // cycles, by function; recursion once
+  uint64_t total = 0;              // cycles of the whole run
+  double secondsPerCycle = 0;
+
+  // Call stacks seen, as a tree: node 0 is the main program
+  struct Stack {
+    int parent;
+    int function;  // -1 for the main program
+    uint64_t self; // cycles spent in this stack's innermost function
+  };
+  std::vector<Stack> stacks;
+};
+
+// Sorted text report: hot lines with the source text, functions by
+// inclusive time and loop trip counts. `locate` maps source offsets to
+// lines of `text`.
+void writeProfileReport(const Bytecode &bytecode, const Profile &profile,
+                        std::string_view text,
+                        const std::function<Location(size_t)> &locate,
+                        std::ostream &out);
+
+// One "main;f;g <microseconds>" line per call stack, as flame graph tools
+// read
+void writeCollapsedStacks(const Bytecode &bytecode, const Profile &profile,
+                          std::ostream &out);
+
+#endif
@@ -0,0 +1,83 @@
+#include "purity.hpp"
+#include "symbol_table.hpp"
+
+static int functionSymbol;
+static std::vector<int> functionIndex; // by symbol
+static const std::vector<bool> *pure;
+
+static bool global(uint32_t name) {
+  int symbol = symbolTable.lookup(name, functionSymbol);
+  return symbol >= 0 && symbolTable.symbols()[symbol].kind == GLOBAL_SYMBOL;
+}
+
+static bool pureExpr(const Expr &e) {
+  switch (e.kind) {
+  case IDENTIFIER_EXPR:
+    return !global(e.name);
+  case CALL_EXPR: {
+    // Bad calls fail to compile anyway
+    int symbol = symbolTable.lookup(e.name, functionSymbol);
+    if (symbol < 0 || functionIndex[symbol] < 0 ||
+        !(*pure)[functionIndex[symbol]])
+      return false;
+    for (const ExprPtr &arg : e.args) {
+      if (!pureExpr(*arg))
+        return false;
+    }
+    return true;
+  }
+  default:
+    return (!e.left || pureExpr(*e.left)) && (!e.right || pureExpr(*e.right));
+  }
+}
+
+static bool pureStmt(const Stmt &s) {
+  switch (s.kind) {
+  case COMPOUND_STMT:
+    for (const StmtPtr &statement : s.body) {
+      if (!pureStmt(*statement))
+        return false;
+    }
+    return true;
+  case ASSIGN_STMT:
+    return !global(s.name) && pureExpr(*s.value);
+  case IF_STMT:
+  case WHILE_STMT:
+    return pureExpr(*s.condition.left) && pureExpr(*s.condition.right) &&
+           pureStmt(*s.branch) && (!s.elseBranch || pureStmt(*s.elseBranch));
+  case RETURN_STMT:
+    return !s.value || pureExpr(*s.value);
+  case PRINT_STMT:
+  case SCAN_STMT:
+    return false;
+  }
+  return false;
+}
+
+// Assume every function pure and clear the ones that break the rules until
+// nothing changes, so recursive pure functions stay pure
+std::vector<bool> findPureFunctions(const Program &program) {
+  functionIndex.assign(symbolTable.symbols().size(), -1);
+  for (size_t i = 0; i < program.functions.size(); i++)
+    functionIndex[program.functions[i].symbol] = i;
+
+  std::vector<bool> result(program.functions.size(), true);
+  pure = &result;
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t i = 0; i < program.functions.size(); i++) {
+      if (!result[i])
+        continue;
+      functionSymbol = program.functions[i].symbol;
+      for (const StmtPtr &statement : program.functions[i].body) {
+        if (!pureStmt(*statement)) {
+          result[i] = false;
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+  pure = nullptr;
+  return result;
+}
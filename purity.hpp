@@ -0,0 +1,14 @@
+#ifndef PURITY_HPP
+#define PURITY_HPP
+
+#include <vector>
+
+#include "ast.hpp"
+
+// A function is pure when its result depends only on its arguments and
+// calling it has no effect: it never scans, prints, reads or writes a
+// global, and calls only pure functions. Names resolve through
+// symbolTable. Returns a flag per entry of program.functions.
+std::vector<bool> findPureFunctions(const Program &program);
+
+#endif
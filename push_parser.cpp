@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <cstdint>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "push_parser.hpp"
+#include "string_table.hpp"
+
+// As much stack as the main thread has, so nesting the pull-based parser
+// takes is taken here too. Only the pages touched are ever backed.
+static const size_t stackSize = 8 << 20;
+
+// Thrown through a suspended parse to unwind it
+struct Cancelled {};
+
+ParseSession::ParseSession() : lexer(lex()) {
+  stack = mmap(nullptr, stackSize, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+  if (stack == MAP_FAILED)
+    throw std::bad_alloc();
+  // A guard page, so running off the end faults instead of corrupting
+  mprotect(stack, getpagesize(), PROT_NONE);
+
+  getcontext(&parserContext);
+  parserContext.uc_stack.ss_sp = stack;
+  parserContext.uc_stack.ss_size = stackSize;
+  parserContext.uc_link = &callerContext;
+  uintptr_t self = reinterpret_cast<uintptr_t>(this);
+  makecontext(&parserContext, reinterpret_cast<void (*)()>(run), 2,
+              unsigned(self >> 32), unsigned(self));
+}
+
+ParseSession::~ParseSession() {
+  if (started && status == PARSING) {
+    cancelled = true;
+    resume();
+  }
+  munmap(stack, stackSize);
+}
+
+int ParseSession::NextChar::await_resume() const {
+  if (session->pos >= session->pending.size()) {
+    return -1;
+  }
+  unsigned char c = session->pending[session->pos];
+  if (consume) {
+    session->pos++;
+  }
+  return c;
+}
+
+// Same token rules as lexer(), written against get()/peek() so that any
+// co_await can suspend until more input has been pushed.
+LexTask ParseSession::lex() {
+  // Tokens are built in a named local before co_yield; g++ 12 mishandles
+  // braced temporaries in a co_yield operand.
+  TokenResult token;
+  for (;;) {
+    int c = co_await get();
+    if (c < 0) {
+      token = {"EOF", "", consumed + pos};
+      co_yield token;
+      co_return;
+    }
+    if (isBlank(c)) {
+      continue;
+    }
+
+    size_t start = consumed + pos - 1;
+    std::string lexeme(1, static_cast<char>(c));
+
+    if (isLetter(c)) {
+      for (int p = co_await peek(); p >= 0 && isWordChar(p);
+           p = co_await peek()) {
+        lexeme += static_cast<char>(co_await get());
+      }
+      if (isKeyword(lexeme)) {
+        token = {"Keyword", lexeme, start};
+      } else {
+        token = {"Identifier", lexeme, start, identifiers.intern(lexeme)};
+      }
+      co_yield token;
+    } else if (isDigit(c)) {
+      for (int p = co_await peek(); p >= 0 && isDigit(p); p = co_await peek()) {
+        lexeme += static_cast<char>(co_await get());
+      }
+      if (co_await peek() != '.') {
+        token = {"Integer", lexeme, start};
+        convertLiteral(token);
+        co_yield token;
+        continue;
+      }
+      lexeme += static_cast<char>(co_await get());
+      int p = co_await peek();
+      if (p < 0 || !isDigit(p)) {
+        // lexer() consumes the character after a dangling '.'
+        co_await get();
+        token = {"Invalid", lexeme, start};
+        co_yield token;
+        continue;
+      }
+      for (; p >= 0 && isDigit(p); p = co_await peek()) {
+        lexeme += static_cast<char>(co_await get());
+      }
+      token = {"Real", lexeme, start};
+      convertLiteral(token);
+      co_yield token;
+    } else if (c == '[' && co_await peek() == '*') {
+      co_await get();
+      for (int p = co_await get(); p >= 0; p = co_await get()) {
+        if (p == '*' && co_await peek() == ']') {
+          co_await get();
+          break;
+        }
+      }
+    } else if (isSeparator(c)) {
+      token = {"Separator", lexeme, start};
+      co_yield token;
+    } else if (c == '$' && co_await peek() == '$') {
+      lexeme += static_cast<char>(co_await get());
+      token = {"Separator", lexeme, start};
+      co_yield token;
+    } else if (isOperator(c)) {
+      if (isTwoCharOperator(c, co_await peek())) {
+        lexeme += static_cast<char>(co_await get());
+      }
+      token = {"Operator", lexeme, start};
+      co_yield token;
+    } else {
+      token = {"Invalid", lexeme, start};
+      co_yield token;
+    }
+  }
+}
+
+// Entry of the session's stack: the whole parse, from the first token
+void ParseSession::run(unsigned high, unsigned low) {
+  ParseSession *session = reinterpret_cast<ParseSession *>(
+      (uintptr_t(high) << 32) | low);
+  try {
+    parseFeed(*session);
+    session->status = PARSED;
+  } catch (const SyntaxError &e) {
+    session->message = e.what();
+    session->status = FAILED;
+  } catch (const Cancelled &) {
+    session->status = FAILED;
+  } catch (...) {
+    session->failure = std::current_exception();
+    session->status = FAILED;
+  }
+  // Returning switches to uc_link, the caller
+}
+
+// Run the parse until it needs input or ends, with its globals in place
+void ParseSession::resume() {
+  started = true;
+  swapParserState(state);
+  swapcontext(&callerContext, &parserContext);
+  swapParserState(state);
+  if (failure) {
+    std::exception_ptr thrown = failure;
+    failure = nullptr;
+    std::rethrow_exception(thrown);
+  }
+}
+
+void ParseSession::suspend() { swapcontext(&parserContext, &callerContext); }
+
+// Lex the next token, suspending the parse while there is no input for it
+TokenResult ParseSession::next() {
+  auto &promise = lexer.handle.promise();
+  for (;;) {
+    if (cancelled)
+      throw Cancelled();
+    if (lexer.handle.done())
+      return {"EOF", "", consumed + pos};
+    lexer.handle.resume();
+    if (promise.produced) {
+      promise.produced = false;
+      lastToken = promise.token.offset;
+      return std::move(promise.token);
+    }
+    suspend();
+  }
+}
+
+Location ParseSession::locate(size_t offset) const {
+  return lines.locate(offset);
+}
+
+bool ParseSession::push(const char *data, size_t size) {
+  if (closed || status != PARSING) {
+    return status != FAILED;
+  }
+  // Keep the lines of the last token and a streamed Source's window back
+  size_t end = consumed + pending.size();
+  size_t window = Source::defaultWindow;
+  lines.forget(std::min(lastToken, end > window ? end - window : 0));
+  lines.add(data, size, end);
+  pending.erase(0, pos);
+  consumed += pos;
+  pos = 0;
+  pending.append(data, size);
+  resume();
+  return status != FAILED;
+}
+
+bool ParseSession::finish() {
+  closed = true;
+  if (status == PARSING)
+    resume();
+  if (status == PARSED && !installed) {
+    swapParserState(state);
+    installed = true;
+  }
+  return status == PARSED;
+}
@@ -0,0 +1,127 @@
+#ifndef PUSH_PARSER_HPP
+#define PUSH_PARSER_HPP
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <string>
+#include <ucontext.h>
+
+#include "lexer.hpp"
+#include "line_index.hpp"
+#include "syntax_analyzer.hpp"
+
+// Coroutine handle for the push lexer. It suspends when it has produced a
+// token and when it has run out of input in the middle of one.
+struct LexTask {
+  struct promise_type {
+    TokenResult token;
+    bool produced = false;
+
+    LexTask get_return_object() {
+      return LexTask(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    std::suspend_always yield_value(const TokenResult &t) {
+      token = t;
+      produced = true;
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { throw; }
+  };
+
+  explicit LexTask(std::coroutine_handle<promise_type> h) : handle(h) {}
+  LexTask(LexTask &&other) noexcept : handle(other.handle) {
+    other.handle = nullptr;
+  }
+  LexTask(const LexTask &) = delete;
+  LexTask &operator=(const LexTask &) = delete;
+  ~LexTask() {
+    if (handle)
+      handle.destroy();
+  }
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+// One resumable parse. The caller pushes the source in chunks of any size
+// and nothing blocks: the lexer suspends when it runs out of input in the
+// middle of a token, and Rat25S() runs on the session's own stack, taking
+// each token as it is lexed and suspending with it when the lexer needs
+// more. Its trace and results are those of the pull-based parser.
+//
+// Only the unlexed input and the line starts of about the last window of
+// a streamed Source are held, so offsets can be located as far back as the
+// pull-based parser can; a syntax error stops the session at the chunk
+// that shows it. The parser's state is
+// swapped in only while the session runs, so any number of sessions can be
+// pushed to in any order, all on one thread.
+class ParseSession : private TokenFeed {
+public:
+  ParseSession();
+  ~ParseSession();
+  ParseSession(const ParseSession &) = delete;
+  ParseSession &operator=(const ParseSession &) = delete;
+
+  // False once a syntax error has been found; chunks after it are ignored
+  bool push(const char *data, size_t size);
+  bool push(const std::string &chunk) {
+    return push(chunk.data(), chunk.size());
+  }
+
+  // End of input. Returns false and sets errorMessage() on a syntax error;
+  // otherwise the parse is left in the globals, as parseSource() leaves it.
+  bool finish();
+
+  const std::string &errorMessage() const { return message; }
+
+private:
+  // Awaitable that yields the next input character, or -1 at end of input
+  struct NextChar {
+    ParseSession *session;
+    bool consume;
+
+    bool await_ready() const {
+      return session->pos < session->pending.size() || session->closed;
+    }
+    void await_suspend(std::coroutine_handle<>) const {}
+    int await_resume() const;
+  };
+
+  NextChar get() { return {this, true}; }
+  NextChar peek() { return {this, false}; }
+
+  LexTask lex();
+
+  // TokenFeed, called by the parser on the session's stack
+  TokenResult next() override;
+  Location locate(size_t offset) const override;
+  bool locatesAll() const override { return false; }
+
+  static void run(unsigned high, unsigned low);
+  void resume();
+  void suspend();
+
+  std::string pending; // unconsumed input
+  size_t pos = 0;
+  size_t consumed = 0; // offset of pending[0] in the whole input
+  bool closed = false;
+  LineIndex lines;     // from the line of the last token lexed, at least
+  size_t lastToken = 0; // offset of the last token given to the parser
+  std::string message;
+  LexTask lexer;
+
+  enum { PARSING, PARSED, FAILED } status = PARSING;
+  bool started = false;
+  bool cancelled = false;     // unwind the parse, for the destructor
+  bool installed = false;     // finish() has put the parse in the globals
+  std::exception_ptr failure; // anything but a syntax error
+  ParserState state;          // the parse's globals while it is set aside
+  ucontext_t parserContext;
+  ucontext_t callerContext;
+  void *stack = nullptr;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <unistd.h>
+
+#include "runtime_io.hpp"
+
+static bool blank(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+InputBuffer::InputBuffer(std::string_view data)
+    : cur(data.data()), end(data.data() + data.size()), eof(true) {}
+
+InputBuffer::InputBuffer(int fd) : fd(fd), storage(blockSize) {
+  cur = end = storage.data();
+}
+
+InputBuffer::InputBuffer(std::istream &in) : stream(&in), storage(blockSize) {
+  cur = end = storage.data();
+}
+
+// Keep what is left, move it to the front and read after it; false at the
+// end of input
+bool InputBuffer::refill() {
+  if (eof)
+    return false;
+  size_t from = cur - storage.data(), kept = end - cur;
+  if (kept == storage.size())
+    storage.resize(storage.size() * 2);
+  std::memmove(storage.data(), storage.data() + from, kept);
+  char *at = storage.data() + kept;
+  size_t room = storage.size() - kept;
+  ssize_t got;
+  if (stream != nullptr) {
+    stream->read(at, room);
+    got = stream->gcount();
+  } else {
+    do {
+      got = read(fd, at, room);
+    } while (got < 0 && errno == EINTR);
+  }
+  if (got <= 0) {
+    eof = true;
+    got = 0;
+  }
+  cur = storage.data();
+  end = at + got;
+  return got > 0;
+}
+
+bool InputBuffer::skipBlanks() {
+  for (;;) {
+    while (cur < end && blank(*cur))
+      cur++;
+    if (cur < end)
+      return true;
+    if (!refill())
+      return false;
+  }
+}
+
+// Make sure the whole word at `cur` is buffered
+void InputBuffer::fillWord() {
+  for (size_t scanned = 0;;) {
+    const char *c = cur + scanned;
+    while (c < end && !blank(*c))
+      c++;
+    if (c < end || eof)
+      return;
+    scanned = c - cur;
+    if (!refill())
+      return;
+  }
+}
+
+bool InputBuffer::scanInteger(int64_t &value) {
+  if (!skipBlanks())
+    return false;
+  fillWord();
+  const char *first = cur;
+  if (first < end && *first == '+')
+    first++;
+  auto [ptr, ec] = std::from_chars(first, end, value);
+  if (ec != std::errc() || (first != cur && *first == '-'))
+    return false;
+  cur = ptr;
+  return true;
+}
+
+bool InputBuffer::scanReal(double &value) {
+  if (!skipBlanks())
+    return false;
+  fillWord();
+  const char *first = cur;
+  if (first < end && *first == '+')
+    first++;
+  auto [ptr, ec] = std::from_chars(first, end, value);
+  if (ec != std::errc() || (first != cur && *first == '-'))
+    return false;
+  cur = ptr;
+  return true;
+}
+
+bool InputBuffer::scanBoolean(int64_t &value) {
+  if (!skipBlanks())
+    return false;
+  fillWord();
+  const char *word = cur;
+  while (word < end && !blank(*word))
+    word++;
+  std::string_view text(cur, word - cur);
+  if (text == "true" || text == "1") {
+    value = 1;
+  } else if (text == "false" || text == "0") {
+    value = 0;
+  } else {
+    return false;
+  }
+  cur = word;
+  return true;
+}
+
+OutputBuffer::OutputBuffer(int fd, bool binary)
+    : fd(fd), binary(binary), storage(bufferSize) {
+  cur = storage.data();
+  limit = cur + storage.size();
+}
+
+OutputBuffer::OutputBuffer(std::ostream &out, bool binary)
+    : stream(&out), binary(binary), storage(bufferSize) {
+  cur = storage.data();
+  limit = cur + storage.size();
+}
+
+OutputBuffer::OutputBuffer(std::string &text, bool binary)
+    : text(&text), binary(binary), storage(bufferSize) {
+  cur = storage.data();
+  limit = cur + storage.size();
+}
+
+void OutputBuffer::writeBinary(const void *value) {
+  std::memcpy(reserve(8), value, 8);
+  cur += 8;
+}
+
+void OutputBuffer::printInteger(int64_t value) {
+  if (binary)
+    return writeBinary(&value);
+  char *at = reserve(24);
+  at = std::to_chars(at, limit, value).ptr;
+  *at++ = '\n';
+  cur = at;
+}
+
+void OutputBuffer::printReal(double value) {
+  if (binary)
+    return writeBinary(&value);
+  char *at = reserve(40);
+  at = std::to_chars(at, limit, value).ptr;
+  *at++ = '\n';
+  cur = at;
+}
+
+void OutputBuffer::printBoolean(int64_t value) {
+  if (binary)
+    return writeBinary(&value);
+  char *at = reserve(8);
+  at = stpcpy(at, value ? "true\n" : "false\n");
+  cur = at;
+}
+
+void OutputBuffer::flush() {
+  const char *data = storage.data();
+  size_t size = cur - data;
+  cur = storage.data();
+  if (size == 0)
+    return;
+  if (text != nullptr) {
+    text->append(data, size);
+  } else if (stream != nullptr) {
+    stream->write(data, size);
+    stream->flush();
+  } else {
+    while (size > 0) {
+      ssize_t written = write(fd, data, size);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0)
+        return; // nowhere to report it; like a closed stdout
+      data += written;
+      size -= written;
+    }
+  }
+}
@@ -0,0 +1,81 @@
+#ifndef RUNTIME_IO_HPP
+#define RUNTIME_IO_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Input of scan: numbers are parsed with from_chars straight out of a
+// large buffer. The buffer is a whole input in memory, or is refilled from
+// a file descriptor or stream in blocks; a value that straddles two blocks
+// is moved to the front before parsing. Like stream extraction, a number
+// ends at the first character that cannot continue it.
+class InputBuffer {
+public:
+  static const size_t blockSize = 1 << 16;
+
+  explicit InputBuffer(std::string_view data);
+  explicit InputBuffer(int fd);
+  explicit InputBuffer(std::istream &in);
+
+  // Each returns false, consuming nothing more, when the input does not
+  // start (after blanks) with a value of that type
+  bool scanInteger(int64_t &value);
+  bool scanReal(double &value);
+  bool scanBoolean(int64_t &value); // true, false, 1 or 0
+
+private:
+  bool refill();
+  bool skipBlanks();
+  void fillWord();
+
+  int fd = -1;
+  std::istream *stream = nullptr;
+  std::vector<char> storage;
+  const char *cur;
+  const char *end;
+  bool eof = false;
+};
+
+// Output of print: values are formatted with to_chars into a large buffer
+// that goes out in bulk when full and on flush(). In binary mode each
+// value is written as its 8 bytes instead (booleans as 0 or 1) and records
+// carry no separators.
+class OutputBuffer {
+public:
+  static const size_t bufferSize = 1 << 16;
+
+  explicit OutputBuffer(int fd, bool binary = false);
+  explicit OutputBuffer(std::ostream &out, bool binary = false);
+  explicit OutputBuffer(std::string &text, bool binary = false);
+  ~OutputBuffer() { flush(); }
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+  void printInteger(int64_t value);
+  void printReal(double value);
+  void printBoolean(int64_t value);
+  void flush();
+
+private:
+  char *reserve(size_t size) {
+    if (size_t(limit - cur) < size)
+      flush();
+    return cur;
+  }
+  void writeBinary(const void *value);
+
+  int fd = -1;
+  std::ostream *stream = nullptr;
+  std::string *text = nullptr;
+  bool binary;
+  std::vector<char> storage;
+  char *cur;
+  char *limit;
+};
+
+#endif
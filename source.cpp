@@ -0,0 +1,49 @@
+#include <cerrno>
+#include <unistd.h>
+
+#include "source.hpp"
+
+Source::Source(int fd, size_t windowSize)
+    : fd(fd), window(windowSize), base(window.data()), cur(base), end(base) {}
+
+Source::Source(const char *data, size_t size, size_t offset, Location at)
+    : fd(-1), base(data), cur(data), end(data + size), windowOffset(offset),
+      lines(offset - (at.column - 1), at.line) {}
+
+Location Source::locate(size_t offset) {
+  if (!indexed) {
+    lines.add(base, end - base, windowOffset);
+    indexed = true;
+  }
+  return lines.locate(offset);
+}
+
+// Replace the window with the next block of input. Returns false at end of
+// input or on a read error.
+bool Source::refill() {
+  if (fd < 0) {
+    return false;
+  }
+  // Newlines in the outgoing window are counted in bulk, not per character
+  if (indexed) {
+    lines.advance(nullptr, 0, windowOffset);
+  } else {
+    lines.advance(base, end - base, windowOffset);
+  }
+  windowOffset += end - base;
+  indexed = false;
+
+  ssize_t n;
+  do {
+    n = read(fd, window.data(), window.size());
+  } while (n < 0 && errno == EINTR);
+
+  if (n <= 0) {
+    fd = -1;
+    cur = end = base;
+    return false;
+  }
+  cur = base;
+  end = cur + n;
+  return true;
+}
@@ -0,0 +1,59 @@
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "line_index.hpp"
+
+// Input for lexer(). Reads a file descriptor in large blocks into a
+// fixed-size window, so memory stays constant however long the input is
+// (pipes included), or serves an in-memory buffer directly. The lexer only
+// needs one character of lookahead, so nothing before the current position
+// is ever kept.
+class Source {
+public:
+  static const size_t defaultWindow = 1 << 16;
+
+  explicit Source(int fd, size_t windowSize = defaultWindow);
+  // An in-memory buffer that starts at `offset` and `at` in a larger input
+  Source(const char *data, size_t size, size_t offset = 0,
+         Location at = {1, 1});
+
+  // Next character, or -1 at end of input
+  int get() {
+    if (cur == end && !refill())
+      return -1;
+    return static_cast<unsigned char>(*cur++);
+  }
+
+  int peek() {
+    if (cur == end && !refill())
+      return -1;
+    return static_cast<unsigned char>(*cur);
+  }
+
+  // Byte offset of the next character in the whole input
+  size_t offset() const { return windowOffset + (cur - base); }
+
+  // Line and column of an offset in the current window, or of a token that
+  // started just before it. The window is indexed on the first call.
+  Location locate(size_t offset);
+
+  // The whole input is in memory, so locate() is exact for any offset
+  bool inMemory() const { return window.empty(); }
+
+private:
+  bool refill();
+
+  int fd;
+  std::vector<char> window;
+  const char *base; // start of the current window
+  const char *cur;
+  const char *end;
+  size_t windowOffset = 0;
+  LineIndex lines;
+  bool indexed = false; // lines holds the current window's line starts
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <cstring>
+
+#include "string_table.hpp"
+
+StringTable identifiers;
+
+static const size_t arenaBlock = 1 << 16;
+
+StringTable::StringTable() : slots(1024, 0) { intern(""); }
+
+// FNV-1a
+uint64_t StringTable::hash(std::string_view text) {
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c : text) {
+    h ^= c;
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+// Copy text into the arena. Names longer than a block get their own block.
+const char *StringTable::store(std::string_view text) {
+  if (text.empty()) {
+    return "";
+  }
+  if (blockUsed + text.size() > blockSize) {
+    blockSize = std::max(arenaBlock, text.size());
+    blocks.emplace_back(new char[blockSize]);
+    blockUsed = 0;
+  }
+  char *dest = blocks.back().get() + blockUsed;
+  memcpy(dest, text.data(), text.size());
+  blockUsed += text.size();
+  return dest;
+}
+
+// Double the slot array, keeping the load factor under one half
+void StringTable::grow() {
+  std::vector<uint32_t> bigger(slots.size() * 2, 0);
+  size_t mask = bigger.size() - 1;
+  for (uint32_t id = 0; id < names.size(); id++) {
+    size_t i = hashes[id] & mask;
+    while (bigger[i] != 0)
+      i = (i + 1) & mask;
+    bigger[i] = id + 1;
+  }
+  slots.swap(bigger);
+}
+
+uint32_t StringTable::intern(std::string_view text) {
+  uint64_t h = hash(text);
+  size_t mask = slots.size() - 1;
+  size_t i = h & mask;
+  while (slots[i] != 0) {
+    uint32_t id = slots[i] - 1;
+    if (hashes[id] == h && names[id] == text)
+      return id;
+    i = (i + 1) & mask;
+  }
+
+  uint32_t id = names.size();
+  names.emplace_back(store(text), text.size());
+  hashes.push_back(h);
+  slots[i] = id + 1;
+  if (names.size() * 2 > slots.size())
+    grow();
+  return id;
+}
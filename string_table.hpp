@@ -0,0 +1,38 @@
+#ifndef STRING_TABLE_HPP
+#define STRING_TABLE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Interns strings to dense 32-bit IDs. Lookup is an open-addressing hash
+// with linear probing; the text lives in large arena blocks, so interning
+// a name allocates nothing once its block has room. ID 0 is the empty
+// string.
+class StringTable {
+public:
+  StringTable();
+  StringTable(const StringTable &) = delete;
+  StringTable &operator=(const StringTable &) = delete;
+
+  uint32_t intern(std::string_view text);
+  std::string_view name(uint32_t id) const { return names[id]; }
+  size_t size() const { return names.size(); }
+
+private:
+  static uint64_t hash(std::string_view text);
+  void grow();
+  const char *store(std::string_view text);
+
+  std::vector<uint32_t> slots; // ID + 1, 0 for an empty slot
+  std::vector<uint64_t> hashes;
+  std::vector<std::string_view> names;
+  std::vector<std::unique_ptr<char[]>> blocks;
+  size_t blockUsed = 0;
+  size_t blockSize = 0;
+};
+
+extern StringTable identifiers;
+
+#endif
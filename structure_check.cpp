@@ -0,0 +1,142 @@
+#include <vector>
+
+#include "structure_check.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const size_t noEnd = size_t(-1);
+
+// Offset just past the "*]" that closes a comment whose text starts at i,
+// or noEnd
+static size_t commentEnd(const char *data, size_t size, size_t i) {
+#ifdef __SSE2__
+  const __m128i star = _mm_set1_epi8('*');
+  const __m128i close = _mm_set1_epi8(']');
+  for (; i + 17 <= size; i += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    __m128i next =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 1));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(block, star), _mm_cmpeq_epi8(next, close)));
+    if (mask)
+      return i + __builtin_ctz(mask) + 2;
+  }
+#endif
+  for (; i + 1 < size; i++) {
+    if (data[i] == '*' && data[i + 1] == ']')
+      return i + 2;
+  }
+  return noEnd;
+}
+
+// Offset of the innermost `open` left unclosed at the end, found by walking
+// again with a stack of openers once the counts show there is one
+static size_t innermostUnclosed(const char *data, size_t size, char open,
+                                char close) {
+  std::vector<size_t> openers;
+  for (size_t i = 0; i < size; i++) {
+    if (data[i] == '[' && i + 1 < size && data[i + 1] == '*') {
+      size_t after = commentEnd(data, size, i + 2);
+      if (after == noEnd)
+        break;
+      i = after - 1;
+    } else if (data[i] == open) {
+      openers.push_back(i);
+    } else if (data[i] == close && !openers.empty()) {
+      openers.pop_back();
+    }
+  }
+  return openers.empty() ? size : openers.back();
+}
+
+// Blocks of 16 bytes without markers, comments or a possible unmatched
+// closer only move the bracket depths, by popcounts of the bracket masks;
+// any other block is walked a byte at a time with the lexer's rules.
+bool checkStructure(const char *data, size_t size, bool parentheses,
+                    StructureError &error) {
+  long braces = 0;
+  long parens = 0;
+  size_t markers = 0;
+  size_t extraMarker = size; // offset of a fifth marker
+  size_t i = 0;
+
+  while (i < size) {
+#ifdef __SSE2__
+    for (; i + 17 <= size; i += 16) {
+      __m128i block =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+      __m128i next =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 1));
+      unsigned special = _mm_movemask_epi8(_mm_or_si128(
+          _mm_cmpeq_epi8(block, _mm_set1_epi8('$')),
+          _mm_and_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('[')),
+                        _mm_cmpeq_epi8(next, _mm_set1_epi8('*')))));
+      if (special)
+        break;
+      int openBraces = __builtin_popcount(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('{'))));
+      int closeBraces = __builtin_popcount(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('}'))));
+      int openParens = __builtin_popcount(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('('))));
+      int closeParens = __builtin_popcount(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(')'))));
+      if (braces < closeBraces || (parentheses && parens < closeParens))
+        break;
+      braces += openBraces - closeBraces;
+      parens += openParens - closeParens;
+    }
+#endif
+    size_t end = i + 16 < size ? i + 16 : size;
+    while (i < end) {
+      char c = data[i];
+      if (c == '[' && i + 1 < size && data[i + 1] == '*') {
+        size_t after = commentEnd(data, size, i + 2);
+        // One after the last marker just runs to the end, as in lexer()
+        if (after == noEnd && markers < 4) {
+          error = {"Unterminated comment", i};
+          return false;
+        }
+        i = after == noEnd ? size : after;
+        break;
+      }
+      if (c == '$' && i + 1 < size && data[i + 1] == '$') {
+        if (++markers == 5)
+          extraMarker = i;
+        i += 2;
+        continue;
+      }
+      if (c == '{') {
+        braces++;
+      } else if (c == '}' && --braces < 0) {
+        error = {"Unmatched }", i};
+        return false;
+      } else if (c == '(') {
+        parens++;
+      } else if (c == ')' && --parens < 0 && parentheses) {
+        error = {"Unmatched )", i};
+        return false;
+      }
+      i++;
+    }
+  }
+
+  if (markers != 4) {
+    error = {"Expected 4 $$ section markers, found " + std::to_string(markers),
+             extraMarker};
+    return false;
+  }
+  if (braces > 0) {
+    error = {std::to_string(braces) + " unclosed {",
+             innermostUnclosed(data, size, '{', '}')};
+    return false;
+  }
+  if (parentheses && parens > 0) {
+    error = {std::to_string(parens) + " unclosed (",
+             innermostUnclosed(data, size, '(', ')')};
+    return false;
+  }
+  return true;
+}
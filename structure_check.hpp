@@ -0,0 +1,21 @@
+#ifndef STRUCTURE_CHECK_HPP
+#define STRUCTURE_CHECK_HPP
+
+#include <cstddef>
+#include <string>
+
+struct StructureError {
+  std::string message;
+  size_t offset;
+};
+
+// What every program has, checked on the raw bytes before lexing: four $$
+// section markers and balanced braces outside comments, no unterminated
+// comment, and with `parentheses` set balanced parentheses too (lazily
+// skipped bodies are never lexed, so theirs may not be). A text that fails
+// would fail to parse; one that passes may still have syntax errors. An
+// unclosed bracket is reported at the innermost one left open.
+bool checkStructure(const char *data, size_t size, bool parentheses,
+                    StructureError &error);
+
+#endif
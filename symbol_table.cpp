@@ -0,0 +1,155 @@
+#include <algorithm>
+
+#include "string_table.hpp"
+#include "symbol_table.hpp"
+
+SymbolTable symbolTable;
+
+static std::string quoted(uint32_t name) {
+  return "'" + std::string(identifiers.name(name)) + "'";
+}
+
+int SymbolTable::binding(const std::vector<int> &bindings, uint32_t name) {
+  return name < bindings.size() ? bindings[name] : -1;
+}
+
+void SymbolTable::bind(std::vector<int> &bindings, uint32_t name, int symbol) {
+  if (name >= bindings.size())
+    bindings.resize(std::max<size_t>(name + 1, bindings.size() * 2), -1);
+  bindings[name] = symbol;
+}
+
+void SymbolTable::report(size_t offset, const std::string &message,
+                         bool fatal) {
+  problems.push_back(
+      {locate ? locate(offset) : Location{0, 0}, message, fatal});
+}
+
+void SymbolTable::clear() {
+  table.clear();
+  refs.clear();
+  kept.clear();
+  problems.clear();
+  globals.clear();
+  locals.clear();
+  current = -1;
+  sealed = false;
+}
+
+int SymbolTable::beginFunction(uint32_t name, size_t offset) {
+  int symbol = table.size();
+  if (binding(globals, name) >= 0) {
+    report(offset, "duplicate declaration of " + quoted(name));
+  } else {
+    bind(globals, name, symbol);
+  }
+  table.push_back({name, FUNCTION_SYMBOL, "", offset, -1});
+  current = symbol;
+  return symbol;
+}
+
+// Open a function scope again, for a lazily expanded body
+void SymbolTable::reopenFunction(int function) {
+  current = function;
+  for (int member : table[function].members)
+    bind(locals, table[member].name, member);
+}
+
+void SymbolTable::endFunction() {
+  if (current < 0)
+    return;
+  for (int member : table[current].members)
+    locals[table[member].name] = -1;
+  current = -1;
+}
+
+void SymbolTable::declare(uint32_t name, const std::string &type,
+                          bool parameter, size_t offset) {
+  int symbol = table.size();
+  std::vector<int> &scope = current >= 0 ? locals : globals;
+  if (binding(scope, name) >= 0) {
+    report(offset, "duplicate declaration of " + quoted(name));
+    return;
+  }
+  bind(scope, name, symbol);
+
+  SymbolKind kind = current < 0   ? GLOBAL_SYMBOL
+                    : parameter ? PARAMETER_SYMBOL
+                                : LOCAL_SYMBOL;
+  table.push_back({name, kind, type, offset, current});
+  if (current >= 0) {
+    table[current].members.push_back(symbol);
+    if (parameter)
+      table[current].parameters++;
+  }
+}
+
+int SymbolTable::lookup(uint32_t name, int function) const {
+  if (function >= 0) {
+    for (int member : table[function].members) {
+      if (table[member].name == name)
+        return member;
+    }
+  }
+  return binding(globals, name);
+}
+
+void SymbolTable::reference(uint32_t name, ReferenceKind kind, size_t offset,
+                            int arity) {
+  int symbol = current >= 0 ? binding(locals, name) : -1;
+  if (symbol < 0)
+    symbol = binding(globals, name);
+  Reference ref = {name, kind, offset, {0, 0}, current, arity, symbol};
+  if (symbol >= 0 || sealed) {
+    check(ref);
+    if (keepReferences)
+      kept.push_back(ref);
+    return;
+  }
+  // Its source window may be gone by the time resolve() runs
+  if (locate)
+    ref.at = locate(offset);
+  refs.push_back(ref);
+}
+
+// Check a reference against the symbol it resolved to
+void SymbolTable::check(Reference &ref) {
+  std::string message;
+  if (ref.symbol < 0) {
+    message = "undeclared identifier " + quoted(ref.name);
+  } else {
+    const Symbol &symbol = table[ref.symbol];
+    if (ref.kind == CALL_REFERENCE && symbol.kind != FUNCTION_SYMBOL) {
+      message = quoted(ref.name) + " is not a function";
+    } else if (ref.kind == CALL_REFERENCE && ref.arity != symbol.parameters) {
+      message = quoted(ref.name) + " expects " +
+                std::to_string(symbol.parameters) + " argument(s), got " +
+                std::to_string(ref.arity);
+    } else if (ref.kind != CALL_REFERENCE && symbol.kind == FUNCTION_SYMBOL) {
+      message = "function " + quoted(ref.name) + " used as a variable";
+    }
+  }
+
+  if (message.empty()) {
+    return;
+  }
+  if (ref.at.line > 0) {
+    problems.push_back({ref.at, message, false});
+  } else {
+    report(ref.offset, message);
+  }
+}
+
+// All globals are declared: resolve the references function bodies made
+// to globals and to functions defined after them
+void SymbolTable::resolve() {
+  for (Reference &ref : refs) {
+    ref.symbol = binding(globals, ref.name);
+    check(ref);
+    if (keepReferences)
+      kept.push_back(ref);
+  }
+  refs.clear();
+  refs.shrink_to_fit();
+  sealed = true;
+}
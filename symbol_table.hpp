@@ -0,0 +1,99 @@
+#ifndef SYMBOL_TABLE_HPP
+#define SYMBOL_TABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "line_index.hpp"
+
+enum SymbolKind { FUNCTION_SYMBOL, GLOBAL_SYMBOL, PARAMETER_SYMBOL, LOCAL_SYMBOL };
+
+enum ReferenceKind { ASSIGN_REFERENCE, READ_REFERENCE, CALL_REFERENCE, SCAN_REFERENCE };
+
+struct Symbol {
+  uint32_t name;       // interned identifier
+  SymbolKind kind;
+  std::string type;    // qualifier; empty for functions
+  size_t offset;       // where it is declared
+  int function;        // owning function symbol, -1 for the global scope
+  std::vector<int> members; // parameters then locals, for functions
+  int parameters = 0;  // arity, for functions
+};
+
+struct Reference {
+  uint32_t name;
+  ReferenceKind kind;
+  size_t offset;
+  Location at;  // only set for references kept until resolve()
+  int function; // function the reference is in, -1 for the main program
+  int arity;    // argument count, for calls
+  int symbol;   // resolved symbol, -1 if unresolved
+};
+
+struct Diagnostic {
+  Location at;
+  std::string message;
+  bool fatal; // the program cannot be compiled; others only fail --check
+};
+
+// Symbols of one program. Globals and functions share the global scope;
+// each function has a scope of its parameters and locals. Bindings are
+// arrays indexed by interned ID, so every lookup is an integer index.
+//
+// Rat25S declares functions before globals, so a reference from a function
+// body that is not a parameter or local is kept until resolve() runs at the
+// end of the program. Everything after that resolves immediately. Only
+// those waiting references are held; each is dropped once checked, unless
+// keepReferences asks for the full list.
+class SymbolTable {
+public:
+  void clear();
+
+  int beginFunction(uint32_t name, size_t offset);
+  void reopenFunction(int function);
+  void endFunction();
+
+  void declare(uint32_t name, const std::string &type, bool parameter,
+               size_t offset);
+  void reference(uint32_t name, ReferenceKind kind, size_t offset,
+                 int arity = 0);
+  void resolve();
+
+  int lookup(uint32_t name, int function) const;
+
+  const std::vector<Symbol> &symbols() const { return table; }
+  // Every reference made since clear(), resolved; empty unless
+  // keepReferences was set first
+  const std::vector<Reference> &references() const { return kept; }
+  const std::vector<Diagnostic> &diagnostics() const { return problems; }
+
+  // Add a diagnostic for the input at offset
+  void report(size_t offset, const std::string &message, bool fatal = false);
+
+  // Resolves offsets to locations, only called for diagnostics and for
+  // references kept until resolve()
+  Location (*locate)(size_t offset) = nullptr;
+
+  // Keep each reference after it is checked, for references()
+  bool keepReferences = false;
+
+private:
+  static int binding(const std::vector<int> &bindings, uint32_t name);
+  static void bind(std::vector<int> &bindings, uint32_t name, int symbol);
+  void check(Reference &ref);
+
+  std::vector<Symbol> table;
+  std::vector<Reference> refs; // waiting for resolve()
+  std::vector<Reference> kept; // all, with keepReferences
+  std::vector<Diagnostic> problems;
+  std::vector<int> globals; // symbol bound to each ID, or -1
+  std::vector<int> locals;  // same, for the open function
+  int current = -1;         // open function symbol
+  bool sealed = false;      // all globals are declared
+};
+
+extern SymbolTable symbolTable;
+
+#endif
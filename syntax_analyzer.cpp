@@ -1,90 +1,476 @@
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 
 #include "lexer.hpp"
 #include "syntax_analyzer.hpp"
+#include "trace.hpp"
 
 TokenResult currentToken;
-const bool debug = true; // For debugging output
-int line_number = 1;
+bool debug = true; // For debugging output
+bool showExpressions = false; // Print each statement's folded expressions
+Source stdinSource(0);
+Source *input = &stdinSource; // Source the lexer reads from
+
+bool lazyBodies = false; // Skip function bodies until ExpandBody() is called
+std::vector<FunctionHeader> functionHeaders;
+
+// Keep statement trees in `program`; off, they are dropped as soon as they
+// are parsed so memory does not grow with the input
+bool keepProgram = false;
+Program program;
+
+// Gives the tokens instead of the lexer when set, by parseFeed()
+static TokenFeed *feed = nullptr;
+
+// Recent trace events, kept when the full trace is off; written out when
+// error() fires or by writeFlightRecord()
+TraceRing flightRecorder;
+static int ruleDepth = 0; // grammar rule calls in progress
+
+// Inlined even at -O0: every rule call pays for it
+struct RuleScope {
+  [[gnu::always_inline]] RuleScope() { ruleDepth++; }
+  [[gnu::always_inline]] ~RuleScope() { ruleDepth--; }
+};
+
+// Printing or recording; set by Rat25S()
+static bool tracing = false;
+
+bool cacheFunctions = false;
+FunctionCache functionCache;
+
+// Tokens Function() read ahead, handed out by nextToken() first
+static std::vector<TokenResult> pushedBack;
+static size_t pushedBackPos = 0;
+
+// Offsets of the tokens of the function span Function() read ahead
+static std::vector<size_t> spanOffsets;
+
+// The function being parsed into a cache entry, and the rule depth of its
+// Function() call
+static CachedFunction *capture = nullptr;
+static int captureDepth = 0;
+
+// Index of a token of the span from its offset
+static size_t spanToken(size_t offset) {
+  return std::lower_bound(spanOffsets.begin(), spanOffsets.end(), offset) -
+         spanOffsets.begin();
+}
+
+// Print or record a reduced production
+static void reduce(const char *production) {
+  if (capture)
+    capture->trace.push_back(
+        {TraceItem::PRODUCTION, uint16_t(ruleDepth - captureDepth), production});
+  if (debug)
+    std::cout << production;
+  if (flightRecorder.enabled())
+    flightRecorder.recordProduction(production);
+}
+
+static void traceToken(const TokenResult &token) {
+  if (capture)
+    capture->trace.push_back(
+        {TraceItem::TOKEN, uint16_t(ruleDepth - captureDepth)});
+  if (debug)
+    std::cout << "Token: " << token.token << "\tLexeme: " << token.lexeme
+              << '\n';
+  if (flightRecorder.enabled())
+    flightRecorder.recordToken(token);
+}
+
+void writeFlightRecord(std::ostream &out) { flightRecorder.write(out); }
 
 // Get the next token from the lexer
-void nextToken() { currentToken = lexer(std::cin); }
+void nextToken() {
+  if (pushedBackPos < pushedBack.size()) {
+    currentToken = std::move(pushedBack[pushedBackPos++]);
+    return;
+  }
+  if (feed != nullptr) {
+    currentToken = feed->next();
+    return;
+  }
+  currentToken = lexer(*input);
+}
+
+// Line and column of an offset in the input being parsed. Only resolved
+// for diagnostics, and only reliable for recent tokens when streaming.
+Location locateOffset(size_t offset) {
+  if (feed != nullptr) {
+    return feed->locate(offset);
+  }
+  return input->locate(offset);
+}
+
+Location currentLocation() { return locateOffset(currentToken.offset); }
 
-// Error handling: print an error message and exit
+// Error handling: throw the formatted message, main() prints it and exits
 void error(const std::string &msg) {
-  std::cerr << "Syntax error: " << msg << " @ line "<< std::to_string(line_number) << ", token: " << currentToken.lexeme
-            << '\n';
-  exit(1);
+  Location at = currentLocation();
+  if (flightRecorder.enabled()) {
+    std::cerr << "Parser trace before the error:\n";
+    writeFlightRecord(std::cerr);
+  }
+  throw SyntaxError("Syntax error: " + msg + " @ line " +
+                    std::to_string(at.line) + ", column " +
+                    std::to_string(at.column) +
+                    ", token: " + currentToken.lexeme);
+}
+
+// Parse a whole program from a source, starting from a clean state
+void parseSource(Source &source) {
+  Source *savedInput = input;
+  input = &source;
+  functionHeaders.clear();
+  program = Program();
+  symbolTable.clear();
+  flightRecorder.clear();
+  pushedBack.clear();
+  pushedBackPos = 0;
+  try {
+    nextToken();
+    Rat25S();
+  } catch (...) {
+    input = savedInput;
+    throw;
+  }
+  input = savedInput;
+}
+
+// Run Rat25S() over the tokens a feed gives
+void parseFeed(TokenFeed &tokens) {
+  feed = &tokens;
+  functionHeaders.clear();
+  program = Program();
+  symbolTable.clear();
+  flightRecorder.clear();
+  pushedBack.clear();
+  pushedBackPos = 0;
+  try {
+    nextToken();
+    Rat25S();
+  } catch (...) {
+    feed = nullptr;
+    throw;
+  }
+  feed = nullptr;
+}
+
+// Replays a token vector, then EOF for good
+namespace {
+class ReplayFeed : public TokenFeed {
+public:
+  ReplayFeed(const std::vector<TokenResult> &tokens, const LineIndex &lines)
+      : tokens(tokens), lines(lines) {}
+
+  TokenResult next() override {
+    if (pos < tokens.size())
+      return tokens[pos++];
+    return {"EOF", "", currentToken.offset};
+  }
+  Location locate(size_t offset) const override {
+    return lines.locate(offset);
+  }
+
+private:
+  const std::vector<TokenResult> &tokens;
+  const LineIndex &lines;
+  size_t pos = 0;
+};
+} // namespace
+
+// Run Rat25S() over an already lexed token stream
+void parseTokens(const std::vector<TokenResult> &tokens,
+                 const LineIndex &lines) {
+  ReplayFeed replay(tokens, lines);
+  parseFeed(replay);
+}
+
+ParserState::ParserState() {
+  // A parse set aside keeps its own recorder, as large as the global one
+  flightRecorder.resize(::flightRecorder.limit());
+}
+
+void swapParserState(ParserState &state) {
+  std::swap(currentToken, state.currentToken);
+  std::swap(feed, state.feed);
+  std::swap(functionHeaders, state.functionHeaders);
+  std::swap(program, state.program);
+  std::swap(symbolTable, state.symbols);
+  std::swap(flightRecorder, state.flightRecorder);
+  std::swap(ruleDepth, state.ruleDepth);
+  std::swap(tracing, state.tracing);
+  std::swap(pushedBack, state.pushedBack);
+  std::swap(pushedBackPos, state.pushedBackPos);
+  std::swap(spanOffsets, state.spanOffsets);
+  std::swap(capture, state.capture);
+  std::swap(captureDepth, state.captureDepth);
 }
 
 // Match the expected token and advance the token stream
 void match(TokenResult expected) {
   if (currentToken.token == expected.token &&
       (expected.lexeme == "" || currentToken.lexeme == expected.lexeme)) {
-    std::cout << "Token: " << currentToken.token
-              << "\tLexeme: " << currentToken.lexeme << '\n';
+    if (tracing)
+      traceToken(currentToken);
     nextToken();
   } else {
-    error("At line " + std::to_string(line_number) + " Expected " +
+    error("At line " + std::to_string(currentLocation().line) + " Expected " +
           expected.token +
           (expected.lexeme != "" ? (" " + expected.lexeme) : "") +
           " but found " + currentToken.token + " " + currentToken.lexeme);
   }
 }
 
+static void printExpression(const std::string &text) {
+  std::cout << "Expression: " << text << '\n';
+}
+
+// Print an expression a statement received, after folding
+void showExpression(const ExprPtr &e) {
+  if (showExpressions) {
+    std::string text = exprToString(*e);
+    if (capture) {
+      capture->trace.push_back({TraceItem::EXPRESSION, 0, nullptr,
+                                uint32_t(capture->expressions.size())});
+      capture->expressions.push_back(text);
+    }
+    printExpression(text);
+  }
+}
+
+// Symbol table calls, journaled while a function is captured so a reuse
+// makes the same ones
+static void declareName(const TokenResult &name, const std::string &qualifier,
+                        bool parameter) {
+  if (capture) {
+    SymbolCall call{SymbolCall::DECLARE, parameter};
+    call.name = name.id;
+    call.token = spanToken(name.offset);
+    call.text = qualifier;
+    capture->symbols.push_back(std::move(call));
+  }
+  symbolTable.declare(name.id, qualifier, parameter, name.offset);
+}
+
+static void referenceName(uint32_t name, ReferenceKind kind, size_t offset,
+                          int arity = 0) {
+  if (capture) {
+    SymbolCall call{SymbolCall::REFERENCE, false, kind, arity, name};
+    call.token = spanToken(offset);
+    capture->symbols.push_back(std::move(call));
+  }
+  symbolTable.reference(name, kind, offset, arity);
+}
+
+// A literal that cannot be represented; the program cannot be compiled
+static void reportAt(size_t offset, const std::string &message) {
+  if (capture) {
+    SymbolCall call{SymbolCall::REPORT};
+    call.token = spanToken(offset);
+    call.text = message;
+    capture->symbols.push_back(std::move(call));
+  }
+  symbolTable.report(offset, message, true);
+}
+
 void Rat25S() {
+  RuleScope rule;
+  tracing = debug || flightRecorder.enabled();
+  symbolTable.locate = locateOffset;
   match({"Separator", "$$"});
   OptFunctDef();
   match({"Separator", "$$"});
   OptDeclarationList();
+  symbolTable.resolve(); // every global is declared now
   match({"Separator", "$$"});
-  StatementList();
+  program.statements = StatementList();
   match({"Separator", "$$"});
 
   if (currentToken.token != "EOF") {
     error("Expected EOF");
   }
-  if (debug)
-    std::cout << "<Rat25S> ::= $$ <Opt Function Definitions> $$ <Opt "
-                 "Declaration List> $$ <Statement List> $$\n";
+  if (tracing)
+    reduce("<Rat25S> ::= $$ <Opt Function Definitions> $$ <Opt "
+           "Declaration List> $$ <Statement List> $$\n");
 }
 
 // R2. <Opt Function Definitions> ::= <Function Definitions> | <Empty>
 void OptFunctDef() {
+  RuleScope rule;
   if (currentToken.token == "Keyword" && currentToken.lexeme == "function") {
     FunctionDefinition();
-    if (debug)
-      std::cout << "<Opt Function Definitions> ::= <Function Definitions>\n";
+    if (tracing)
+      reduce("<Opt Function Definitions> ::= <Function Definitions>\n");
 
   } else {
-    if (debug) {
-      std::cout << "<Opt Function Definitions> ::= <Empty>\n";
-    }
+    if (tracing)
+      reduce("<Opt Function Definitions> ::= <Empty>\n");
   }
 }
 
 // R3. <Function Definitions> ::= <Function> | <Function> <Function Definitions>
+// The right recursion is run as a loop so stack depth does not grow with
+// the input; the reductions are printed in the order the recursion would.
 void FunctionDefinition() {
-  Function();
-  if (currentToken.token == "Keyword" && currentToken.lexeme == "function") {
-    FunctionDefinition();
-    if (debug)
-      std::cout
-          << "<Function Definitions> ::= <Function> <Function Definitions>\n";
-  } else {
-    if (debug)
-      std::cout << "<Function Definitions> ::= <Function>\n";
+  RuleScope rule;
+  size_t count = 0;
+  do {
+    Function();
+    count++;
+  } while (currentToken.token == "Keyword" &&
+           currentToken.lexeme == "function");
+
+  if (tracing) {
+    reduce("<Function Definitions> ::= <Function>\n");
+    for (size_t i = 1; i < count; i++)
+      reduce("<Function Definitions> ::= <Function> <Function Definitions>\n");
+  }
+}
+
+// Hand tokens read ahead back to nextToken(), the first as currentToken
+static void pushBack(std::vector<TokenResult> tokens) {
+  pushedBack.erase(pushedBack.begin(), pushedBack.begin() + pushedBackPos);
+  pushedBack.insert(pushedBack.begin(),
+                    std::make_move_iterator(tokens.begin() + 1),
+                    std::make_move_iterator(tokens.end()));
+  pushedBackPos = 0;
+  currentToken = std::move(tokens[0]);
+}
+
+// Rebuild a cached function at the offsets of its span: the same symbol
+// table calls, trace and statement tree its own parse would make
+static void reuseFunction(const CachedFunction &entry, const std::string &key,
+                          const TokenResult &name) {
+  int symbol = symbolTable.beginFunction(name.id, name.offset);
+  functionHeaders.push_back(FunctionHeader());
+  functionHeaders.back().name = name.lexeme;
+  functionHeaders.back().params = entry.params;
+  functionHeaders.back().symbol = symbol;
+  functionHeaders.back().expanded = true;
+
+  for (const SymbolCall &call : entry.symbols) {
+    size_t offset = spanOffsets[call.token];
+    if (call.op == SymbolCall::DECLARE)
+      symbolTable.declare(call.name, call.text, call.parameter, offset);
+    else if (call.op == SymbolCall::REFERENCE)
+      symbolTable.reference(call.name, call.kind, offset, call.arity);
+    else
+      symbolTable.report(offset, call.text, true);
+  }
+
+  if (!entry.trace.empty()) {
+    std::vector<TokenResult> tokens =
+        FunctionCache::tokens(std::string_view(key).substr(1), spanOffsets);
+    int depth = ruleDepth;
+    size_t token = 0;
+    for (const TraceItem &item : entry.trace) {
+      ruleDepth = depth + item.depth;
+      if (item.kind == TraceItem::PRODUCTION)
+        reduce(item.production);
+      else if (item.kind == TraceItem::TOKEN)
+        traceToken(tokens[token++]);
+      else
+        printExpression(entry.expressions[item.expression]);
+    }
+    ruleDepth = depth;
   }
+
+  size_t offset = spanOffsets[0];
+  program.functions.push_back({name.id, offset, offset, symbol});
+  program.functions.back().body = cloneStatements(
+      entry.body, [](size_t token) { return spanOffsets[token]; });
+  symbolTable.endFunction();
+}
+
+static void parseFunction();
+
+// Lex the tokens from `function` to the '}' closing its body into a key,
+// and rebuild the parse of an identical span from the cache, or parse them
+// and cache the result. Only the offsets and the function's name are kept
+// as tokens are read; a miss gets the rest back from the key. False, with
+// the tokens pushed back, for a span too long or not closed before a $$.
+static bool cachedFunction() {
+  // Entries differ by what parsing them printed or kept
+  std::string key(1, char('0' + tracing + 2 * showExpressions + 4 * keepProgram));
+  key.reserve(1024);
+  spanOffsets.clear();
+  TokenResult name;
+  int braces = 0;
+  for (;;) {
+    FunctionCache::addToken(key, currentToken);
+    spanOffsets.push_back(currentToken.offset);
+    if (spanOffsets.size() == 2)
+      name = currentToken;
+    bool unclosed = currentToken.token == "EOF";
+    if (currentToken.token == "Separator") {
+      if (currentToken.lexeme == "{") {
+        braces++;
+      } else if (currentToken.lexeme == "}" && --braces == 0) {
+        break;
+      } else if (currentToken.lexeme == "$$") {
+        unclosed = true;
+      }
+    }
+    if (unclosed || spanOffsets.size() == FunctionCache::maxTokens) {
+      pushBack(FunctionCache::tokens(std::string_view(key).substr(1),
+                                     spanOffsets));
+      return false;
+    }
+    nextToken();
+  }
+
+  size_t bytes = spanOffsets.back() + 1 - spanOffsets[0];
+  if (const CachedFunction *entry = functionCache.find(key)) {
+    reuseFunction(*entry, key, name);
+    functionCache.reused(bytes);
+    nextToken();
+    program.functions.back().end = currentToken.offset;
+    return true;
+  }
+
+  CachedFunction entry;
+  pushBack(FunctionCache::tokens(std::string_view(key).substr(1), spanOffsets));
+  capture = &entry;
+  captureDepth = ruleDepth;
+  try {
+    parseFunction();
+  } catch (...) {
+    capture = nullptr;
+    throw;
+  }
+  capture = nullptr;
+  entry.params = functionHeaders.back().params;
+  entry.body = cloneStatements(program.functions.back().body, spanToken);
+  functionCache.insert(std::move(key), std::move(entry));
+  return true;
 }
 
 // R4. <Function> ::= function <Identifier> ( <Opt Parameter List> ) <Opt
 // Declaration List> <Body>
 void Function() {
+  RuleScope rule;
+  // Only read ahead when every offset read can still be located
+  if (cacheFunctions && !lazyBodies &&
+      (feed != nullptr ? feed->locatesAll() : input->inMemory()) &&
+      cachedFunction())
+    return;
+  parseFunction();
+}
+
+static void parseFunction() {
   // function
+  size_t offset = currentToken.offset;
   match({"Keyword", "function"});
 
   // <Identifier>
+  int symbol = symbolTable.beginFunction(currentToken.id, currentToken.offset);
+  functionHeaders.push_back(FunctionHeader());
+  functionHeaders.back().name = currentToken.lexeme;
+  functionHeaders.back().symbol = symbol;
+  program.functions.push_back({currentToken.id, offset, offset, symbol});
   match({"Identifier", ""});
 
   // (
@@ -99,457 +485,667 @@ void Function() {
   // <Opt Declaration List>
   OptDeclarationList();
 
-  // <Body>
-  Body();
-
-  if (debug) {
-    std::cout << "<Function> ::= function <Identifier> ( <Opt Parameter List> "
-                 ") <Opt Declaration List> <Body>\n";
+  // <Body>; only raw input can be skipped over
+  if (lazyBodies && feed == nullptr) {
+    SkipBody(functionHeaders.back());
+  } else {
+    program.functions.back().body = Body();
+    functionHeaders.back().expanded = true;
   }
+  program.functions.back().end = currentToken.offset;
+  symbolTable.endFunction();
+
+  if (tracing)
+    reduce("<Function> ::= function <Identifier> ( <Opt Parameter List> "
+           ") <Opt Declaration List> <Body>\n");
 }
 
 // R5. <Opt Parameter List> ::= <Parameter List> | <Empty>
 void OptParameterList() {
+  RuleScope rule;
   if (currentToken.token == "Identifier") {
     ParameterList();
-    if (debug)
-      std::cout << "<Opt Parameter List> ::= <Parameter List>\n";
+    if (tracing)
+      reduce("<Opt Parameter List> ::= <Parameter List>\n");
   } else {
-    if (debug)
-      std::cout << "<Opt Parameter List> ::= <Empty>\n";
+    if (tracing)
+      reduce("<Opt Parameter List> ::= <Empty>\n");
   }
 }
 
 // R6. <Parameter List> ::= <Parameter> | <Parameter> , <Parameter List>
 void ParameterList() {
+  RuleScope rule;
+  size_t count = 1;
   Parameter();
-  if (currentToken.token == "Separator" && currentToken.lexeme == ",") {
+  while (currentToken.token == "Separator" && currentToken.lexeme == ",") {
     match({"Separator", ","});
-    ParameterList();
-    if (debug) {
-      std::cout << "<Parameter List> ::= <Parameter> , <Parameter List>\n";
-    }
-  } else {
-    if (debug)
-      std::cout << "<Parameter List> ::= <Parameter>\n";
+    Parameter();
+    count++;
+  }
+
+  if (tracing) {
+    reduce("<Parameter List> ::= <Parameter>\n");
+    for (size_t i = 1; i < count; i++)
+      reduce("<Parameter List> ::= <Parameter> , <Parameter List>\n");
   }
 }
 
 // R7. <Parameter> ::= <IDs> <Qualifier>
 void Parameter() {
-  IDs();
-  Qualifier();
+  RuleScope rule;
+  std::vector<TokenResult> names = IDs();
+  std::string qualifier = Qualifier();
 
-  if (debug)
-    std::cout << "<Parameter> ::= <IDs> <Qualifier>\n";
+  for (const TokenResult &name : names) {
+    functionHeaders.back().params.push_back({name.lexeme, qualifier});
+    declareName(name, qualifier, true);
+  }
+
+  if (tracing)
+    reduce("<Parameter> ::= <IDs> <Qualifier>\n");
 }
 
 // R8. <Qualifier> ::= integer | boolean | real
-void Qualifier() {
+std::string Qualifier() {
+  RuleScope rule;
+  std::string qualifier = currentToken.lexeme;
   if (currentToken.token == "Keyword" && currentToken.lexeme == "integer") {
     match({"Keyword", "integer"});
-    if (debug)
-      std::cout << "<Qualifier> ::= integer\n";
+    if (tracing)
+      reduce("<Qualifier> ::= integer\n");
   } else if (currentToken.token == "Keyword" &&
              currentToken.lexeme == "boolean") {
     match({"Keyword", "boolean"});
-    if (debug)
-      std::cout << "<Qualifier> ::= boolean\n";
+    if (tracing)
+      reduce("<Qualifier> ::= boolean\n");
   } else if (currentToken.token == "Keyword" && currentToken.lexeme == "real") {
     match({"Keyword", "real"});
-    if (debug)
-      std::cout << "<Qualifier> ::= real\n";
+    if (tracing)
+      reduce("<Qualifier> ::= real\n");
   } else {
     error("Expected qualifier: integer, boolean, or real");
   }
+  return qualifier;
 }
 
 // R9. <Body> ::= { <Statement List> }
-void Body() {
+std::vector<StmtPtr> Body() {
+  RuleScope rule;
   match({"Separator", "{"});
-  StatementList();
+  std::vector<StmtPtr> statements = StatementList();
   match({"Separator", "}"});
 
-  if (debug)
-    std::cout << "<Body> ::= { <Statement List> }\n";
+  if (tracing)
+    reduce("<Body> ::= { <Statement List> }\n");
+  return statements;
+}
+
+// Skip a function body by brace matching on the raw input. currentToken must be
+// the opening '{'; the text up to the matching '}' is kept in the header so
+// ExpandBody() can parse it later.
+void SkipBody(FunctionHeader &header) {
+  if (currentToken.token != "Separator" || currentToken.lexeme != "{") {
+    error("At line " + std::to_string(currentLocation().line) +
+          " Expected Separator { but found " + currentToken.token + " " +
+          currentToken.lexeme);
+  }
+  header.offset = currentToken.offset;
+  header.at = currentLocation();
+  header.body = "{";
+
+  int depth = 1;
+  int c;
+  while (depth > 0 && (c = input->get()) >= 0) {
+    header.body += static_cast<char>(c);
+    if (c == '[' && input->peek() == '*') {
+      // Comments may contain braces, copy them through untouched
+      header.body += static_cast<char>(input->get());
+      while ((c = input->get()) >= 0) {
+        header.body += static_cast<char>(c);
+        if (c == '*' && input->peek() == ']') {
+          header.body += static_cast<char>(input->get());
+          break;
+        }
+      }
+    } else if (c == '$' && input->peek() == '$') {
+      error("Expected } before $$ in body of function " + header.name);
+    } else if (c == '{') {
+      depth++;
+    } else if (c == '}') {
+      depth--;
+    }
+  }
+  if (depth > 0) {
+    error("Unterminated body of function " + header.name);
+  }
+  nextToken();
+}
+
+// Parse a body skipped by SkipBody(). Syntax errors in the body are reported
+// here, with offsets and lines of the original source.
+void ExpandBody(FunctionHeader &header) {
+  if (header.expanded) {
+    return;
+  }
+  Source body(header.body.data(), header.body.size(), header.offset,
+              header.at);
+  Source *savedInput = input;
+  TokenResult savedToken = currentToken;
+
+  input = &body;
+  symbolTable.reopenFunction(header.symbol);
+  try {
+    nextToken();
+    program.functions[&header - functionHeaders.data()].body = Body();
+    if (currentToken.token != "EOF") {
+      error("Unexpected tokens after body of function " + header.name);
+    }
+  } catch (...) {
+    symbolTable.endFunction();
+    input = savedInput;
+    throw;
+  }
+  symbolTable.endFunction();
+  header.expanded = true;
+
+  input = savedInput;
+  currentToken = savedToken;
+}
+
+// Find the recorded header of a function by name, or nullptr
+FunctionHeader *findFunction(const std::string &name) {
+  for (FunctionHeader &header : functionHeaders) {
+    if (header.name == name) {
+      return &header;
+    }
+  }
+  return nullptr;
 }
 
 // R10. <Opt Declaration List> ::= <Declaration List> | <Empty>
 void OptDeclarationList() {
+  RuleScope rule;
   if (currentToken.token == "Keyword" &&
       (currentToken.lexeme == "integer" || currentToken.lexeme == "boolean" ||
        currentToken.lexeme == "real")) {
     DeclarationList();
-    if (debug)
-      std::cout << "<Opt Declaration List> ::= <Declaration List>\n";
+    if (tracing)
+      reduce("<Opt Declaration List> ::= <Declaration List>\n");
   } else {
-    if (debug)
-      std::cout << "<Opt Declaration List> ::= <Empty>\n";
+    if (tracing)
+      reduce("<Opt Declaration List> ::= <Empty>\n");
   }
 }
 
 // R11. <Declaration List> := <Declaration> ; | <Declaration> ; <Declaration
 // List>
 void DeclarationList() {
-  Declaration();
-  match({"Separator", ";"});
-
-  if (currentToken.token == "Keyword" &&
-      (currentToken.lexeme == "integer" || currentToken.lexeme == "boolean" ||
-       currentToken.lexeme == "real")) {
-    DeclarationList();
-    if (debug)
-      std::cout
-          << "<Declaration List> ::= <Declaration> ; <Declaration List>\n";
-  } else {
-    if (debug)
-      std::cout << "<Declaration List> ::= <Declaration> ;\n";
+  RuleScope rule;
+  size_t count = 0;
+  do {
+    Declaration();
+    match({"Separator", ";"});
+    count++;
+  } while (currentToken.token == "Keyword" &&
+           (currentToken.lexeme == "integer" ||
+            currentToken.lexeme == "boolean" || currentToken.lexeme == "real"));
+
+  if (tracing) {
+    reduce("<Declaration List> ::= <Declaration> ;\n");
+    for (size_t i = 1; i < count; i++)
+      reduce("<Declaration List> ::= <Declaration> ; <Declaration List>\n");
   }
 }
 
 // R12. <Declaration> ::= <Qualifier> <IDs>
 void Declaration() {
-  Qualifier();
-  IDs();
-  if (debug)
-    std::cout << "<Declaration> ::= <Qualifier> <IDs>\n";
+  RuleScope rule;
+  std::string qualifier = Qualifier();
+  for (const TokenResult &name : IDs()) {
+    declareName(name, qualifier, false);
+  }
+  if (tracing)
+    reduce("<Declaration> ::= <Qualifier> <IDs>\n");
 }
 
 // R13. <IDs> ::= <Identifier> | <Identifier>, <IDs>
-void IDs() {
+std::vector<TokenResult> IDs() {
+  RuleScope rule;
+  std::vector<TokenResult> names = {currentToken};
   match({"Identifier", ""});
 
-  if (currentToken.token == "Separator" && currentToken.lexeme == ",") {
+  while (currentToken.token == "Separator" && currentToken.lexeme == ",") {
     match({"Separator", ","});
-    IDs();
-    if (debug)
-      std::cout << "<IDs> ::= <Identifier>, <IDs>\n";
-  } else {
-    if (debug)
-      std::cout << "<IDs> ::= <Identifier>\n";
+    names.push_back(currentToken);
+    match({"Identifier", ""});
   }
+
+  if (tracing) {
+    reduce("<IDs> ::= <Identifier>\n");
+    for (size_t i = 1; i < names.size(); i++)
+      reduce("<IDs> ::= <Identifier>, <IDs>\n");
+  }
+  return names;
 }
 
 // R14. <Statement List> ::= <Statement> | <Statement> <Statement List>
-void StatementList() {
-  Statement();
-
-  if (currentToken.token != "Separator" ||
-      (currentToken.token == "Separator" && currentToken.lexeme != "}" &&
-       currentToken.lexeme != "$$")) {
-    StatementList();
-    if (debug)
-      std::cout << "<Statement List> ::= <Statement> <Statement List>\n";
-  } else {
-    if (debug)
-      std::cout << "<Statement List> ::= <Statement>\n";
+std::vector<StmtPtr> StatementList() {
+  RuleScope rule;
+  std::vector<StmtPtr> statements;
+  size_t count = 0;
+  do {
+    StmtPtr statement = Statement();
+    if (keepProgram)
+      statements.push_back(std::move(statement));
+    count++;
+  } while (currentToken.token != "Separator" ||
+           (currentToken.lexeme != "}" && currentToken.lexeme != "$$"));
+
+  if (tracing) {
+    reduce("<Statement List> ::= <Statement>\n");
+    for (size_t i = 1; i < count; i++)
+      reduce("<Statement List> ::= <Statement> <Statement List>\n");
   }
+  return statements;
+}
+
+// New statement node at the current token
+static StmtPtr makeStmt(StmtKind kind) {
+  StmtPtr statement(new Stmt());
+  statement->kind = kind;
+  statement->offset = currentToken.offset;
+  return statement;
 }
 
 // R15. <Statement> ::= <Compound> | <Assign> | <If> | <Return> | <Print> |
 // <Scan> | <While>
-void Statement() {
+StmtPtr Statement() {
+  RuleScope rule;
+  StmtPtr statement;
   if (currentToken.token == "Separator" && currentToken.lexeme == "{") {
-    Compound();
-    if (debug)
-      std::cout << "<Statement> ::= <Compound>\n";
+    statement = Compound();
+    if (tracing)
+      reduce("<Statement> ::= <Compound>\n");
   } else if (currentToken.token == "Identifier") {
-    Assign();
-    if (debug)
-      std::cout << "<Statement> ::= <Assign>\n";
+    statement = Assign();
+    if (tracing)
+      reduce("<Statement> ::= <Assign>\n");
   } else if (currentToken.token == "Keyword") {
     if (currentToken.lexeme == "if") {
-      If();
-      if (debug)
-        std::cout << "<Statement> ::= <If>\n";
+      statement = If();
+      if (tracing)
+        reduce("<Statement> ::= <If>\n");
     } else if (currentToken.lexeme == "return") {
-      Return();
-      if (debug)
-        std::cout << "<Statement> ::= <Return>\n";
+      statement = Return();
+      if (tracing)
+        reduce("<Statement> ::= <Return>\n");
     } else if (currentToken.lexeme == "print") {
-      Print();
-      if (debug)
-        std::cout << "<Statement> ::= <Print>\n";
+      statement = Print();
+      if (tracing)
+        reduce("<Statement> ::= <Print>\n");
     } else if (currentToken.lexeme == "scan") {
-      Scan();
-      if (debug)
-        std::cout << "<Statement> ::= <Scan>\n";
+      statement = Scan();
+      if (tracing)
+        reduce("<Statement> ::= <Scan>\n");
     } else if (currentToken.lexeme == "while") {
-      While();
-      if (debug)
-        std::cout << "<Statement> ::= <While>\n";
+      statement = While();
+      if (tracing)
+        reduce("<Statement> ::= <While>\n");
     } else {
       error("Invalid keyword for statement");
     }
   } else {
     error("Invalid statement");
   }
+  return statement;
 }
 
 // R16. <Compound> ::= { <Statement List> }
-void Compound() {
+StmtPtr Compound() {
+  RuleScope rule;
+  StmtPtr statement = makeStmt(COMPOUND_STMT);
   match({"Separator", "{"});
-  StatementList();
+  statement->body = StatementList();
   match({"Separator", "}"});
-  if (debug)
-    std::cout << "<Compound> ::= { <Statement List> }\n";
+  if (tracing)
+    reduce("<Compound> ::= { <Statement List> }\n");
+  return statement;
 }
 
 // R17. <Assign> ::= <Identifier> = <Expression> ;
-void Assign() {
+StmtPtr Assign() {
+  RuleScope rule;
+  StmtPtr statement = makeStmt(ASSIGN_STMT);
+  statement->name = currentToken.id;
   match({"Identifier", ""});
+  referenceName(statement->name, ASSIGN_REFERENCE, statement->offset);
   match({"Operator", "="});
-  Expression();
+  statement->value = Expression();
+  showExpression(statement->value);
   match({"Separator", ";"});
-  if (debug)
-    std::cout << "<Assign> ::= <Identifier> = <Expression> ;\n";
+  if (tracing)
+    reduce("<Assign> ::= <Identifier> = <Expression> ;\n");
+  return statement;
 }
 
 // R18. <If> ::= if ( <Condition> ) <Statement> endif | if ( <Condition> )
 // <Statement> else <Statement> endif
-void If() {
+StmtPtr If() {
+  RuleScope rule;
+  StmtPtr statement = makeStmt(IF_STMT);
   match({"Keyword", "if"});
   match({"Separator", "("});
-  Condition();
+  statement->condition = Condition();
   match({"Separator", ")"});
-  Statement();
+  statement->branch = Statement();
 
   if (currentToken.token == "Keyword" && currentToken.lexeme == "else") {
     match({"Keyword", "else"});
-    Statement();
+    statement->elseBranch = Statement();
     match({"Keyword", "endif"});
 
-    if (debug)
-      std::cout
-          << "<If> ::= if ( <Condition> ) <Statement> else <Statement> endif\n";
+    if (tracing)
+      reduce(
+          "<If> ::= if ( <Condition> ) <Statement> else <Statement> endif\n");
   } else {
     match({"Keyword", "endif"});
 
-    if (debug)
-      std::cout << "<If> ::= if ( <Condition> ) <Statement> endif\n";
+    if (tracing)
+      reduce("<If> ::= if ( <Condition> ) <Statement> endif\n");
   }
+  return statement;
 }
 
 // R19. <Return> ::= return ; | return <Expression> ;
-void Return() {
+StmtPtr Return() {
+  RuleScope rule;
+  StmtPtr statement = makeStmt(RETURN_STMT);
   match({"Keyword", "return"});
 
   if (currentToken.token == "Separator" && currentToken.lexeme == ";") {
     match({"Separator", ";"});
 
-    if (debug)
-      std::cout << "<Return> ::= return ;\n";
+    if (tracing)
+      reduce("<Return> ::= return ;\n");
   } else {
-    Expression();
+    statement->value = Expression();
+    showExpression(statement->value);
     match({"Separator", ";"});
 
-    if (debug)
-      std::cout << "<Return> ::= return <Expression> ;\n";
+    if (tracing)
+      reduce("<Return> ::= return <Expression> ;\n");
   }
+  return statement;
 }
 
 // R20. <Print> ::= print ( <Expression> );
-void Print() {
-
+StmtPtr Print() {
+  RuleScope rule;
+  StmtPtr statement = makeStmt(PRINT_STMT);
   match({"Keyword", "print"});
   match({"Separator", "("});
-  Expression();
+  statement->value = Expression();
+  showExpression(statement->value);
   match({"Separator", ")"});
   match({"Separator", ";"});
-  if (debug)
-    std::cout << "<Print> ::= print ( <Expression> );\n";
+  if (tracing)
+    reduce("<Print> ::= print ( <Expression> );\n");
+  return statement;
 }
 
 // R21. <Scan> ::= scan ( <IDs> );
-void Scan() {
+StmtPtr Scan() {
+  RuleScope rule;
+  StmtPtr statement = makeStmt(SCAN_STMT);
   match({"Keyword", "scan"});
   match({"Separator", "("});
-  IDs();
+  for (const TokenResult &name : IDs()) {
+    referenceName(name.id, SCAN_REFERENCE, name.offset);
+    statement->targets.push_back(makeIdentifier(name.id, name.offset));
+  }
   match({"Separator", ")"});
   match({"Separator", ";"});
-  if (debug)
-    std::cout << "<Scan> ::= scan ( <IDs> );\n";
+  if (tracing)
+    reduce("<Scan> ::= scan ( <IDs> );\n");
+  return statement;
 }
 
 // R22. <While> ::= while ( <Condition> ) <Statement> endwhile
-void While() {
+StmtPtr While() {
+  RuleScope rule;
+  StmtPtr statement = makeStmt(WHILE_STMT);
   match({"Keyword", "while"});
   match({"Separator", "("});
-  Condition();
+  statement->condition = Condition();
   match({"Separator", ")"});
-  Statement();
+  statement->branch = Statement();
   match({"Keyword", "endwhile"});
-  if (debug)
-    std::cout << "<While> ::= while ( <Condition> ) <Statement> endwhile\n";
+  if (tracing)
+    reduce("<While> ::= while ( <Condition> ) <Statement> endwhile\n");
+  return statement;
 }
 
 // R23. <Condition> ::= <Expression> <Relop> <Expression>
-void Condition() {
-  Expression();
-  Relop();
-  Expression();
-  if (debug)
-    std::cout << "<Condition> ::= <Expression> <Relop> <Expression>\n";
+Comparison Condition() {
+  RuleScope rule;
+  Comparison condition;
+  condition.left = Expression();
+  showExpression(condition.left);
+  condition.op = Relop();
+  condition.right = Expression();
+  showExpression(condition.right);
+  if (tracing)
+    reduce("<Condition> ::= <Expression> <Relop> <Expression>\n");
+  return condition;
 }
 
 // R24. <Relop> ::= == | != | > | < | <= | =>
-void Relop() {
+RelopKind Relop() {
+  RuleScope rule;
+  RelopKind op = EQUAL_RELOP;
   if (currentToken.token == "Operator") {
     if (currentToken.lexeme == "==") {
       match({"Operator", "=="});
-      if (debug)
-        std::cout << "<Relop> ::= ==\n";
+      op = EQUAL_RELOP;
+      if (tracing)
+        reduce("<Relop> ::= ==\n");
     } else if (currentToken.lexeme == "!=") {
       match({"Operator", "!="});
-      if (debug)
-        std::cout << "<Relop> ::= !=\n";
+      op = NOT_EQUAL_RELOP;
+      if (tracing)
+        reduce("<Relop> ::= !=\n");
     } else if (currentToken.lexeme == ">") {
       match({"Operator", ">"});
-      if (debug)
-        std::cout << "<Relop> ::= >\n";
+      op = GREATER_RELOP;
+      if (tracing)
+        reduce("<Relop> ::= >\n");
     } else if (currentToken.lexeme == "<") {
       match({"Operator", "<"});
-      if (debug)
-        std::cout << "<Relop> ::= <\n";
+      op = LESS_RELOP;
+      if (tracing)
+        reduce("<Relop> ::= <\n");
     } else if (currentToken.lexeme == "<=") {
       match({"Operator", "<="});
-      if (debug)
-        std::cout << "<Relop> ::= <=\n";
+      op = LESS_EQUAL_RELOP;
+      if (tracing)
+        reduce("<Relop> ::= <=\n");
     } else if (currentToken.lexeme == "=>") {
       match({"Operator", "=>"});
-      if (debug)
-        std::cout << "<Relop> ::= =>\n";
+      op = GREATER_EQUAL_RELOP;
+      if (tracing)
+        reduce("<Relop> ::= =>\n");
     } else {
       error("Invalid relational operator");
     }
   } else {
     error("Expected relational operator");
   }
+  return op;
 }
 
 // R25. <Expression> ::= <Term> <Expression'>
-void Expression() {
-  Term();
-  ExpressionPrime();
-  if (debug)
-    std::cout << "<Expression> ::= <Term> <Expression'>\n";
+ExprPtr Expression() {
+  RuleScope rule;
+  ExprPtr e = ExpressionPrime(Term());
+  if (tracing)
+    reduce("<Expression> ::= <Term> <Expression'>\n");
+  return e;
 }
 
 // <Expression'> ::= + <Term> <Expression'> | - <Term> <Expression'> | epsilon
-void ExpressionPrime() {
+// The operators are left associative, so each one combines with the tree
+// built so far before the rest of the expression is parsed.
+ExprPtr ExpressionPrime(ExprPtr left) {
+  RuleScope rule;
   if (currentToken.token == "Operator" && currentToken.lexeme == "+") {
     match({"Operator", "+"});
-    Term();
-    ExpressionPrime();
-    if (debug)
-      std::cout << "<Expression'> ::= + <Term> <Expression'>\n";
+    ExprPtr e = makeBinary(ADD_EXPR, std::move(left), Term());
+    e = ExpressionPrime(std::move(e));
+    if (tracing)
+      reduce("<Expression'> ::= + <Term> <Expression'>\n");
+    return e;
   } else if (currentToken.token == "Operator" && currentToken.lexeme == "-") {
     match({"Operator", "-"});
-    Term();
-    ExpressionPrime();
-    if (debug)
-      std::cout << "<Expression'> ::= - <Term> <Expression'>\n";
+    ExprPtr e = makeBinary(SUBTRACT_EXPR, std::move(left), Term());
+    e = ExpressionPrime(std::move(e));
+    if (tracing)
+      reduce("<Expression'> ::= - <Term> <Expression'>\n");
+    return e;
   } else {
-    if (debug)
-      std::cout << "<Expression'> ::= ε\n";
+    if (tracing)
+      reduce("<Expression'> ::= ε\n");
+    return left;
   }
 }
 
 // R26. <Term> ::= <Factor> <Term'>
-void Term() {
-  Factor();
-  TermPrime();
-  if (debug)
-    std::cout << "<Term> ::= <Factor> <Term'>\n";
+ExprPtr Term() {
+  RuleScope rule;
+  ExprPtr e = TermPrime(Factor());
+  if (tracing)
+    reduce("<Term> ::= <Factor> <Term'>\n");
+  return e;
 }
 
 // <Term'> ::= * <Factor> <Term'> | / <Factor> <Term'> | epsilon
-void TermPrime() {
+ExprPtr TermPrime(ExprPtr left) {
+  RuleScope rule;
   if (currentToken.token == "Operator" && currentToken.lexeme == "*") {
     match({"Operator", "*"});
-    Factor();
-    TermPrime();
-    if (debug)
-      std::cout << "<Term'> ::= * <Factor> <Term'>\n";
+    ExprPtr e = makeBinary(MULTIPLY_EXPR, std::move(left), Factor());
+    e = TermPrime(std::move(e));
+    if (tracing)
+      reduce("<Term'> ::= * <Factor> <Term'>\n");
+    return e;
   } else if (currentToken.token == "Operator" && currentToken.lexeme == "/") {
     match({"Operator", "/"});
-    Factor();
-    TermPrime();
-    if (debug)
-      std::cout << "<Term'> ::= / <Factor> <Term'>\n";
+    ExprPtr e = makeBinary(DIVIDE_EXPR, std::move(left), Factor());
+    e = TermPrime(std::move(e));
+    if (tracing)
+      reduce("<Term'> ::= / <Factor> <Term'>\n");
+    return e;
   } else {
     // Epsilon production
-    if (debug)
-      std::cout << "<Term'> ::= ε\n";
+    if (tracing)
+      reduce("<Term'> ::= ε\n");
+    return left;
   }
 }
 
 // R27. <Factor> ::= - <Primary> | <Primary>
-void Factor() {
+ExprPtr Factor() {
+  RuleScope rule;
   if (currentToken.token == "Operator" && currentToken.lexeme == "-") {
+    size_t offset = currentToken.offset;
     match({"Operator", "-"});
-    Primary();
-    if (debug)
-      std::cout << "<Factor> ::= - <Primary>\n";
+    ExprPtr e = makeNegate(Primary(), offset);
+    if (tracing)
+      reduce("<Factor> ::= - <Primary>\n");
+    return e;
   } else {
-    if (debug)
-      std::cout << "<Factor> ::= <Primary>\n";
-    Primary();
+    if (tracing)
+      reduce("<Factor> ::= <Primary>\n");
+    return Primary();
   }
 }
 
 // R28. <Primary> ::= <Identifier> | <Integer> | <Identifier> ( <IDs> ) | (
 // <Expression> ) | <Real> | true | false
-void Primary() {
+ExprPtr Primary() {
+  RuleScope rule;
+  ExprPtr e;
+  TokenResult token = currentToken;
+
   if (currentToken.token == "Identifier") {
     match({"Identifier", ""});
 
     if (currentToken.token == "Separator" && currentToken.lexeme == "(") {
       match({"Separator", "("});
-      IDs();
+      std::vector<ExprPtr> args;
+      std::vector<TokenResult> names = IDs();
+      referenceName(token.id, CALL_REFERENCE, token.offset, names.size());
+      for (const TokenResult &arg : names) {
+        referenceName(arg.id, READ_REFERENCE, arg.offset);
+        args.push_back(makeIdentifier(arg.id, arg.offset));
+      }
       match({"Separator", ")"});
-      if (debug)
-        std::cout << "<Primary> ::= <Identifier> ( <IDs> )\n";
+      e = makeCall(token.id, std::move(args), token.offset);
+      if (tracing)
+        reduce("<Primary> ::= <Identifier> ( <IDs> )\n");
 
     } else {
-      if (debug)
-        std::cout << "<Primary> ::= <Identifier>\n";
+      referenceName(token.id, READ_REFERENCE, token.offset);
+      e = makeIdentifier(token.id, token.offset);
+      if (tracing)
+        reduce("<Primary> ::= <Identifier>\n");
     }
   } else if (currentToken.token == "Integer") {
     match({"Integer", ""});
+    if (token.overflow)
+      reportAt(token.offset,
+               "integer literal " + token.lexeme + " out of range");
+    e = makeInteger(token.integer, token.offset);
 
-    if (debug)
-      std::cout << "<Primary> ::= <Integer>\n";
+    if (tracing)
+      reduce("<Primary> ::= <Integer>\n");
   } else if (currentToken.token == "Real") {
     match({"Real", ""});
+    if (token.overflow)
+      reportAt(token.offset, "real literal " + token.lexeme + " out of range");
+    e = makeReal(token.real, token.offset);
 
-    if (debug)
-      std::cout << "<Primary> ::= <Real>\n";
+    if (tracing)
+      reduce("<Primary> ::= <Real>\n");
   } else if (currentToken.token == "Separator" && currentToken.lexeme == "(") {
     match({"Separator", "("});
-    Expression();
+    e = Expression();
     match({"Separator", ")"});
-    if (debug)
-      std::cout << "<Primary> ::= ( <Expression> )\n";
+    if (tracing)
+      reduce("<Primary> ::= ( <Expression> )\n");
 
   } else if (currentToken.token == "Keyword" && currentToken.lexeme == "true") {
     match({"Keyword", "true"});
+    e = makeBoolean(true, token.offset);
 
-    if (debug)
-      std::cout << "<Primary> ::= true\n";
+    if (tracing)
+      reduce("<Primary> ::= true\n");
   } else if (currentToken.token == "Keyword" &&
              currentToken.lexeme == "false") {
     match({"Keyword", "false"});
+    e = makeBoolean(false, token.offset);
 
-    if (debug)
-      std::cout << "<Primary> ::= false\n";
+    if (tracing)
+      reduce("<Primary> ::= false\n");
   } else {
     error("Expected primary expression");
   }
+  return e;
 }
 
 // R29. <Empty> ::=
 void Empty() {
-  if (debug)
-    std::cout << "<Empty> ::= ε\n";
+  RuleScope rule;
+  if (tracing)
+    reduce("<Empty> ::= ε\n");
 }
\ No newline at end of file
@@ -1,13 +1,95 @@
 #ifndef SYNTAX_ANALYZER_HPP
 #define SYNTAX_ANALYZER_HPP
 
+#include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
+#include "ast.hpp"
+#include "function_cache.hpp"
 #include "lexer.hpp"
+#include "symbol_table.hpp"
+#include "trace.hpp"
+
+// Header of a parsed function. With lazyBodies set, the body is kept as raw
+// text and only parsed when ExpandBody() is called. Bodies are only skipped
+// when the lexer reads the input itself, not from a TokenFeed.
+struct FunctionHeader {
+  std::string name;
+  std::vector<std::pair<std::string, std::string>> params; // name, qualifier
+  std::string body;
+  size_t offset = 0; // offset of the opening '{'
+  Location at = {1, 1};
+  int symbol = -1; // in symbolTable
+  bool expanded = false;
+};
+
+// Thrown by error(); what() is the full diagnostic line
+struct SyntaxError : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+extern bool debug;
+extern bool showExpressions;
+extern Source *input;
+extern bool lazyBodies;
+extern std::vector<FunctionHeader> functionHeaders;
+extern bool keepProgram;
+extern Program program;
+// Off (no capacity) unless asked for; error() writes it to standard error
+extern TraceRing flightRecorder;
+// Set to reuse the parse of a function identical to one seen before, in
+// this file or an earlier one
+extern bool cacheFunctions;
+extern FunctionCache functionCache;
+
+// Gives the parser its tokens in place of the lexer: a replayed token
+// vector, or a push session's lexer
+class TokenFeed {
+public:
+  virtual ~TokenFeed() = default;
+  virtual TokenResult next() = 0; // EOF at the end, and after it
+  virtual Location locate(size_t offset) const = 0;
+  // False if only offsets near the last token can be located, as with a
+  // streamed Source
+  virtual bool locatesAll() const { return true; }
+};
+
+// A parse's share of the parser's globals. swapParserState() trades them
+// with the globals, so a parse suspended in a ParseSession can be set
+// aside while another one runs. Settings such as debug stay shared.
+struct ParserState {
+  ParserState();
+
+  TokenResult currentToken;
+  TokenFeed *feed = nullptr;
+  std::vector<FunctionHeader> functionHeaders;
+  Program program;
+  SymbolTable symbols;
+  TraceRing flightRecorder;
+  int ruleDepth = 0;
+  bool tracing = false;
+  std::vector<TokenResult> pushedBack;
+  size_t pushedBackPos = 0;
+  std::vector<size_t> spanOffsets;
+  CachedFunction *capture = nullptr;
+  int captureDepth = 0;
+};
+
+void swapParserState(ParserState &state);
 
 // Function declarations for the syntax analyzer
 void nextToken();
 void error(const std::string &msg);
 void match(TokenResult expected);
+void parseSource(Source &source);
+void parseTokens(const std::vector<TokenResult> &tokens,
+                 const LineIndex &lines);
+void parseFeed(TokenFeed &tokens);
+Location currentLocation();
+Location locateOffset(size_t offset);
+// The flight recorder's events, oldest first, in the debug trace's format
+void writeFlightRecord(std::ostream &out);
 
 // Grammar rule functions
 void Rat25S();
@@ -17,29 +99,34 @@ void Function();
 void OptParameterList();
 void ParameterList();
 void Parameter();
-void Qualifier();
-void Body();
+std::string Qualifier();
+std::vector<StmtPtr> Body();
 void OptDeclarationList();
 void DeclarationList();
 void Declaration();
-void IDs();
-void StatementList();
-void Statement();
-void Compound();
-void Assign();
-void If();
-void Return();
-void Print();
-void Scan();
-void While();
-void Condition();
-void Relop();
-void Expression();
-void ExpressionPrime();
-void Term();
-void TermPrime();
-void Factor();
-void Primary();
+std::vector<TokenResult> IDs();
+std::vector<StmtPtr> StatementList();
+StmtPtr Statement();
+StmtPtr Compound();
+StmtPtr Assign();
+StmtPtr If();
+StmtPtr Return();
+StmtPtr Print();
+StmtPtr Scan();
+StmtPtr While();
+Comparison Condition();
+RelopKind Relop();
+ExprPtr Expression();
+ExprPtr ExpressionPrime(ExprPtr left);
+ExprPtr Term();
+ExprPtr TermPrime(ExprPtr left);
+ExprPtr Factor();
+ExprPtr Primary();
 void Empty();
 
+// Lazy function bodies
+void SkipBody(FunctionHeader &header);
+void ExpandBody(FunctionHeader &header);
+FunctionHeader *findFunction(const std::string &name);
+
 #endif
\ No newline at end of file
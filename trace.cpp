@@ -0,0 +1,96 @@
+#include <cstring>
+
+#include "string_table.hpp"
+#include "trace.hpp"
+
+// Token classes as static strings, so events can point at them. The
+// class names differ by their first letter, or third for the I's.
+static const char *tokenClass(const std::string &token) {
+  switch (token[0]) {
+  case 'K':
+    return "Keyword";
+  case 'I':
+    return token[2] == 'e' ? "Identifier"
+                           : token[2] == 't' ? "Integer" : "Invalid";
+  case 'R':
+    return "Real";
+  case 'S':
+    return "Separator";
+  case 'O':
+    return "Operator";
+  default:
+    return "EOF";
+  }
+}
+
+void formatTokenLine(const char *tokenClass, std::string_view lexeme,
+                     std::string &out) {
+  out += "Token: ";
+  out += tokenClass;
+  out += "\tLexeme: ";
+  out += lexeme;
+  out += '\n';
+}
+
+void TraceRing::resize(size_t capacity) {
+  events.assign(capacity, TraceEvent());
+  longLexemes.assign(capacity, std::string());
+  this->capacity = capacity;
+  clear();
+}
+
+TraceEvent &TraceRing::add() {
+  TraceEvent &event = events.data()[next];
+  if (++next == capacity)
+    next = 0;
+  if (count < capacity)
+    count++;
+  return event;
+}
+
+// Identifiers are kept by id and short lexemes in the event. A longer
+// one, a rare long number or invalid token, is copied to the slot's
+// string, which keeps its capacity for the next one.
+void TraceRing::recordToken(const TokenResult &token) {
+  size_t slot = next;
+  TraceEvent &event = add();
+  event.text = tokenClass(token.token);
+  event.id = token.id;
+  event.production = false;
+  size_t length = token.lexeme.size();
+  if (token.id != 0) {
+    event.length = 0;
+  } else if (length <= sizeof event.lexeme) {
+    event.length = length;
+    memcpy(event.lexeme, token.lexeme.data(), length);
+  } else {
+    event.length = TraceEvent::LONG_LEXEME;
+    longLexemes[slot] = token.lexeme;
+  }
+}
+
+void TraceRing::recordProduction(const char *production) {
+  TraceEvent &event = add();
+  event.text = production;
+  event.production = true;
+}
+
+void TraceRing::write(std::ostream &out) const {
+  if (count == 0)
+    return;
+  size_t first = (next + capacity - count) % capacity;
+  std::string text;
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = (first + i) % capacity;
+    const TraceEvent &event = events[slot];
+    if (event.production)
+      text += event.text;
+    else if (event.id != 0)
+      formatTokenLine(event.text, identifiers.name(event.id), text);
+    else if (event.length == TraceEvent::LONG_LEXEME)
+      formatTokenLine(event.text, longLexemes[slot], text);
+    else
+      formatTokenLine(event.text, {event.lexeme, event.length}, text);
+  }
+  out << text;
+}
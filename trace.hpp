@@ -0,0 +1,54 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lexer.hpp"
+
+// A parser trace event in binary form: a matched token or a reduced
+// production. Nothing is formatted until the event is written.
+struct TraceEvent {
+  const char *text; // production line, or the token's class name
+  uint32_t id;      // interned name of an identifier token
+  uint8_t production; // else a token
+  uint8_t length;     // lexeme bytes, for other tokens; LONG_LEXEME if spilled
+  char lexeme[18];
+
+  static const uint8_t LONG_LEXEME = UINT8_MAX;
+};
+
+// Append the line the debug trace prints for a token
+void formatTokenLine(const char *tokenClass, std::string_view lexeme,
+                     std::string &out);
+
+// The most recent events in a fixed ring, older ones overwritten. Events
+// are written in place, so recording one is a few stores.
+class TraceRing {
+public:
+  // 0 events turns recording off
+  void resize(size_t capacity);
+  bool enabled() const { return capacity != 0; }
+  size_t limit() const { return capacity; }
+  void clear() { next = count = 0; }
+
+  void recordToken(const TokenResult &token);
+  void recordProduction(const char *production);
+
+  // Oldest first, each line as the debug trace prints it
+  void write(std::ostream &out) const;
+
+private:
+  TraceEvent &add();
+
+  std::vector<TraceEvent> events;
+  std::vector<std::string> longLexemes; // by slot, for lexemes that spill
+  size_t capacity = 0;
+  size_t next = 0;
+  size_t count = 0;
+};
+
+#endif
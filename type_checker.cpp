@@ -0,0 +1,249 @@
+#include "bytecode.hpp"
+#include "string_table.hpp"
+#include "symbol_table.hpp"
+#include "type_checker.hpp"
+
+static const uint8_t INT_BIT = 1 << INT_VALUE;
+static const uint8_t REAL_BIT = 1 << REAL_VALUE;
+static const uint8_t BOOL_BIT = 1 << BOOL_VALUE;
+
+static int functionSymbol;            // -1 for the main program
+static FunctionDef *function;         // being checked, null for main
+static std::vector<int> functionIndex; // by symbol
+static std::vector<uint8_t> returns;  // type bit per function
+static bool final; // last round: convert and report
+static std::vector<TypeError> *errors;
+
+static std::string quoted(uint32_t name) {
+  return "'" + std::string(identifiers.name(name)) + "'";
+}
+
+static void error(const std::string &message, size_t offset) {
+  if (final)
+    errors->push_back({message, offset});
+}
+
+// A function returns a real if any return is real, else an integer if
+// any return (or falling off the end) is an integer
+static ValueType returnType(uint8_t bits) {
+  if (bits & REAL_BIT)
+    return REAL_VALUE;
+  if (bits == BOOL_BIT)
+    return BOOL_VALUE;
+  return INT_VALUE;
+}
+
+static ValueType variableType(uint32_t name) {
+  int symbol = symbolTable.lookup(name, functionSymbol);
+  if (symbol < 0)
+    return INT_VALUE;
+  const Symbol &s = symbolTable.symbols()[symbol];
+  return s.kind == FUNCTION_SYMBOL ? INT_VALUE : valueType(s.type);
+}
+
+// Make `e` a `to`, promoting an integer to real
+static void convert(ExprPtr &e, ValueType to, const std::string &what) {
+  if (e->type == to)
+    return;
+  if (e->type == INT_VALUE && to == REAL_VALUE) {
+    if (final)
+      e = makeToReal(std::move(e));
+    return;
+  }
+  error("cannot use " + std::string(typeName(e->type)) + " as " + what,
+        e->offset);
+}
+
+static void checkExpr(ExprPtr &e);
+
+static void checkCall(Expr &e) {
+  int symbol = symbolTable.lookup(e.name, functionSymbol);
+  e.type = INT_VALUE;
+  if (symbol < 0 || functionIndex[symbol] < 0)
+    return; // Compilation reports bad calls
+  const Symbol &callee = symbolTable.symbols()[symbol];
+  e.type = returnType(returns[functionIndex[symbol]]);
+  for (size_t i = 0; i < e.args.size(); i++) {
+    checkExpr(e.args[i]);
+    if ((int)i >= callee.parameters)
+      continue;
+    const Symbol &parameter = symbolTable.symbols()[callee.members[i]];
+    convert(e.args[i], valueType(parameter.type),
+            std::string(typeName(valueType(parameter.type))) + " parameter " +
+                quoted(parameter.name) + " of " + quoted(e.name));
+  }
+}
+
+// Both operands numbers; an integer beside a real becomes real
+static ValueType checkNumbers(ExprPtr &left, ExprPtr &right, const char *verb,
+                              size_t offset) {
+  if (left->type == BOOL_VALUE || right->type == BOOL_VALUE) {
+    error(std::string("cannot ") + verb + " a boolean", offset);
+    return INT_VALUE;
+  }
+  if (left->type == right->type)
+    return left->type;
+  convert(left, REAL_VALUE, "real");
+  convert(right, REAL_VALUE, "real");
+  return REAL_VALUE;
+}
+
+static void checkExpr(ExprPtr &e) {
+  switch (e->kind) {
+  case INTEGER_EXPR:
+    e->type = INT_VALUE;
+    break;
+  case REAL_EXPR:
+  case TO_REAL_EXPR:
+    e->type = REAL_VALUE;
+    break;
+  case BOOLEAN_EXPR:
+    e->type = BOOL_VALUE;
+    break;
+  case IDENTIFIER_EXPR:
+    e->type = variableType(e->name);
+    break;
+  case CALL_EXPR:
+    checkCall(*e);
+    break;
+  case NEGATE_EXPR:
+    checkExpr(e->left);
+    e->type = e->left->type;
+    if (e->type == BOOL_VALUE) {
+      error("cannot negate a boolean", e->offset);
+      e->type = INT_VALUE;
+    }
+    break;
+  default: {
+    static const char *const verbs[] = {"add", "subtract", "multiply",
+                                        "divide"};
+    checkExpr(e->left);
+    checkExpr(e->right);
+    e->type = checkNumbers(e->left, e->right, verbs[e->kind - ADD_EXPR],
+                           e->offset);
+    break;
+  }
+  }
+}
+
+static void checkCondition(Comparison &c) {
+  checkExpr(c.left);
+  checkExpr(c.right);
+  if (c.left->type == c.right->type)
+    return;
+  if (c.left->type == BOOL_VALUE || c.right->type == BOOL_VALUE) {
+    error("cannot compare a boolean with a number", c.left->offset);
+    return;
+  }
+  convert(c.left, REAL_VALUE, "real");
+  convert(c.right, REAL_VALUE, "real");
+}
+
+static void checkStmt(Stmt &s) {
+  switch (s.kind) {
+  case COMPOUND_STMT:
+    for (StmtPtr &statement : s.body)
+      checkStmt(*statement);
+    break;
+  case ASSIGN_STMT: {
+    checkExpr(s.value);
+    ValueType type = variableType(s.name);
+    convert(s.value, type,
+            std::string(typeName(type)) + " variable " + quoted(s.name));
+    break;
+  }
+  case IF_STMT:
+  case WHILE_STMT:
+    checkCondition(s.condition);
+    checkStmt(*s.branch);
+    if (s.elseBranch)
+      checkStmt(*s.elseBranch);
+    break;
+  case RETURN_STMT:
+    if (!s.value)
+      break;
+    checkExpr(s.value);
+    // A return in the main program only ends it
+    if (function != nullptr) {
+      uint8_t &bits = returns[functionIndex[functionSymbol]];
+      if (!final) {
+        bits |= 1 << s.value->type;
+      } else {
+        convert(s.value, function->type,
+                "the result of " + quoted(function->name) + ", which is " +
+                    typeName(function->type));
+      }
+    }
+    break;
+  case PRINT_STMT:
+    checkExpr(s.value);
+    break;
+  case SCAN_STMT:
+    for (ExprPtr &target : s.targets)
+      checkExpr(target);
+    break;
+  }
+}
+
+// Whether control can never reach the end of `s`
+static bool alwaysReturns(const Stmt &s) {
+  switch (s.kind) {
+  case RETURN_STMT:
+    return true;
+  case COMPOUND_STMT:
+    for (const StmtPtr &statement : s.body) {
+      if (alwaysReturns(*statement))
+        return true;
+    }
+    return false;
+  case IF_STMT:
+    return s.elseBranch && alwaysReturns(*s.branch) &&
+           alwaysReturns(*s.elseBranch);
+  default:
+    return false;
+  }
+}
+
+// Return types grow until no call's type changes; the last round then
+// inserts the conversions and reports
+std::vector<TypeError> checkTypes(Program &program) {
+  std::vector<TypeError> found;
+  errors = &found;
+  functionIndex.assign(symbolTable.symbols().size(), -1);
+  returns.assign(program.functions.size(), 0);
+  for (size_t i = 0; i < program.functions.size(); i++) {
+    FunctionDef &def = program.functions[i];
+    functionIndex[def.symbol] = i;
+    bool returned = false;
+    for (const StmtPtr &statement : def.body)
+      returned = returned || alwaysReturns(*statement);
+    // Falling off the end returns the integer 0
+    if (!returned)
+      returns[i] = INT_BIT;
+  }
+
+  auto checkFunctions = [&]() {
+    for (size_t i = 0; i < program.functions.size(); i++) {
+      FunctionDef &def = program.functions[i];
+      function = &def;
+      functionSymbol = def.symbol;
+      def.type = returnType(returns[i]);
+      for (StmtPtr &statement : def.body)
+        checkStmt(*statement);
+    }
+  };
+  final = false;
+  for (std::vector<uint8_t> before; before != returns;) {
+    before = returns;
+    checkFunctions();
+  }
+  final = true;
+  checkFunctions();
+
+  function = nullptr;
+  functionSymbol = -1;
+  for (StmtPtr &statement : program.statements)
+    checkStmt(*statement);
+  errors = nullptr;
+  return found;
+}
@@ -0,0 +1,24 @@
+#ifndef TYPE_CHECKER_HPP
+#define TYPE_CHECKER_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+
+struct TypeError {
+  std::string message;
+  size_t offset;
+};
+
+// Give every expression its static type from the declared qualifiers
+// (undeclared variables are integers) and every function the type it
+// returns, inferred from its return statements. Where an integer meets a
+// real (arithmetic, comparison, assignment, argument or return) a
+// TO_REAL_EXPR is inserted, so later stages never convert implicitly.
+// Names resolve through symbolTable. Returns the mismatches in the order
+// found; the program is only fit to run when there are none.
+std::vector<TypeError> checkTypes(Program &program);
+
+#endif
@@ -0,0 +1,468 @@
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "vm.hpp"
+
+static const size_t stackSize = 1 << 20; // values
+static const size_t maxCalls = 1 << 16;
+
+// A run-time value without its type: the instructions know it
+union Word {
+  int64_t integer;
+  double real;
+};
+
+struct Frame {
+  const int32_t *returnTo;
+  Word *base;
+};
+
+// Results of one pure function by argument tuple. Open addressing with
+// linear probing over a fixed table; when a key's probe window is full
+// its first slot is evicted, so the cache never grows.
+static const size_t memoSlots = 1 << 12;
+static const size_t memoProbes = 8;
+
+struct MemoCache {
+  int parameters = 0;
+  std::vector<Word> keys; // `parameters` values per slot
+  std::vector<Word> results;
+  std::vector<bool> used;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+};
+
+static size_t memoHome(const MemoCache &cache, const Word *args) {
+  uint64_t hash = 0x9e3779b97f4a7c15;
+  for (int i = 0; i < cache.parameters; i++) {
+    hash = (hash ^ uint64_t(args[i].integer)) * 0xff51afd7ed558ccd;
+    hash ^= hash >> 32;
+  }
+  return hash & (memoSlots - 1);
+}
+
+// Parameters have static types, so equal bits are equal arguments
+static bool memoMatches(const MemoCache &cache, size_t slot,
+                        const Word *args) {
+  const Word *key = &cache.keys[slot * cache.parameters];
+  for (int i = 0; i < cache.parameters; i++) {
+    if (key[i].integer != args[i].integer)
+      return false;
+  }
+  return true;
+}
+
+static const Word *memoFind(const MemoCache &cache, const Word *args) {
+  size_t home = memoHome(cache, args);
+  for (size_t probe = 0; probe < memoProbes; probe++) {
+    size_t slot = (home + probe) & (memoSlots - 1);
+    if (!cache.used[slot])
+      return nullptr;
+    if (memoMatches(cache, slot, args))
+      return &cache.results[slot];
+  }
+  return nullptr;
+}
+
+static void memoStore(MemoCache &cache, const Word *args, Word result) {
+  size_t home = memoHome(cache, args);
+  size_t slot = home;
+  for (size_t probe = 0; probe < memoProbes; probe++) {
+    size_t next = (home + probe) & (memoSlots - 1);
+    if (!cache.used[next] || memoMatches(cache, next, args)) {
+      slot = next;
+      break;
+    }
+  }
+  std::copy(args, args + cache.parameters,
+            cache.keys.begin() + slot * cache.parameters);
+  cache.results[slot] = result;
+  cache.used[slot] = true;
+}
+
+static bool readValue(InputBuffer &in, ValueType type, Word &v) {
+  if (type == INT_VALUE)
+    return in.scanInteger(v.integer);
+  if (type == REAL_VALUE)
+    return in.scanReal(v.real);
+  return in.scanBoolean(v.integer);
+}
+
+static uint64_t timestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// A call while profiling
+struct ProfileFrame {
+  int function;
+  int node; // caller's call stack
+  uint64_t entered;
+};
+
+struct VmState {
+  explicit VmState(const Bytecode &bytecode);
+
+  const Bytecode &bytecode;
+  std::vector<Word> constants;
+  std::vector<Word> globals;
+  std::vector<MemoCache> caches; // by function, kept between runs
+  std::vector<Word> memoKeys;    // arguments of memoized calls in progress
+  std::vector<Word> stack;
+  std::vector<Frame> frames;
+};
+
+VmState::VmState(const Bytecode &bytecode)
+    : bytecode(bytecode), globals(bytecode.globalTypes.size()),
+      caches(bytecode.functions.size()), stack(stackSize) {
+  for (const Value &v : bytecode.constants)
+    constants.push_back(v.type == REAL_VALUE ? Word{.real = v.real}
+                                             : Word{.integer = v.integer});
+  for (size_t i = 0; i < caches.size(); i++) {
+    if (!bytecode.functions[i].memoized)
+      continue;
+    MemoCache &cache = caches[i];
+    cache.parameters = bytecode.functions[i].parameters;
+    cache.keys.resize(memoSlots * cache.parameters);
+    cache.results.resize(memoSlots);
+    cache.used.assign(memoSlots, false);
+  }
+  frames.reserve(64);
+}
+
+// Dispatch is a computed goto per instruction: each handler jumps straight
+// to the next one through the label table. The compiler picked every
+// instruction by static type, so handlers work on raw words. The profiling
+// instance also counts and times every instruction and call; the other
+// compiles without any of it.
+template <bool profiling>
+static void execute(VmState &state, InputBuffer &in, OutputBuffer &out,
+                    RunStats *stats, Profile *profile) {
+  static void *const labels[OPCODE_COUNT] = {
+      &&CONST,          &&LOAD_GLOBAL,     &&STORE_GLOBAL,
+      &&LOAD_LOCAL,     &&STORE_LOCAL,     &&NEGATE_INT,
+      &&NEGATE_REAL,    &&ADD_INT,         &&ADD_REAL,
+      &&SUBTRACT_INT,   &&SUBTRACT_REAL,   &&MULTIPLY_INT,
+      &&MULTIPLY_REAL,  &&DIVIDE_INT,      &&DIVIDE_REAL,
+      &&TO_REAL,        &&EQUAL_INT,       &&EQUAL_REAL,
+      &&NOT_EQUAL_INT,  &&NOT_EQUAL_REAL,  &&GREATER_INT,
+      &&GREATER_REAL,   &&LESS_INT,        &&LESS_REAL,
+      &&LESS_EQUAL_INT, &&LESS_EQUAL_REAL, &&GREATER_EQUAL_INT,
+      &&GREATER_EQUAL_REAL, &&JUMP,        &&JUMP_IF_FALSE,
+      &&CALL,           &&RETURN,          &&MEMO_CALL,
+      &&MEMO_RETURN,    &&PRINT_INT,       &&PRINT_REAL,
+      &&PRINT_BOOL,     &&SCAN_GLOBAL,     &&SCAN_LOCAL,
+      &&HALT};
+
+  const Bytecode &bytecode = state.bytecode;
+  const int32_t *code = bytecode.code.data();
+  const FunctionCode *functions = bytecode.functions.data();
+  const Word *constants = state.constants.data();
+  std::vector<MemoCache> &caches = state.caches;
+  std::vector<Word> &memoKeys = state.memoKeys;
+  std::vector<Frame> &frames = state.frames;
+
+  // All zero bits: 0, 0.0 and false alike
+  std::fill(state.globals.begin(), state.globals.end(), Word{0});
+  Word *globals = state.globals.data();
+  for (MemoCache &cache : caches)
+    cache.hits = cache.misses = 0;
+  memoKeys.clear();
+  frames.clear();
+
+  Word *base = state.stack.data();
+  Word *sp = base;
+  Word *limit = base + state.stack.size();
+  if (size_t(bytecode.mainStack) > state.stack.size())
+    throw RuntimeError("expression too deep", bytecode.offsets[bytecode.entry]);
+
+  const int32_t *pc = code + bytecode.entry;
+  const int32_t *at = pc; // current instruction, for errors
+  uint64_t count = 0;
+  uint64_t calls = 0;
+
+  std::vector<ProfileFrame> profileFrames;
+  std::vector<int> active; // frames of each function on the stack
+  std::map<std::pair<int, int>, int> children; // call stack by parent, callee
+  int node = 0;           // current call stack
+  uint64_t last = 0;      // when the current instruction started
+  auto started = std::chrono::steady_clock::now();
+  uint64_t first = timestamp();
+  if constexpr (profiling) {
+    profile->counts.assign(bytecode.code.size(), 0);
+    profile->cycles.assign(bytecode.code.size(), 0);
+    profile->calls.assign(bytecode.functions.size(), 0);
+    profile->inclusive.assign(bytecode.functions.size(), 0);
+    profile->stacks = {{-1, -1, 0}};
+    active.assign(bytecode.functions.size(), 0);
+    last = first;
+  }
+  // Charge the running instruction up to now
+  auto charge = [&]() {
+    uint64_t now = timestamp();
+    profile->cycles[at - code] += now - last;
+    profile->stacks[node].self += now - last;
+    last = now;
+  };
+  auto finishProfile = [&]() {
+    charge();
+    profile->total = last - first;
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - started)
+                         .count();
+    profile->secondsPerCycle =
+        profile->total ? seconds / profile->total : 0;
+  };
+
+  auto fail = [&](const std::string &msg) {
+    out.flush();
+    if constexpr (profiling)
+      finishProfile();
+    throw RuntimeError(msg, bytecode.offsets[at - code]);
+  };
+
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    if constexpr (profiling) {                                                 \
+      charge();                                                                \
+      profile->counts[pc - code]++;                                            \
+    }                                                                          \
+    at = pc;                                                                   \
+    count++;                                                                   \
+    goto *labels[*pc++];                                                       \
+  } while (0)
+
+// Integers wrap
+#define INT_ARITHMETIC(op)                                                     \
+  sp--;                                                                        \
+  sp[-1].integer =                                                             \
+      int64_t(uint64_t(sp[-1].integer) op uint64_t(sp[0].integer));            \
+  DISPATCH();
+
+#define REAL_ARITHMETIC(op)                                                    \
+  sp--;                                                                        \
+  sp[-1].real = sp[-1].real op sp[0].real;                                     \
+  DISPATCH();
+
+#define COMPARE(field, op)                                                     \
+  sp--;                                                                        \
+  sp[-1].integer = sp[-1].field op sp[0].field;                                \
+  DISPATCH();
+
+  DISPATCH();
+
+CONST:
+  *sp++ = constants[*pc++];
+  DISPATCH();
+LOAD_GLOBAL:
+  *sp++ = globals[*pc++];
+  DISPATCH();
+STORE_GLOBAL:
+  globals[*pc++] = *--sp;
+  DISPATCH();
+LOAD_LOCAL:
+  *sp++ = base[*pc++];
+  DISPATCH();
+STORE_LOCAL:
+  base[*pc++] = *--sp;
+  DISPATCH();
+NEGATE_INT:
+  sp[-1].integer = int64_t(0 - uint64_t(sp[-1].integer));
+  DISPATCH();
+NEGATE_REAL:
+  sp[-1].real = -sp[-1].real;
+  DISPATCH();
+ADD_INT:
+  INT_ARITHMETIC(+)
+ADD_REAL:
+  REAL_ARITHMETIC(+)
+SUBTRACT_INT:
+  INT_ARITHMETIC(-)
+SUBTRACT_REAL:
+  REAL_ARITHMETIC(-)
+MULTIPLY_INT:
+  INT_ARITHMETIC(*)
+MULTIPLY_REAL:
+  REAL_ARITHMETIC(*)
+DIVIDE_INT: {
+  int64_t a = sp[-2].integer, b = sp[-1].integer;
+  sp--;
+  if (b == 0)
+    fail("division by zero");
+  // INT64_MIN / -1 wraps like the other operators
+  sp[-1].integer = b == -1 ? int64_t(0 - uint64_t(a)) : a / b;
+  DISPATCH();
+}
+DIVIDE_REAL:
+  REAL_ARITHMETIC(/)
+TO_REAL:
+  sp[-1].real = double(sp[-1].integer);
+  DISPATCH();
+EQUAL_INT:
+  COMPARE(integer, ==)
+EQUAL_REAL:
+  COMPARE(real, ==)
+NOT_EQUAL_INT:
+  COMPARE(integer, !=)
+NOT_EQUAL_REAL:
+  COMPARE(real, !=)
+GREATER_INT:
+  COMPARE(integer, >)
+GREATER_REAL:
+  COMPARE(real, >)
+LESS_INT:
+  COMPARE(integer, <)
+LESS_REAL:
+  COMPARE(real, <)
+LESS_EQUAL_INT:
+  COMPARE(integer, <=)
+LESS_EQUAL_REAL:
+  COMPARE(real, <=)
+GREATER_EQUAL_INT:
+  COMPARE(integer, >=)
+GREATER_EQUAL_REAL:
+  COMPARE(real, >=)
+JUMP:
+  pc = code + *pc;
+  DISPATCH();
+JUMP_IF_FALSE:
+  if ((--sp)->integer) {
+    pc++;
+  } else {
+    pc = code + *pc;
+  }
+  DISPATCH();
+CALL: {
+  int index = *pc++;
+  const FunctionCode &f = functions[index];
+  Word *callee = sp - f.parameters;
+  if (frames.size() >= maxCalls || limit - callee < f.frameSize)
+    fail("call stack overflow");
+  frames.push_back({pc, base});
+  if constexpr (profiling) {
+    profile->calls[index]++;
+    active[index]++;
+    profileFrames.push_back({index, node, last});
+    auto [it, added] =
+        children.emplace(std::make_pair(node, index), profile->stacks.size());
+    if (added)
+      profile->stacks.push_back({node, index, 0});
+    node = it->second;
+  }
+  calls++;
+  base = callee;
+  sp = callee + f.localTypes.size();
+  for (size_t i = f.parameters; i < f.localTypes.size(); i++)
+    base[i].integer = 0;
+  pc = code + f.entry;
+  DISPATCH();
+}
+RETURN: {
+  if constexpr (profiling) {
+    const ProfileFrame &call = profileFrames.back();
+    // Only the outermost of recursive calls counts toward inclusive time
+    if (--active[call.function] == 0)
+      profile->inclusive[call.function] += timestamp() - call.entered;
+    node = call.node;
+    profileFrames.pop_back();
+  }
+  Word result = sp[-1];
+  const Frame &frame = frames.back();
+  sp = base;
+  *sp++ = result;
+  base = frame.base;
+  pc = frame.returnTo;
+  frames.pop_back();
+  DISPATCH();
+}
+MEMO_CALL: {
+  MemoCache &cache = caches[*pc];
+  const Word *args = sp - cache.parameters;
+  if (const Word *result = memoFind(cache, args)) {
+    cache.hits++;
+    sp -= cache.parameters;
+    *sp++ = *result;
+    pc++;
+    DISPATCH();
+  }
+  cache.misses++;
+  memoKeys.insert(memoKeys.end(), args, args + cache.parameters);
+  goto CALL;
+}
+MEMO_RETURN: {
+  MemoCache &cache = caches[*pc];
+  size_t key = memoKeys.size() - cache.parameters;
+  memoStore(cache, memoKeys.data() + key, sp[-1]);
+  memoKeys.resize(key);
+  goto RETURN;
+}
+PRINT_INT:
+  out.printInteger((--sp)->integer);
+  DISPATCH();
+PRINT_REAL:
+  out.printReal((--sp)->real);
+  DISPATCH();
+PRINT_BOOL:
+  out.printBoolean((--sp)->integer);
+  DISPATCH();
+SCAN_GLOBAL:
+  if (!readValue(in, ValueType(pc[1]), globals[pc[0]]))
+    fail(std::string("scan expected a value of type ") +
+         typeName(ValueType(pc[1])));
+  pc += 2;
+  DISPATCH();
+SCAN_LOCAL:
+  if (!readValue(in, ValueType(pc[1]), base[pc[0]]))
+    fail(std::string("scan expected a value of type ") +
+         typeName(ValueType(pc[1])));
+  pc += 2;
+  DISPATCH();
+HALT:
+  if constexpr (profiling)
+    finishProfile();
+  out.flush();
+  if (stats != nullptr) {
+    stats->instructions += count;
+    stats->calls += calls;
+    for (size_t i = 0; i < caches.size(); i++) {
+      if (functions[i].memoized)
+        stats->memo.push_back({functions[i].name, caches[i].hits,
+                               caches[i].misses});
+    }
+  }
+
+#undef DISPATCH
+#undef INT_ARITHMETIC
+#undef REAL_ARITHMETIC
+#undef COMPARE
+}
+
+VmContext::VmContext(const Bytecode &bytecode)
+    : state(new VmState(bytecode)) {}
+
+VmContext::~VmContext() = default;
+
+void VmContext::run(InputBuffer &in, OutputBuffer &out, RunStats *stats,
+                    Profile *profile) {
+  if (profile != nullptr) {
+    execute<true>(*state, in, out, stats, profile);
+  } else {
+    execute<false>(*state, in, out, stats, profile);
+  }
+}
+
+void runProgram(const Bytecode &bytecode, std::istream &in, std::ostream &out,
+                RunStats *stats, Profile *profile) {
+  InputBuffer input(in);
+  OutputBuffer output(out);
+  VmContext(bytecode).run(input, output, stats, profile);
+}
@@ -0,0 +1,63 @@
+#ifndef VM_HPP
+#define VM_HPP
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "profiler.hpp"
+#include "runtime_io.hpp"
+
+// An error while running: a bad operand type, division by zero, bad scan
+// input or too deep recursion
+struct RuntimeError : std::runtime_error {
+  RuntimeError(const std::string &msg, size_t offset)
+      : std::runtime_error(msg), offset(offset) {}
+  size_t offset;
+};
+
+// Result cache use of one memoized function
+struct MemoStats {
+  uint32_t name;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+};
+
+struct RunStats {
+  uint64_t instructions = 0;
+  uint64_t calls = 0;
+  std::vector<MemoStats> memo;
+};
+
+struct VmState;
+
+// Everything one running program needs: globals, the value stack, frames
+// and the memo caches. Allocated once, so running the same program many
+// times (each run starting afresh) costs no allocation; results cached
+// for pure functions stay valid and are kept. One context per thread.
+class VmContext {
+public:
+  explicit VmContext(const Bytecode &bytecode);
+  ~VmContext();
+
+  // Scan reads from `in` and print writes to `out`, which is flushed when
+  // the program stops, also on a run-time error. With a profile,
+  // every instruction is counted and timed into it (also when a run-time
+  // error stops the program).
+  void run(InputBuffer &in, OutputBuffer &out, RunStats *stats = nullptr,
+           Profile *profile = nullptr);
+
+private:
+  std::unique_ptr<VmState> state;
+};
+
+// Run a compiled program once in a fresh context, on streams
+void runProgram(const Bytecode &bytecode, std::istream &in, std::ostream &out,
+                RunStats *stats = nullptr, Profile *profile = nullptr);
+
+#endif
@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "batch_reader.hpp"
+#include "string_table.hpp"
+#include "syntax_analyzer.hpp"
+#include "xref_index.hpp"
+
+const char *const xrefKindNames[] = {
+    "function", "global",  "parameter", "local",
+    "assign",   "read",    "call",      "scan"};
+
+static const char xrefMagic[4] = {'R', 'X', 'R', 'F'};
+static const uint32_t xrefVersion = 1;
+
+XrefIndex::~XrefIndex() { close(); }
+
+void XrefIndex::close() {
+  if (map != nullptr)
+    munmap(map, mapSize);
+  map = nullptr;
+  header = nullptr;
+}
+
+bool XrefIndex::open(const std::string &path, std::string &error,
+                     bool verify) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error = path + ": " + strerror(errno);
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(XrefHeader)) {
+    ::close(fd);
+    error = path + ": not an index";
+    return false;
+  }
+  mapSize = info.st_size;
+  map = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    map = nullptr;
+    error = path + ": " + strerror(errno);
+    return false;
+  }
+
+  const char *data = static_cast<const char *>(map);
+  header = reinterpret_cast<const XrefHeader *>(data);
+  // Each table must fit in what is left of the file, counted so that a
+  // huge count cannot wrap around
+  size_t left = mapSize - sizeof(XrefHeader);
+  auto take = [&](uint64_t count, size_t each) {
+    if (count > left / each)
+      return false;
+    left -= count * each;
+    return true;
+  };
+  if (memcmp(header->magic, xrefMagic, sizeof xrefMagic) != 0 ||
+      header->version != xrefVersion ||
+      !take(header->fileCount, sizeof(XrefFile)) ||
+      !take(header->nameCount, sizeof(XrefName)) ||
+      !take(header->postingCount, sizeof(XrefPosting)) ||
+      header->stringsSize != left) {
+    close();
+    error = path + ": not an index, or written by another version";
+    return false;
+  }
+  fileTable = reinterpret_cast<const XrefFile *>(data + sizeof(XrefHeader));
+  nameTable = reinterpret_cast<const XrefName *>(fileTable + header->fileCount);
+  postingTable =
+      reinterpret_cast<const XrefPosting *>(nameTable + header->nameCount);
+  strings = reinterpret_cast<const char *>(postingTable + header->postingCount);
+  if (verify && !entriesValid()) {
+    close();
+    error = path + ": damaged index";
+    return false;
+  }
+  return true;
+}
+
+// Every string, posting range, file number and kind in range
+bool XrefIndex::entriesValid() const {
+  uint64_t stringsSize = header->stringsSize;
+  auto inStrings = [&](uint64_t at, uint64_t length) {
+    return at <= stringsSize && length <= stringsSize - at;
+  };
+  for (const XrefFile &file : files()) {
+    if (!inStrings(file.path, file.pathLength))
+      return false;
+  }
+  for (const XrefName &name : names()) {
+    if (!inStrings(name.text, name.length) ||
+        name.first + uint64_t(name.count) > header->postingCount)
+      return false;
+  }
+  for (const XrefPosting &posting : postings()) {
+    if (posting.file >= header->fileCount || posting.kind > SCAN_USE)
+      return false;
+  }
+  return true;
+}
+
+std::span<const XrefPosting> XrefIndex::find(std::string_view name) const {
+  std::span<const XrefName> table = names();
+  auto found = std::lower_bound(
+      table.begin(), table.end(), name,
+      [&](const XrefName &entry, std::string_view key) {
+        return text(entry) < key;
+      });
+  if (found == table.end() || text(*found) != name ||
+      found->first + uint64_t(found->count) > header->postingCount)
+    return {};
+  return {postingTable + found->first, found->count};
+}
+
+// An occurrence while the index is built, its name numbered by Names
+struct Occurrence {
+  uint32_t name;
+  XrefPosting posting;
+};
+
+// Distinct names, numbered as first seen. Texts point into the identifier
+// table or the previous index.
+struct Names {
+  std::unordered_map<std::string_view, uint32_t> numbers;
+  std::vector<std::string_view> texts;
+  std::vector<int64_t> identifierNumbers; // by identifiers ID, or -1
+
+  uint32_t number(std::string_view text) {
+    auto found = numbers.emplace(text, texts.size());
+    if (found.second)
+      texts.push_back(text);
+    return found.first->second;
+  }
+
+  uint32_t identifier(uint32_t id) {
+    if (id >= identifierNumbers.size())
+      identifierNumbers.resize(identifiers.size(), -1);
+    if (identifierNumbers[id] < 0)
+      identifierNumbers[id] = number(identifiers.name(id));
+    return identifierNumbers[id];
+  }
+};
+
+static bool fileStatus(const std::string &path, XrefFile &file) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0)
+    return false;
+  file.size = info.st_size;
+  file.mtime = int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+  return true;
+}
+
+// Definitions and uses of the program just parsed, in offset order
+static void collect(Source &source, uint32_t file, Names &names,
+                    std::vector<Occurrence> &occurrences) {
+  auto add = [&](uint32_t name, size_t offset, int kind) {
+    Location at = source.locate(offset);
+    XrefPosting posting = {offset, file, uint32_t(at.line),
+                           uint32_t(at.column), uint8_t(kind)};
+    occurrences.push_back({names.identifier(name), posting});
+  };
+  for (const Symbol &symbol : symbolTable.symbols())
+    add(symbol.name, symbol.offset, int(FUNCTION_DEFINITION) + symbol.kind);
+  for (const Reference &ref : symbolTable.references())
+    add(ref.name, ref.offset, int(ASSIGN_USE) + ref.kind);
+  std::stable_sort(occurrences.begin(), occurrences.end(),
+                   [](const Occurrence &a, const Occurrence &b) {
+                     return a.posting.offset < b.posting.offset;
+                   });
+}
+
+bool buildXrefIndex(const std::string &indexPath,
+                    const std::vector<std::string> &paths, std::ostream &report,
+                    XrefBuildStats &stats, std::string &error) {
+  XrefIndex previous;
+  std::string ignored;
+  // A missing or damaged index just means no reuse
+  previous.open(indexPath, ignored, true);
+
+  // Match each file against its old entry by path, size and time
+  std::vector<int64_t> reuse(previous.files().size(), -1); // old to new
+  std::vector<XrefFile> files(paths.size());
+  std::vector<bool> usable(paths.size(), false);
+  std::vector<std::string> changed;
+  std::unordered_map<std::string, uint32_t> changedIndex; // path to file
+  {
+    std::vector<std::pair<std::string_view, size_t>> old;
+    for (size_t i = 0; i < previous.files().size(); i++)
+      old.push_back({previous.path(previous.files()[i]), i});
+    std::sort(old.begin(), old.end());
+
+    std::unordered_set<std::string_view> seen;
+    for (size_t i = 0; i < paths.size(); i++) {
+      if (!seen.insert(paths[i]).second)
+        continue; // a path given twice is indexed once
+      if (!fileStatus(paths[i], files[i])) {
+        report << paths[i] << ": " << strerror(errno) << '\n';
+        stats.failed++;
+        continue;
+      }
+      auto found = std::lower_bound(
+          old.begin(), old.end(), std::pair<std::string_view, size_t>(paths[i], 0));
+      if (found != old.end() && found->first == paths[i]) {
+        const XrefFile &entry = previous.files()[found->second];
+        if (entry.size == files[i].size && entry.mtime == files[i].mtime &&
+            reuse[found->second] < 0) {
+          reuse[found->second] = i;
+          usable[i] = true;
+          stats.unchanged++;
+          continue;
+        }
+      }
+      changedIndex[paths[i]] = i;
+      changed.push_back(paths[i]);
+    }
+  }
+
+  // Kept by file, and each file's in offset order for every name: the old
+  // index has them so, and collect() sorts a parsed file's
+  Names names;
+  std::vector<std::vector<Occurrence>> occurrences(paths.size());
+  for (const XrefName &name : previous.names()) {
+    uint32_t number = names.number(previous.text(name));
+    for (uint32_t i = 0; i < name.count; i++) {
+      const XrefPosting &posting = previous.postings()[name.first + i];
+      if (reuse[posting.file] >= 0)
+        occurrences[reuse[posting.file]].push_back({number, posting});
+    }
+  }
+
+  // Parse the rest without the trace; bodies must be parsed for their uses
+  bool savedDebug = debug;
+  bool savedLazy = lazyBodies;
+  debug = false;
+  lazyBodies = false;
+  symbolTable.keepReferences = true;
+  BatchReader reader;
+  reader.run(changed, [&](const std::string &path, const char *data,
+                          size_t size, int err) {
+    // Files complete in any order
+    uint32_t file = changedIndex[path];
+    if (err != 0) {
+      report << path << ": " << strerror(err) << '\n';
+      stats.failed++;
+      return;
+    }
+    Source source(data, size);
+    try {
+      parseSource(source);
+    } catch (const SyntaxError &e) {
+      report << path << ": " << e.what() << '\n';
+      stats.failed++;
+      return;
+    }
+    collect(source, file, names, occurrences[file]);
+    usable[file] = true;
+    stats.parsed++;
+  });
+  debug = savedDebug;
+  lazyBodies = savedLazy;
+  symbolTable.keepReferences = false;
+
+  // Files left out are dropped from the file table, so renumber
+  std::vector<XrefFile> fileTable;
+  std::string strings;
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (!usable[i])
+      continue;
+    files[i].path = strings.size();
+    files[i].pathLength = paths[i].size();
+    strings += paths[i];
+    fileTable.push_back(files[i]);
+  }
+
+  // Names that still occur sorted by text, then each one's postings placed
+  // by walking the files in order, so no posting is compared with another
+  std::vector<uint32_t> counts(names.texts.size());
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (usable[i]) {
+      for (const Occurrence &occurrence : occurrences[i])
+        counts[occurrence.name]++;
+    }
+  }
+  std::vector<uint32_t> order;
+  for (uint32_t i = 0; i < counts.size(); i++) {
+    if (counts[i] > 0)
+      order.push_back(i);
+  }
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return names.texts[a] < names.texts[b];
+  });
+  std::vector<XrefName> nameTable(order.size());
+  std::vector<uint32_t> next(names.texts.size()); // posting, by name number
+  uint32_t first = 0;
+  for (uint32_t i = 0; i < order.size(); i++) {
+    std::string_view text = names.texts[order[i]];
+    nameTable[i] = {uint32_t(strings.size()), uint32_t(text.size()), first,
+                    counts[order[i]]};
+    strings += text;
+    next[order[i]] = first;
+    first += counts[order[i]];
+  }
+  std::vector<XrefPosting> postingTable(first);
+  uint32_t file = 0;
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (!usable[i])
+      continue;
+    for (const Occurrence &occurrence : occurrences[i]) {
+      XrefPosting &posting = postingTable[next[occurrence.name]++];
+      posting = occurrence.posting;
+      posting.file = file;
+    }
+    file++;
+  }
+
+  XrefHeader header = {};
+  memcpy(header.magic, xrefMagic, sizeof xrefMagic);
+  header.version = xrefVersion;
+  header.fileCount = fileTable.size();
+  header.nameCount = nameTable.size();
+  header.postingCount = postingTable.size();
+  header.stringsSize = strings.size();
+
+  std::string temporary = indexPath + ".tmp";
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof header);
+    out.write(reinterpret_cast<const char *>(fileTable.data()),
+              fileTable.size() * sizeof(XrefFile));
+    out.write(reinterpret_cast<const char *>(nameTable.data()),
+              nameTable.size() * sizeof(XrefName));
+    out.write(reinterpret_cast<const char *>(postingTable.data()),
+              postingTable.size() * sizeof(XrefPosting));
+    out.write(strings.data(), strings.size());
+    if (!out.flush()) {
+      error = temporary + ": write failed";
+      return false;
+    }
+  }
+  if (rename(temporary.c_str(), indexPath.c_str()) != 0) {
+    error = indexPath + ": " + strerror(errno);
+    return false;
+  }
+  stats.names = nameTable.size();
+  stats.postings = postingTable.size();
+  return true;
+}
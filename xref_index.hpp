@@ -0,0 +1,138 @@
+#ifndef XREF_INDEX_HPP
+#define XREF_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// What an occurrence of an identifier is. Definitions are in SymbolKind
+// order, uses in ReferenceKind order.
+enum XrefKind : uint8_t {
+  FUNCTION_DEFINITION,
+  GLOBAL_DEFINITION,
+  PARAMETER_DEFINITION,
+  LOCAL_DEFINITION,
+  ASSIGN_USE,
+  READ_USE,
+  CALL_USE,
+  SCAN_USE
+};
+
+extern const char *const xrefKindNames[];
+
+// The index file is used in place once mapped, so every record has fixed
+// size and natural alignment, in the byte order of the machine that wrote
+// it:
+//
+//   XrefHeader
+//   XrefFile[fileCount]      indexed files, in the order given
+//   XrefName[nameCount]      sorted by name text
+//   XrefPosting[postingCount] grouped by name, each group by file and offset
+//   stringsSize bytes        paths and names, not terminated
+struct XrefHeader {
+  char magic[4]; // "RXRF"
+  uint32_t version;
+  uint32_t fileCount;
+  uint32_t nameCount;
+  uint64_t postingCount;
+  uint64_t stringsSize;
+};
+
+struct XrefFile {
+  uint64_t size;  // what the file was when parsed; a change in either
+  int64_t mtime;  // means it is parsed again. Nanoseconds.
+  uint32_t path;  // in the strings
+  uint32_t pathLength;
+};
+
+struct XrefName {
+  uint32_t text; // in the strings
+  uint32_t length;
+  uint32_t first; // posting
+  uint32_t count;
+};
+
+struct XrefPosting {
+  uint64_t offset;
+  uint32_t file;
+  uint32_t line;
+  uint32_t column;
+  uint8_t kind; // XrefKind
+  uint8_t padding[3];
+};
+
+// A mapped index file. Lookups binary search the name table in place, so
+// nothing is read until it is touched.
+class XrefIndex {
+public:
+  XrefIndex() = default;
+  ~XrefIndex();
+  XrefIndex(const XrefIndex &) = delete;
+  XrefIndex &operator=(const XrefIndex &) = delete;
+
+  // False with the reason if the file is missing or not a valid index.
+  // The tables' extents are always checked; `verify` checks every entry as
+  // well, for a caller that reads them all, and leaves nothing open if one
+  // is out of range. Otherwise entries are checked as they are used.
+  bool open(const std::string &path, std::string &error, bool verify = false);
+
+  // Postings of a name; none if it does not occur
+  std::span<const XrefPosting> find(std::string_view name) const;
+
+  std::span<const XrefFile> files() const { return {fileTable, fileCount()}; }
+  std::span<const XrefName> names() const { return {nameTable, nameCount()}; }
+  std::span<const XrefPosting> postings() const {
+    return {postingTable, header ? size_t(header->postingCount) : 0};
+  }
+  // Empty if the entry points outside the strings
+  std::string_view path(const XrefFile &file) const {
+    return piece(file.path, file.pathLength);
+  }
+  std::string_view text(const XrefName &name) const {
+    return piece(name.text, name.length);
+  }
+
+private:
+  std::string_view piece(uint64_t at, uint64_t length) const {
+    if (header == nullptr || at > header->stringsSize ||
+        length > header->stringsSize - at)
+      return {};
+    return {strings + at, size_t(length)};
+  }
+  bool entriesValid() const;
+  void close();
+  size_t fileCount() const { return header ? header->fileCount : 0; }
+  size_t nameCount() const { return header ? header->nameCount : 0; }
+
+  void *map = nullptr;
+  size_t mapSize = 0;
+  const XrefHeader *header = nullptr;
+  const XrefFile *fileTable = nullptr;
+  const XrefName *nameTable = nullptr;
+  const XrefPosting *postingTable = nullptr;
+  const char *strings = nullptr;
+};
+
+struct XrefBuildStats {
+  size_t parsed = 0;
+  size_t unchanged = 0; // postings taken from the previous index
+  size_t failed = 0;
+  size_t names = 0;
+  size_t postings = 0;
+};
+
+// Index the definitions and uses of every identifier in `paths` into the
+// file at `indexPath`. A file whose size and modification time match its
+// entry in the index already there keeps its postings from it; the others
+// are parsed. Files that cannot be read or parsed are reported to `report`
+// and left out, so the next update tries them again. The new index
+// replaces the old one in a single rename.
+bool buildXrefIndex(const std::string &indexPath,
+                    const std::vector<std::string> &paths, std::ostream &report,
+                    XrefBuildStats &stats, std::string &error);
+
+#endif